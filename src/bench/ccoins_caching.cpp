@@ -5,9 +5,12 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <script/signingprovider.h>
 #include <test/util/transaction_utils.h>
 
+#include <cassert>
+#include <unordered_map>
 #include <vector>
 
 // Microbenchmark for simple accesses to a CCoinsViewCache database. Note from
@@ -52,3 +55,112 @@ static void CCoinsCaching(benchmark::Bench& bench)
 }
 
 BENCHMARK(CCoinsCaching);
+
+// Benchmarks for the map of a CCoinsViewCache, comparing CCoinsMap with the
+// node based std::unordered_map it replaced. They use 1M entries by default;
+// run with -asymptote=1000000,10000000,50000000 to compare at larger sizes
+// (the last needs well over 10 GB of memory).
+struct NodeMap {
+    std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> map;
+};
+
+struct FlatMap {
+    CCoinsMap map;
+};
+
+static size_t NumCoins(const benchmark::Bench& bench)
+{
+    return bench.complexityN() > 1 ? static_cast<size_t>(bench.complexityN()) : 1000000;
+}
+
+static std::vector<COutPoint> RandomOutPoints(size_t count, FastRandomContext& rng)
+{
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        outpoints.emplace_back(rng.rand256(), rng.randrange(4));
+    }
+    return outpoints;
+}
+
+template <typename Map>
+static void FillCoinsMap(Map& map, const std::vector<COutPoint>& outpoints)
+{
+    // A P2WPKH output, whose script fits in the Coin itself.
+    const CScript script = CScript() << OP_0 << std::vector<unsigned char>(20, 1);
+    for (const COutPoint& outpoint : outpoints) {
+        CCoinsCacheEntry& entry = map[outpoint];
+        entry.coin = Coin(CTxOut(outpoint.n, script), 1, false);
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+}
+
+template <typename Holder>
+static void CoinsMapLookup(benchmark::Bench& bench)
+{
+    FastRandomContext rng(true);
+    const std::vector<COutPoint> outpoints = RandomOutPoints(NumCoins(bench), rng);
+    Holder holder;
+    FillCoinsMap(holder.map, outpoints);
+
+    // Half of the lookups are for coins that are not in the map.
+    std::vector<COutPoint> queries = RandomOutPoints(10000, rng);
+    for (size_t i = 0; i < queries.size(); i += 2) {
+        queries[i] = outpoints[rng.randrange(outpoints.size())];
+    }
+
+    size_t found = 0;
+    bench.batch(queries.size()).unit("lookup").run([&] {
+        for (const COutPoint& outpoint : queries) {
+            found += holder.map.find(outpoint) != holder.map.end();
+        }
+    });
+    assert(found > 0);
+}
+
+template <typename Holder>
+static void CoinsMapInsert(benchmark::Bench& bench)
+{
+    FastRandomContext rng(true);
+    const std::vector<COutPoint> outpoints = RandomOutPoints(NumCoins(bench), rng);
+
+    bench.batch(outpoints.size()).unit("insert").epochs(3).epochIterations(1).run([&] {
+        Holder holder;
+        FillCoinsMap(holder.map, outpoints);
+        assert(holder.map.size() == outpoints.size());
+    });
+}
+
+template <typename Holder>
+static void CoinsMapFlush(benchmark::Bench& bench)
+{
+    FastRandomContext rng(true);
+    const std::vector<COutPoint> outpoints = RandomOutPoints(NumCoins(bench), rng);
+    Holder holder;
+    FillCoinsMap(holder.map, outpoints);
+
+    // Walk all entries and clear the DIRTY flag, as CCoinsViewCache::Sync()
+    // does after writing them to the database.
+    bench.batch(outpoints.size()).unit("entry").epochs(3).run([&] {
+        CAmount total = 0;
+        for (auto& entry : holder.map) {
+            total += entry.second.coin.out.nValue;
+            entry.second.flags ^= CCoinsCacheEntry::DIRTY;
+        }
+        assert(total > 0);
+    });
+}
+
+static void CoinsMapLookupNode(benchmark::Bench& bench) { CoinsMapLookup<NodeMap>(bench); }
+static void CoinsMapLookupFlat(benchmark::Bench& bench) { CoinsMapLookup<FlatMap>(bench); }
+static void CoinsMapInsertNode(benchmark::Bench& bench) { CoinsMapInsert<NodeMap>(bench); }
+static void CoinsMapInsertFlat(benchmark::Bench& bench) { CoinsMapInsert<FlatMap>(bench); }
+static void CoinsMapFlushNode(benchmark::Bench& bench) { CoinsMapFlush<NodeMap>(bench); }
+static void CoinsMapFlushFlat(benchmark::Bench& bench) { CoinsMapFlush<FlatMap>(bench); }
+
+BENCHMARK(CoinsMapLookupNode);
+BENCHMARK(CoinsMapLookupFlat);
+BENCHMARK(CoinsMapInsertNode);
+BENCHMARK(CoinsMapInsertFlat);
+BENCHMARK(CoinsMapFlushNode);
+BENCHMARK(CoinsMapFlushFlat);
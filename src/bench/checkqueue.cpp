@@ -19,35 +19,35 @@ static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
 static const unsigned int QUEUE_BATCH_SIZE = 128;
 
+namespace {
+struct PrevectorJob {
+    prevector<PREVECTOR_SIZE, uint8_t> p;
+    PrevectorJob(){
+    }
+    explicit PrevectorJob(FastRandomContext& insecure_rand){
+        p.resize(insecure_rand.randrange(PREVECTOR_SIZE*2));
+    }
+    bool operator()()
+    {
+        return true;
+    }
+    void swap(PrevectorJob& x){p.swap(x.p);};
+};
+} // namespace
+
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
 // and there is a little bit of work done between calls to Add.
-static void CCheckQueueSpeedPrevectorJob(benchmark::Bench& bench)
+static void CCheckQueuePrevectorJob(benchmark::Bench& bench, int threads)
 {
-    // We shouldn't ever be running with the checkqueue on a single core machine.
-    if (GetNumCores() <= 1) return;
-
     const ECCVerifyHandle verify_handle;
     ECC_Start();
 
-    struct PrevectorJob {
-        prevector<PREVECTOR_SIZE, uint8_t> p;
-        PrevectorJob(){
-        }
-        explicit PrevectorJob(FastRandomContext& insecure_rand){
-            p.resize(insecure_rand.randrange(PREVECTOR_SIZE*2));
-        }
-        bool operator()()
-        {
-            return true;
-        }
-        void swap(PrevectorJob& x){p.swap(x.p);};
-    };
     CCheckQueue<PrevectorJob> queue {QUEUE_BATCH_SIZE};
     boost::thread_group tg;
     // The main thread should be counted to prevent thread oversubscription, and
     // to decrease the variance of benchmark results.
-    for (auto x = 0; x < GetNumCores() - 1; ++x) {
+    for (auto x = 0; x < threads - 1; ++x) {
        tg.create_thread([&]{queue.Thread();});
     }
 
@@ -74,4 +74,32 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::Bench& bench)
     tg.join_all();
     ECC_Stop();
 }
+
+static void CCheckQueueSpeedPrevectorJob(benchmark::Bench& bench)
+{
+    // We shouldn't ever be running with the checkqueue on a single core machine.
+    if (GetNumCores() <= 1) return;
+    CCheckQueuePrevectorJob(bench, GetNumCores());
+}
+
+// Fixed thread counts, including the main thread, to measure how the queue
+// scales independently of the machine the benchmark runs on.
+static void CCheckQueuePrevectorJob_2THREADS(benchmark::Bench& bench)
+{
+    CCheckQueuePrevectorJob(bench, 2);
+}
+
+static void CCheckQueuePrevectorJob_8THREADS(benchmark::Bench& bench)
+{
+    CCheckQueuePrevectorJob(bench, 8);
+}
+
+static void CCheckQueuePrevectorJob_32THREADS(benchmark::Bench& bench)
+{
+    CCheckQueuePrevectorJob(bench, 32);
+}
+
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueuePrevectorJob_2THREADS);
+BENCHMARK(CCheckQueuePrevectorJob_8THREADS);
+BENCHMARK(CCheckQueuePrevectorJob_32THREADS);
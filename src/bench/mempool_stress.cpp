@@ -6,7 +6,9 @@
 #include <policy/policy.h>
 #include <test/util/setup_common.h>
 #include <txmempool.h>
+#include <util/memory.h>
 
+#include <memory>
 #include <vector>
 
 static void AddTx(const CTransactionRef& tx, CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
@@ -26,14 +28,8 @@ struct Available {
     Available(CTransactionRef& ref, size_t tx_count) : ref(ref), tx_count(tx_count){}
 };
 
-static void ComplexMemPool(benchmark::Bench& bench)
+static std::vector<CTransactionRef> CreateOrderedCoins(FastRandomContext& det_rand, int childTxs)
 {
-    int childTxs = 800;
-    if (bench.complexityN() > 1) {
-        childTxs = static_cast<int>(bench.complexityN());
-    }
-
-    FastRandomContext det_rand{true};
     std::vector<Available> available_coins;
     std::vector<CTransactionRef> ordered_coins;
     // Create some base transactions
@@ -56,7 +52,7 @@ static void ComplexMemPool(benchmark::Bench& bench)
         size_t n_ancestors = det_rand.randrange(10)+1;
         for (size_t ancestor = 0; ancestor < n_ancestors && !available_coins.empty(); ++ancestor){
             size_t idx = det_rand.randrange(available_coins.size());
-            Available coin = available_coins[idx];
+            Available& coin = available_coins[idx];
             uint256 hash = coin.ref->GetHash();
             // biased towards taking just one ancestor, but maybe more
             size_t n_to_take = det_rand.randrange(2) == 0 ? 1 : 1+det_rand.randrange(coin.ref->vout.size() - coin.vin_left);
@@ -66,7 +62,7 @@ static void ComplexMemPool(benchmark::Bench& bench)
                 tx.vin.back().scriptSig = CScript() << coin.tx_count;
                 tx.vin.back().scriptWitness.stack.push_back(CScriptNum(coin.tx_count).getvch());
             }
-            if (coin.vin_left == coin.ref->vin.size()) {
+            if (coin.vin_left == coin.ref->vout.size()) {
                 coin = available_coins.back();
                 available_coins.pop_back();
             }
@@ -79,6 +75,18 @@ static void ComplexMemPool(benchmark::Bench& bench)
         ordered_coins.emplace_back(MakeTransactionRef(tx));
         available_coins.emplace_back(ordered_coins.back(), tx_counter++);
     }
+    return ordered_coins;
+}
+
+static void ComplexMemPool(benchmark::Bench& bench)
+{
+    int childTxs = 800;
+    if (bench.complexityN() > 1) {
+        childTxs = static_cast<int>(bench.complexityN());
+    }
+
+    FastRandomContext det_rand{true};
+    const std::vector<CTransactionRef> ordered_coins = CreateOrderedCoins(det_rand, childTxs);
     TestingSetup test_setup;
     CTxMemPool pool;
     LOCK2(cs_main, pool.cs);
@@ -91,4 +99,38 @@ static void ComplexMemPool(benchmark::Bench& bench)
     });
 }
 
+static void MempoolConnectBlock(benchmark::Bench& bench)
+{
+    FastRandomContext det_rand{true};
+    const std::vector<CTransactionRef> ordered_coins = CreateOrderedCoins(det_rand, 2000);
+    // Transactions are ordered after their parents, so the oldest ones make up
+    // a block that can be connected with the rest staying in the mempool
+    const std::vector<CTransactionRef> block(ordered_coins.begin(), ordered_coins.begin() + 700);
+    TestingSetup test_setup;
+
+    /* Connect the block against a new full mempool in every iteration, since
+     * removing the block's transactions changes the mempool for the next one. */
+    bench.epochs(5).epochIterations(1);
+
+    std::vector<std::unique_ptr<CTxMemPool>> pools;
+    LOCK(cs_main);
+    for (uint64_t i = 0; i < bench.epochs() * bench.epochIterations(); ++i) {
+        pools.push_back(MakeUnique<CTxMemPool>());
+        LOCK(pools.back()->cs);
+        for (auto& tx : ordered_coins) {
+            AddTx(tx, *pools.back());
+        }
+    }
+
+    uint64_t i = 0;
+    bench.run([&]() NO_THREAD_SAFETY_ANALYSIS {
+        CTxMemPool& pool = *pools.at(i);
+        LOCK(pool.cs);
+        pool.removeForBlock(block, 2);
+        assert(pool.size() == ordered_coins.size() - block.size());
+        ++i;
+    });
+}
+
 BENCHMARK(ComplexMemPool);
+BENCHMARK(MempoolConnectBlock);
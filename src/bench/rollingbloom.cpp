@@ -5,6 +5,14 @@
 
 #include <bench/bench.h>
 #include <bloom.h>
+#include <random.h>
+#include <uint256.h>
+
+#include <cassert>
+#include <vector>
+
+//! About the number of transactions announced in one inv message
+static constexpr size_t INV_BATCH_SIZE = 64;
 
 static void RollingBloom(benchmark::Bench& bench)
 {
@@ -35,5 +43,36 @@ static void RollingBloomReset(benchmark::Bench& bench)
     });
 }
 
+/** Look up the txids of an inv message, half of them known, like filterInventoryKnown does. */
+static void RollingBloomContainsBatch(benchmark::Bench& bench)
+{
+    CRollingBloomFilter filter(50000, 0.000001);
+    FastRandomContext rng(/* fDeterministic */ true);
+    for (int i = 0; i < 50000; ++i) filter.insert(rng.rand256());
+    std::vector<uint256> hashes(INV_BATCH_SIZE);
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        hashes[i] = rng.rand256();
+        if (i % 2) filter.insert(hashes[i]);
+    }
+    bench.batch(hashes.size()).unit("key").run([&] {
+        const std::vector<bool> result = filter.contains(hashes);
+        assert(result[1]);
+    });
+}
+
+static void RollingBloomInsertBatch(benchmark::Bench& bench)
+{
+    CRollingBloomFilter filter(50000, 0.000001);
+    FastRandomContext rng(/* fDeterministic */ true);
+    std::vector<uint256> hashes(INV_BATCH_SIZE);
+    for (auto& hash : hashes) hash = rng.rand256();
+    bench.batch(hashes.size()).unit("key").run([&] {
+        hashes[0] = rng.rand256();
+        filter.insert(hashes);
+    });
+}
+
 BENCHMARK(RollingBloom);
 BENCHMARK(RollingBloomReset);
+BENCHMARK(RollingBloomContainsBatch);
+BENCHMARK(RollingBloomInsertBatch);
@@ -0,0 +1,123 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcache.h>
+
+#include <blockencodings.h>
+#include <core_memusage.h>
+#include <memusage.h>
+#include <streams.h>
+#include <version.h>
+
+#include <algorithm>
+
+namespace {
+
+template <typename Entries>
+auto FindEntry(Entries& entries, const uint256& hash)
+{
+    return std::find_if(entries.begin(), entries.end(), [&hash](const auto& entry) { return entry.hash == hash; });
+}
+
+} // namespace
+
+RecentBlockCache::RecentBlockCache(size_t max_blocks, size_t max_memory)
+    : m_max_blocks(max_blocks), m_max_memory(max_memory) {}
+
+void RecentBlockCache::Add(const std::shared_ptr<const CBlock>& block)
+{
+    const uint256 hash = block->GetHash();
+    const size_t usage = RecursiveDynamicUsage(block);
+
+    LOCK(m_mutex);
+    if (FindEntry(m_entries, hash) != m_entries.end()) return;
+    Entry& entry = m_entries.emplace_back();
+    entry.hash = hash;
+    entry.block = block;
+    entry.memory_usage = usage;
+    m_memory_usage += usage;
+    Trim();
+}
+
+std::shared_ptr<const CBlock> RecentBlockCache::GetMostRecentBlock() const
+{
+    LOCK(m_mutex);
+    return m_entries.empty() ? nullptr : m_entries.back().block;
+}
+
+std::shared_ptr<const CBlock> RecentBlockCache::GetBlock(const uint256& hash) const
+{
+    LOCK(m_mutex);
+    const auto it = FindEntry(m_entries, hash);
+    return it == m_entries.end() ? nullptr : it->block;
+}
+
+CSharedNetPayload RecentBlockCache::GetEncoding(const std::shared_ptr<const CBlock>& block, Encoding encoding)
+{
+    const uint256 hash = block->GetHash();
+    const size_t index = static_cast<size_t>(encoding);
+    {
+        LOCK(m_mutex);
+        const auto it = FindEntry(m_entries, hash);
+        if (it == m_entries.end()) return Encode(*block, encoding);
+        if (it->encodings[index].data) return it->encodings[index];
+    }
+
+    // Serialize without holding the lock; if several threads get here for
+    // the same block, the first result to be stored is kept.
+    CSharedNetPayload payload = Encode(*block, encoding);
+    const size_t usage = memusage::DynamicUsage(*payload.data);
+
+    LOCK(m_mutex);
+    const auto it = FindEntry(m_entries, hash);
+    if (it == m_entries.end()) return payload;
+    if (it->encodings[index].data) return it->encodings[index];
+    it->encodings[index] = payload;
+    it->memory_usage += usage;
+    m_memory_usage += usage;
+    Trim();
+    return payload;
+}
+
+CSharedNetPayload RecentBlockCache::Encode(const CBlock& block, Encoding encoding)
+{
+    std::vector<unsigned char> data;
+    switch (encoding) {
+    case Encoding::BLOCK:
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, data, 0, block);
+        break;
+    case Encoding::BLOCK_NO_WITNESS:
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS, data, 0, block);
+        break;
+    case Encoding::CMPCTBLOCK:
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, data, 0, CBlockHeaderAndShortTxIDs(block, /* fUseWTXID */ true));
+        break;
+    case Encoding::CMPCTBLOCK_NO_WITNESS:
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS, data, 0, CBlockHeaderAndShortTxIDs(block, /* fUseWTXID */ false));
+        break;
+    } // no default case, so the compiler can warn about missing cases
+    return CSharedNetPayload(std::move(data));
+}
+
+size_t RecentBlockCache::Size() const
+{
+    LOCK(m_mutex);
+    return m_entries.size();
+}
+
+size_t RecentBlockCache::DynamicMemoryUsage() const
+{
+    LOCK(m_mutex);
+    return m_memory_usage;
+}
+
+void RecentBlockCache::Trim()
+{
+    AssertLockHeld(m_mutex);
+    while (m_entries.size() > std::max<size_t>(m_max_blocks, 1) ||
+           (m_entries.size() > 1 && m_memory_usage > m_max_memory)) {
+        m_memory_usage -= m_entries.front().memory_usage;
+        m_entries.pop_front();
+    }
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include <net.h>
+#include <primitives/block.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <array>
+#include <deque>
+#include <memory>
+
+/** Number of recent blocks kept serialized for relay. */
+static const unsigned int MAX_RECENT_BLOCKS_CACHE_BLOCKS = 8;
+/** Memory budget of the recent blocks cache, including the blocks themselves. */
+static const size_t MAX_RECENT_BLOCKS_CACHE_MEMORY = 64 * 1024 * 1024;
+
+/**
+ * Keeps the last blocks we learned about together with their serializations
+ * as they are sent on the wire, so that a new block that many peers request
+ * at about the same time is serialized and hashed once, instead of being read
+ * from disk and serialized again for every peer.
+ *
+ * Serializations are made on first use and shared by every peer they are
+ * sent to (see CSharedNetPayload). The cache is bounded both in the number
+ * of blocks and in memory usage; the oldest blocks are evicted first, but the
+ * most recent block is always kept.
+ */
+class RecentBlockCache
+{
+public:
+    /** The forms in which a block is sent to peers. */
+    enum class Encoding : size_t {
+        BLOCK,                 //!< block message with witnesses
+        BLOCK_NO_WITNESS,      //!< block message without witnesses
+        CMPCTBLOCK,            //!< cmpctblock message using wtxids (version 2)
+        CMPCTBLOCK_NO_WITNESS, //!< cmpctblock message using txids (version 1)
+    };
+    static constexpr size_t NUM_ENCODINGS = 4;
+
+    RecentBlockCache(size_t max_blocks, size_t max_memory);
+
+    /** Add a block as the most recent one. Blocks that are already cached are ignored. */
+    void Add(const std::shared_ptr<const CBlock>& block);
+
+    /** The block that was added last, or nullptr if the cache is empty. */
+    std::shared_ptr<const CBlock> GetMostRecentBlock() const;
+
+    /** The cached block with the given hash, or nullptr. */
+    std::shared_ptr<const CBlock> GetBlock(const uint256& hash) const;
+
+    /**
+     * Return the serialization of block in the given encoding. It is kept
+     * for later requests if the block is in the cache. Serialization happens
+     * without holding the cache lock.
+     */
+    CSharedNetPayload GetEncoding(const std::shared_ptr<const CBlock>& block, Encoding encoding);
+
+    /** Serialize a block in the given encoding. */
+    static CSharedNetPayload Encode(const CBlock& block, Encoding encoding);
+
+    size_t Size() const;
+    size_t DynamicMemoryUsage() const;
+
+private:
+    struct Entry {
+        uint256 hash;
+        std::shared_ptr<const CBlock> block;
+        std::array<CSharedNetPayload, NUM_ENCODINGS> encodings;
+        size_t memory_usage{0};
+    };
+
+    const size_t m_max_blocks;
+    const size_t m_max_memory;
+
+    mutable Mutex m_mutex;
+    //! Cached blocks, oldest first.
+    std::deque<Entry> m_entries GUARDED_BY(m_mutex);
+    size_t m_memory_usage GUARDED_BY(m_mutex){0};
+
+    void Trim() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
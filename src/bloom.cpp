@@ -5,6 +5,7 @@
 #include <bloom.h>
 
 #include <primitives/transaction.h>
+#include <crypto/common.h>
 #include <hash.h>
 #include <script/script.h>
 #include <script/standard.h>
@@ -210,7 +211,64 @@ static inline uint32_t FastMod(uint32_t x, size_t n) {
     return ((uint64_t)x * (uint64_t)n) >> 32;
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+namespace {
+
+/**
+ * Computes RollingBloomHash() of a 32 byte key for several hash functions at
+ * once. The part of MurmurHash3 that only depends on the key is done once per
+ * key rather than once per hash function, and the loops over hash functions
+ * are innermost and of fixed length, so that compilers can vectorize them.
+ */
+class RollingBloomKeyHasher
+{
+public:
+    //! Number of hash functions computed together
+    static constexpr int LANES = 4;
+
+    explicit RollingBloomKeyHasher(const uint256& key)
+    {
+        for (int i = 0; i < BLOCKS; ++i) {
+            uint32_t k1 = ReadLE32(key.begin() + i * 4);
+            k1 *= 0xcc9e2d51;
+            k1 = (k1 << 15) | (k1 >> 17);
+            k1 *= 0x1b873593;
+            m_blocks[i] = k1;
+        }
+    }
+
+    /** Compute the hashes for hash functions first_hash_num to first_hash_num + LANES - 1. */
+    void Hash(uint32_t nTweak, unsigned int first_hash_num, uint32_t (&out)[LANES]) const
+    {
+        uint32_t h[LANES];
+        for (int j = 0; j < LANES; ++j) {
+            h[j] = (first_hash_num + j) * 0xFBA4C795 + nTweak;
+        }
+        for (int i = 0; i < BLOCKS; ++i) {
+            for (int j = 0; j < LANES; ++j) {
+                h[j] ^= m_blocks[i];
+                h[j] = (h[j] << 13) | (h[j] >> 19);
+                h[j] = h[j] * 5 + 0xe6546b64;
+            }
+        }
+        for (int j = 0; j < LANES; ++j) {
+            h[j] ^= BLOCKS * 4;
+            h[j] ^= h[j] >> 16;
+            h[j] *= 0x85ebca6b;
+            h[j] ^= h[j] >> 13;
+            h[j] *= 0xc2b2ae35;
+            h[j] ^= h[j] >> 16;
+            out[j] = h[j];
+        }
+    }
+
+private:
+    static constexpr int BLOCKS = 256 / 32;
+    uint32_t m_blocks[BLOCKS];
+};
+
+} // namespace
+
+void CRollingBloomFilter::AddEntry()
 {
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
         nEntriesThisGeneration = 0;
@@ -229,32 +287,58 @@ void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
         }
     }
     nEntriesThisGeneration++;
+}
 
+void CRollingBloomFilter::SetBit(uint32_t h)
+{
+    int bit = h & 0x3F;
+    /* FastMod works with the upper bits of h, so it is safe to ignore that the lower bits of h are already used for bit. */
+    uint32_t pos = FastMod(h, data.size());
+    /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
+    data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+    data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+}
+
+bool CRollingBloomFilter::TestBit(uint32_t h) const
+{
+    int bit = h & 0x3F;
+    uint32_t pos = FastMod(h, data.size());
+    /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain the key */
+    return ((data[pos & ~1] | data[pos | 1]) >> bit) & 1;
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    AddEntry();
     for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        /* FastMod works with the upper bits of h, so it is safe to ignore that the lower bits of h are already used for bit. */
-        uint32_t pos = FastMod(h, data.size());
-        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
-        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+        SetBit(RollingBloomHash(n, nTweak, vKey));
     }
 }
 
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    insert(vData);
+    AddEntry();
+    const RollingBloomKeyHasher hasher(hash);
+    uint32_t h[RollingBloomKeyHasher::LANES];
+    for (int n = 0; n < nHashFuncs; n += RollingBloomKeyHasher::LANES) {
+        hasher.Hash(nTweak, n, h);
+        for (int j = 0; j < RollingBloomKeyHasher::LANES && n + j < nHashFuncs; ++j) {
+            SetBit(h[j]);
+        }
+    }
+}
+
+void CRollingBloomFilter::insert(Span<const uint256> hashes)
+{
+    for (const uint256& hash : hashes) {
+        insert(hash);
+    }
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
     for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = FastMod(h, data.size());
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
+        if (!TestBit(RollingBloomHash(n, nTweak, vKey))) {
             return false;
         }
     }
@@ -263,8 +347,29 @@ bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    return contains(vData);
+    const RollingBloomKeyHasher hasher(hash);
+    uint32_t h[RollingBloomKeyHasher::LANES];
+    for (int n = 0; n < nHashFuncs; n += RollingBloomKeyHasher::LANES) {
+        hasher.Hash(nTweak, n, h);
+        // Test all bits of a group without branching on each; most keys that
+        // are not in the filter miss within the first group.
+        bool all_set = true;
+        for (int j = 0; j < RollingBloomKeyHasher::LANES && n + j < nHashFuncs; ++j) {
+            all_set &= TestBit(h[j]);
+        }
+        if (!all_set) return false;
+    }
+    return true;
+}
+
+std::vector<bool> CRollingBloomFilter::contains(Span<const uint256> hashes) const
+{
+    std::vector<bool> result;
+    result.reserve(hashes.size());
+    for (const uint256& hash : hashes) {
+        result.push_back(contains(hash));
+    }
+    return result;
 }
 
 void CRollingBloomFilter::reset()
@@ -6,6 +6,7 @@
 #define BITCOIN_BLOOM_H
 
 #include <serialize.h>
+#include <span.h>
 
 #include <vector>
 
@@ -114,12 +115,21 @@ public:
 
     void insert(const std::vector<unsigned char>& vKey);
     void insert(const uint256& hash);
+    void insert(Span<const uint256> hashes);
     bool contains(const std::vector<unsigned char>& vKey) const;
     bool contains(const uint256& hash) const;
+    /** Check several hashes at once. Element i of the result is contains(hashes[i]). */
+    std::vector<bool> contains(Span<const uint256> hashes) const;
 
     void reset();
 
 private:
+    /** Account for a new entry, starting a new generation if the current one is full. */
+    void AddEntry();
+    /** Set the bit for hash h in the current generation. */
+    void SetBit(uint32_t h);
+    bool TestBit(uint32_t h) const;
+
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
     int nGeneration;
@@ -411,6 +411,7 @@ public:
         m_assumed_chain_state_size = 0;
 
         UpdateActivationParametersFromArgs(args);
+        UpdateAssumeutxoParametersFromArgs(args);
 
         genesis = CreateGenesisBlock(1296688602, 2, 0x207fffff, 1, 50 * COIN);
         consensus.hashGenesisBlock = genesis.GetHash();
@@ -455,6 +456,7 @@ public:
         consensus.vDeployments[d].nTimeout = nTimeout;
     }
     void UpdateActivationParametersFromArgs(const ArgsManager& args);
+    void UpdateAssumeutxoParametersFromArgs(const ArgsManager& args);
 };
 
 void CRegTestParams::UpdateActivationParametersFromArgs(const ArgsManager& args)
@@ -500,6 +502,30 @@ void CRegTestParams::UpdateActivationParametersFromArgs(const ArgsManager& args)
     }
 }
 
+void CRegTestParams::UpdateAssumeutxoParametersFromArgs(const ArgsManager& args)
+{
+    for (const std::string& str_snapshot : args.GetArgs("-assumeutxo")) {
+        std::vector<std::string> snapshot_params;
+        boost::split(snapshot_params, str_snapshot, boost::is_any_of(":"));
+        if (snapshot_params.size() != 3) {
+            throw std::runtime_error("Assumeutxo parameters malformed, expecting height:hash_serialized:nchaintx");
+        }
+        int32_t height;
+        if (!ParseInt32(snapshot_params[0], &height) || height < 0) {
+            throw std::runtime_error(strprintf("Invalid assumeutxo height (%s)", snapshot_params[0]));
+        }
+        if (!IsHex(snapshot_params[1]) || snapshot_params[1].size() != 64) {
+            throw std::runtime_error(strprintf("Invalid assumeutxo hash (%s)", snapshot_params[1]));
+        }
+        uint32_t nchaintx;
+        if (!ParseUInt32(snapshot_params[2], &nchaintx) || nchaintx == 0) {
+            throw std::runtime_error(strprintf("Invalid assumeutxo nChainTx (%s)", snapshot_params[2]));
+        }
+        m_assumeutxo_data[height] = AssumeutxoData{uint256S(snapshot_params[1]), nchaintx};
+        LogPrintf("Accepting UTXO snapshots at height %d with hash %s\n", height, snapshot_params[1]);
+    }
+}
+
 static std::unique_ptr<const CChainParams> globalChainParams;
 
 const CChainParams &Params() {
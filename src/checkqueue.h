@@ -8,6 +8,9 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,12 +28,38 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Pending verifications are spread over per-worker deques rather than one
+  * shared vector. A worker takes batches from the back of its own deque and,
+  * once that is empty, steals from the front of the others', so the only
+  * shared lock is taken when a thread goes idle or has to be woken up.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Maximum number of per-worker deques; workers beyond that share them.
+    static constexpr unsigned int MAX_WORK_QUEUES = 64;
+
+    //! A deque of verifications, owned by one worker but open to stealing.
+    struct alignas(64) WorkQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! Per-worker deques. Slot 0 belongs to the master.
+    std::array<WorkQueue, MAX_WORK_QUEUES> m_work_queues;
+
+    //! Number of slots of m_work_queues in use, i.e. 1 + the number of workers (capped).
+    std::atomic<unsigned int> m_active_queues{1};
+
+    //! Number of workers that have started, used to assign their slots.
+    std::atomic<unsigned int> m_num_workers{0};
+
+    //! Slot that the next call to Add() pushes its batch into.
+    std::atomic<unsigned int> m_next_add{0};
+
+    //! Mutex protecting the idle/wake-up handshake below
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,86 +68,106 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers (excluding the master) that are idle.
+    std::atomic<int> nIdle{0};
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk{true};
+
+    //! Number of verifications that are still sitting in one of the deques.
+    std::atomic<unsigned int> nQueued{0};
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes elements that are no longer queued, but still in a
+     * worker's own batch, until they have been destroyed.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo{0};
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /**
+     * Move a batch of verifications out of the deque in `slot` into vChecks.
+     * The owner takes from the back (most recently added), thieves take up
+     * to half of what is left from the front.
+     */
+    bool TakeBatch(unsigned int slot, bool fSteal, std::vector<T>& vChecks)
+    {
+        WorkQueue& work = m_work_queues[slot];
+        boost::unique_lock<boost::mutex> lock(work.mutex);
+        const unsigned int nAvailable = work.checks.size();
+        if (nAvailable == 0) return false;
+        const unsigned int nLimit = std::max(1U, nBatchSize);
+        const unsigned int nNow = std::max(1U, std::min(nLimit, fSteal ? nAvailable / 2 : nAvailable));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // We want the lock on the mutex to be as short as possible, so swap jobs from the
+            // deque to the local batch vector instead of copying.
+            if (fSteal) {
+                vChecks[i].swap(work.checks.front());
+                work.checks.pop_front();
+            } else {
+                vChecks[i].swap(work.checks.back());
+                work.checks.pop_back();
+            }
+        }
+        nQueued -= nNow;
+        return true;
+    }
+
+    //! Fill vChecks from our own deque, or else steal from another one.
+    bool FindWork(unsigned int slot, std::vector<T>& vChecks)
+    {
+        if (TakeBatch(slot, false, vChecks)) return true;
+        const unsigned int nActive = m_active_queues.load();
+        for (unsigned int i = 1; i < nActive; i++) {
+            if (nQueued.load() == 0) return false;
+            if (TakeBatch((slot + i) % nActive, true, vChecks)) return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int slot, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        vChecks.reserve(std::max(1U, nBatchSize));
         do {
-            {
+            if (!FindWork(slot, vChecks)) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
+                if (fMaster) {
+                    // All work has been handed out; wait for the workers to finish theirs.
+                    while (nQueued.load() == 0 && nTodo.load() != 0) {
+                        condMaster.wait(lock);
+                    }
+                    if (nTodo.load() == 0) {
+                        // reset the status for new work later, and return the current status
+                        return fAllOk.exchange(true);
+                    }
                 } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        fAllOk = true;
-                        // return the current status
-                        return fRet;
+                    ++nIdle;
+                    while (nQueued.load() == 0) {
+                        condWorker.wait(lock); // wait
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                    --nIdle;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
+            // Check whether we need to do work at all
+            bool fOk = fAllOk.load();
             // execute work
             for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            if (!fOk) fAllOk = false;
+            const unsigned int nNow = vChecks.size();
             vChecks.clear();
+            if (nTodo.fetch_sub(nNow) == nNow) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
@@ -127,33 +176,47 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        const unsigned int slot = 1 + m_num_workers++ % (MAX_WORK_QUEUES - 1);
+        unsigned int nActive = m_active_queues.load();
+        while (nActive <= slot && !m_active_queues.compare_exchange_weak(nActive, slot + 1)) {}
+        Loop(slot);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty()) return;
+        // Account for the checks before they become visible, so that the
+        // counters never drop below the number of checks in flight.
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nQueued += vChecks.size();
+        // Spread consecutive batches over the deques in use.
+        WorkQueue& work = m_work_queues[m_next_add++ % m_active_queues.load()];
+        {
+            boost::unique_lock<boost::mutex> lock(work.mutex);
+            for (T& check : vChecks) {
+                work.checks.push_back(T());
+                check.swap(work.checks.back());
+            }
+        }
+        if (nIdle.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
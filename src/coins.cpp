@@ -12,7 +12,7 @@
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -27,7 +27,7 @@ bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return base->BatchWrite(mapCoins, hashBlock, erase); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
@@ -39,14 +39,23 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
+size_t CCoinsViewCache::PeakMemoryUsage(size_t count) const {
+    // Nothing is allocated yet before the first rebuild.
+    if (cacheCoins.capacity() == 0 || !cacheCoins.needs_rebuild(count)) return DynamicMemoryUsage();
+    return DynamicMemoryUsage() + memusage::DynamicUsage(cacheCoins, cacheCoins.rebuild_capacity(count));
+}
+
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.referenced = true;
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    ret->second.referenced = true;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
@@ -96,9 +105,20 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    it->second.referenced = true;
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
+void CCoinsViewCache::EmplacePrefetchedCoin(const COutPoint& outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+}
+
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check_for_overwrite) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256& txid = tx.GetHash();
@@ -157,8 +177,8 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool erase) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = erase ? mapCoins.erase(it) : std::next(it)) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -171,7 +191,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 // Create the coin in the parent cache, move the data up
                 // and mark it as dirty.
                 CCoinsCacheEntry& entry = cacheCoins[it->first];
-                entry.coin = std::move(it->second.coin);
+                if (erase) {
+                    entry.coin = std::move(it->second.coin);
+                } else {
+                    entry.coin = it->second.coin;
+                }
                 cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
                 // We can mark it FRESH in the parent if it was FRESH in the child
@@ -199,7 +223,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             } else {
                 // A normal modification.
                 cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.coin = std::move(it->second.coin);
+                if (erase) {
+                    itUs->second.coin = std::move(it->second.coin);
+                } else {
+                    itUs->second.coin = it->second.coin;
+                }
                 cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 // NOTE: It isn't safe to mark the coin as FRESH in the parent
@@ -217,9 +245,61 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    // Hand the memory of the emptied table back to the system.
+    ReallocateCache();
     return fOk;
 }
 
+bool CCoinsViewCache::Sync(size_t target_usage) {
+    if (!base->BatchWrite(cacheCoins, hashBlock, /* erase */ false)) {
+        return false;
+    }
+    // Everything has been written to the base. Spent entries can go, the
+    // rest is now identical to the base's version.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+
+    // Every entry is now unmodified, so all of them may be evicted. A full
+    // turn of the sweep clears all referenced bits, so this terminates.
+    // Erasing does not shrink the table, so the target is checked against the
+    // usage once it is rebuilt with room for a third more entries.
+    const auto usage_after_shrink = [this] {
+        return memusage::DynamicUsage(cacheCoins, CCoinsMap::capacity_for(cacheCoins.size() + cacheCoins.size() / 3)) + cachedCoinsUsage;
+    };
+    CCoinsMap::iterator hand = cacheCoins.find(m_evict_hand);
+    while (usage_after_shrink() > target_usage && !cacheCoins.empty()) {
+        if (hand == cacheCoins.end()) {
+            hand = cacheCoins.begin();
+        }
+        if (hand->second.referenced) {
+            hand->second.referenced = false;
+            ++hand;
+        } else {
+            cachedCoinsUsage -= hand->second.coin.DynamicMemoryUsage();
+            hand = cacheCoins.erase(hand);
+        }
+    }
+    m_evict_hand = hand == cacheCoins.end() ? COutPoint() : hand->first;
+    const size_t keep = cacheCoins.size() + cacheCoins.size() / 3;
+    if (cacheCoins.capacity() > CCoinsMap::capacity_for(keep)) {
+        cacheCoins.rehash(keep);
+    }
+    return true;
+}
+
+std::shared_ptr<CCoinsMap> CCoinsViewCache::TakeCoins() {
+    auto coins = std::make_shared<CCoinsMap>(std::move(cacheCoins));
+    cachedCoinsUsage = 0;
+    return coins;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -233,6 +313,14 @@ unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
+void CCoinsViewCache::ForEachUnspentCoin(const std::function<void(const COutPoint&, const Coin&)>& func) const {
+    for (const auto& entry : cacheCoins) {
+        if (!entry.second.coin.IsSpent()) {
+            func(entry.first, entry.second.coin);
+        }
+    }
+}
+
 bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
@@ -282,3 +370,46 @@ bool CCoinsViewErrorCatcher::GetCoin(const COutPoint &outpoint, Coin &coin) cons
         std::abort();
     }
 }
+
+bool CCoinsViewFlushing::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (m_flushing_coins) {
+        CCoinsMap::const_iterator it = m_flushing_coins->find(outpoint);
+        if (it != m_flushing_coins->end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewFlushing::HaveCoin(const COutPoint &outpoint) const {
+    if (m_flushing_coins) {
+        CCoinsMap::const_iterator it = m_flushing_coins->find(outpoint);
+        if (it != m_flushing_coins->end()) {
+            return !it->second.coin.IsSpent();
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewFlushing::GetBestBlock() const {
+    // While the write is in progress, the base is marked as being in between blocks.
+    return m_flushing_coins ? m_flushing_block : base->GetBestBlock();
+}
+
+bool CCoinsViewFlushing::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
+    // Writes to the base must not be reordered with the one in progress.
+    assert(!m_flushing_coins);
+    return base->BatchWrite(mapCoins, hashBlock, erase);
+}
+
+void CCoinsViewFlushing::SetFlushingCoins(std::shared_ptr<const CCoinsMap> coins, const uint256& hashBlock) {
+    assert(!m_flushing_coins && coins);
+    m_flushing_coins = std::move(coins);
+    m_flushing_block = hashBlock;
+}
+
+void CCoinsViewFlushing::ClearFlushingCoins() {
+    m_flushing_coins.reset();
+    m_flushing_block.SetNull();
+}
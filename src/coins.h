@@ -9,6 +9,7 @@
 #include <compressor.h>
 #include <core_memusage.h>
 #include <crypto/siphash.h>
+#include <flatmap.h>
 #include <memusage.h>
 #include <primitives/transaction.h>
 #include <serialize.h>
@@ -18,6 +19,7 @@
 #include <stdint.h>
 
 #include <functional>
+#include <memory>
 #include <unordered_map>
 
 /**
@@ -150,11 +152,19 @@ struct CCoinsCacheEntry
         FRESH = (1 << 1),
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    /**
+     * Set whenever the entry is looked up or added, and cleared by the
+     * eviction sweep in CCoinsViewCache::Sync(). Entries that are not
+     * referenced between two sweeps are the first to be evicted. This is not
+     * part of flags, as it says nothing about the entry's state in the parent.
+     */
+    bool referenced;
+
+    CCoinsCacheEntry() : flags(0), referenced(false) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), referenced(false) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef flatmap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -199,8 +209,9 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. If erase is true, its entries are
+    //! removed as they are written; otherwise they are left in place.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -226,7 +237,7 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -246,6 +257,9 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Outpoint at which the next eviction sweep in Sync() resumes. */
+    COutPoint m_evict_hand;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -259,7 +273,7 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -289,6 +303,17 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool possible_overwrite);
 
+    /**
+     * Add a coin that was read from the backing view outside of this cache,
+     * as if it had been fetched through AccessCoin(). This allows lookups in
+     * the backing view to be done in parallel (see PrefetchBlockInputs()).
+     * If an entry for the outpoint is already present, it is left untouched.
+     *
+     * The caller must ensure the backing view has not been modified since the
+     * coin was read from it.
+     */
+    void EmplacePrefetchedCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -303,6 +328,24 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the unspent entries resident as unmodified entries. Then, if
+     * the memory usage of the cache exceeds target_usage, evict unmodified
+     * entries until it does not. Eviction is a CLOCK sweep: entries that were
+     * referenced since the previous sweep get a second chance.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync(size_t target_usage);
+
+    /**
+     * Hand all entries over to the caller and leave this cache empty, as
+     * Flush() does, but without writing anything to the base. The caller is
+     * responsible for pushing the modifications to the base, and for keeping
+     * them visible to this cache in the meantime (see CCoinsViewFlushing).
+     */
+    std::shared_ptr<CCoinsMap> TakeCoins();
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -312,9 +355,18 @@ public:
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
+    //! Call func for every unspent coin held in this cache, without querying the backing view.
+    void ForEachUnspentCoin(const std::function<void(const COutPoint&, const Coin&)>& func) const;
+
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Calculate the size of the cache (in bytes) that adding count more
+    //! coins may reach, while its table is rebuilt to make room for them and
+    //! the old table is still allocated. The memory of the coins themselves is
+    //! not included.
+    size_t PeakMemoryUsage(size_t count) const;
+
     //! Check whether all prevouts of the transaction are present in the UTXO set represented by this view
     bool HaveInputs(const CTransaction& tx) const;
 
@@ -371,4 +423,34 @@ private:
 
 };
 
+/**
+ * This view sits between a CCoinsViewCache and its backing database view while
+ * the entries taken from the cache with CCoinsViewCache::TakeCoins() are being
+ * written to the database on another thread. Lookups are answered from those
+ * entries first, as the database may not contain them yet, or only some of them.
+ *
+ * The entries are not modified while they are set here, so lookups may run
+ * concurrently with the write.
+ */
+class CCoinsViewFlushing final : public CCoinsViewBacked
+{
+public:
+    explicit CCoinsViewFlushing(CCoinsView* view) : CCoinsViewBacked(view) {}
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
+
+    //! Start answering lookups from coins, which are being written to the base view up to hashBlock.
+    void SetFlushingCoins(std::shared_ptr<const CCoinsMap> coins, const uint256& hashBlock);
+    //! Stop answering lookups from the coins set above, once the base view contains them.
+    void ClearFlushingCoins();
+    bool IsFlushing() const { return m_flushing_coins != nullptr; }
+
+private:
+    std::shared_ptr<const CCoinsMap> m_flushing_coins;
+    uint256 m_flushing_block;
+};
+
 #endif // BITCOIN_COINS_H
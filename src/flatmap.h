@@ -0,0 +1,328 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/**
+ * An open addressing hash map that stores its elements inline, in a single
+ * array of slots.
+ *
+ * A std::unordered_map lookup loads a bucket, then the node it points to,
+ * which are two dependent cache misses. Here the slot of an element and its
+ * control byte are both at a position computed from the hash, so they can be
+ * loaded at once, and probing further is a sequential scan. There are no
+ * per-element allocations, and the memory used is exactly that of the slot
+ * and control arrays. The slot array is aligned to a cache line.
+ *
+ * Collisions are resolved by linear probing. The control byte of a slot is
+ * either empty, deleted, or holds 7 bits of the hash of its element, which
+ * skips most non-matching slots without comparing keys. Erasing leaves a
+ * tombstone so that no other element is moved; tombstones are dropped
+ * whenever the table is rebuilt.
+ *
+ * The interface is the subset of std::unordered_map's that is needed, with
+ * the same semantics, except that inserting an element may invalidate
+ * references and pointers to all elements, not just iterators.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class flatmap
+{
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+
+private:
+    static constexpr int8_t CTRL_EMPTY = -128;
+    static constexpr int8_t CTRL_DELETED = -1;
+    static constexpr std::size_t SLOT_ALIGN_BYTES = 64;
+    static constexpr std::size_t MIN_CAPACITY = 16;
+
+    //! One control byte per slot. Non-negative values mark a slot holding an element.
+    int8_t* m_ctrl{nullptr};
+    value_type* m_slots{nullptr};
+    std::size_t m_capacity{0};
+    std::size_t m_size{0};
+    std::size_t m_deleted{0};
+    Hash m_hash;
+    KeyEqual m_key_equal;
+
+    static int8_t H2(uint64_t hash) { return hash & 0x7f; }
+
+    //! First slot to probe, from the bits of the hash not used by H2().
+    std::size_t Home(uint64_t hash) const
+    {
+        const uint32_t h1 = (hash >> 7) ^ (hash >> 39);
+        return (uint64_t{h1} * m_capacity) >> 32;
+    }
+
+    std::size_t Next(std::size_t pos) const { return pos + 1 == m_capacity ? 0 : pos + 1; }
+
+    std::size_t NextFull(std::size_t pos) const
+    {
+        while (pos < m_capacity && m_ctrl[pos] < 0) ++pos;
+        return pos;
+    }
+
+    //! Maximum number of elements and tombstones for a capacity. At least one slot is always empty.
+    static std::size_t MaxLoad(std::size_t capacity) { return capacity - capacity / 8; }
+
+    template <typename KK>
+    std::size_t FindPos(const KK& key, uint64_t hash) const
+    {
+        if (m_size == 0) return m_capacity;
+        const int8_t h2 = H2(hash);
+        for (std::size_t pos = Home(hash);; pos = Next(pos)) {
+            const int8_t ctrl = m_ctrl[pos];
+            if (ctrl == CTRL_EMPTY) return m_capacity;
+            if (ctrl == h2 && m_key_equal(m_slots[pos].first, key)) return pos;
+        }
+    }
+
+    void Rebuild(std::size_t capacity)
+    {
+        int8_t* old_ctrl = m_ctrl;
+        value_type* old_slots = m_slots;
+        const std::size_t old_capacity = m_capacity;
+
+        m_slots = static_cast<value_type*>(::operator new (capacity * sizeof(value_type), std::align_val_t{SLOT_ALIGN_BYTES}));
+        m_ctrl = new int8_t[capacity];
+        std::memset(m_ctrl, CTRL_EMPTY, capacity);
+        m_capacity = capacity;
+        m_deleted = 0;
+
+        for (std::size_t old_pos = 0; old_pos < old_capacity; ++old_pos) {
+            if (old_ctrl[old_pos] < 0) continue;
+            const uint64_t hash = m_hash(old_slots[old_pos].first);
+            std::size_t pos = Home(hash);
+            while (m_ctrl[pos] != CTRL_EMPTY) pos = Next(pos);
+            new (&m_slots[pos]) value_type(std::move(old_slots[old_pos]));
+            m_ctrl[pos] = H2(hash);
+            old_slots[old_pos].~value_type();
+        }
+        Free(old_ctrl, old_slots);
+    }
+
+    static void Free(int8_t* ctrl, value_type* slots)
+    {
+        delete[] ctrl;
+        ::operator delete (slots, std::align_val_t{SLOT_ALIGN_BYTES});
+    }
+
+    void DestroyAll()
+    {
+        for (std::size_t pos = 0; pos < m_capacity; ++pos) {
+            if (m_ctrl[pos] >= 0) m_slots[pos].~value_type();
+        }
+    }
+
+    //! Construct a new element for a key that is known not to be present.
+    template <typename... Args>
+    std::size_t InsertNew(uint64_t hash, Args&&... args)
+    {
+        if (needs_rebuild(1)) Rebuild(rebuild_capacity(1));
+        std::size_t pos = Home(hash);
+        while (m_ctrl[pos] >= 0) pos = Next(pos);
+        new (&m_slots[pos]) value_type(std::forward<Args>(args)...);
+        if (m_ctrl[pos] == CTRL_DELETED) --m_deleted;
+        m_ctrl[pos] = H2(hash);
+        ++m_size;
+        return pos;
+    }
+
+    template <bool Const>
+    class Iterator
+    {
+        friend class flatmap;
+        template <bool>
+        friend class Iterator;
+        using map_pointer = std::conditional_t<Const, const flatmap*, flatmap*>;
+
+        map_pointer m_map{nullptr};
+        std::size_t m_pos{0};
+
+        Iterator(map_pointer map, std::size_t pos) : m_map(map), m_pos(pos) {}
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename flatmap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        Iterator() = default;
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false>& other) : m_map(other.m_map), m_pos(other.m_pos) {}
+
+        reference operator*() const { return m_map->m_slots[m_pos]; }
+        pointer operator->() const { return &m_map->m_slots[m_pos]; }
+        Iterator& operator++()
+        {
+            m_pos = m_map->NextFull(m_pos + 1);
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator copy(*this);
+            ++*this;
+            return copy;
+        }
+        friend bool operator==(const Iterator& a, const Iterator& b) { return a.m_pos == b.m_pos; }
+        friend bool operator!=(const Iterator& a, const Iterator& b) { return a.m_pos != b.m_pos; }
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    explicit flatmap(size_type capacity = 0, const Hash& hash = Hash(), const KeyEqual& key_equal = KeyEqual())
+        : m_hash(hash), m_key_equal(key_equal)
+    {
+        if (capacity > 0) Rebuild(std::max(capacity, MIN_CAPACITY));
+    }
+
+    flatmap(const flatmap&) = delete;
+
+    /** Take the elements of other, which is left empty but usable. */
+    flatmap(flatmap&& other) noexcept
+        : m_ctrl(std::exchange(other.m_ctrl, nullptr)), m_slots(std::exchange(other.m_slots, nullptr)),
+          m_capacity(std::exchange(other.m_capacity, 0)), m_size(std::exchange(other.m_size, 0)),
+          m_deleted(std::exchange(other.m_deleted, 0)), m_hash(other.m_hash), m_key_equal(other.m_key_equal) {}
+
+    flatmap& operator=(const flatmap&) = delete;
+
+    ~flatmap()
+    {
+        DestroyAll();
+        Free(m_ctrl, m_slots);
+    }
+
+    //! Smallest capacity that holds count elements.
+    static size_type capacity_for(size_type count)
+    {
+        size_type capacity = std::max(MIN_CAPACITY, count + count / 7 + 1);
+        while (MaxLoad(capacity) < count) ++capacity;
+        return capacity;
+    }
+
+    iterator begin() { return iterator(this, NextFull(0)); }
+    const_iterator begin() const { return const_iterator(this, NextFull(0)); }
+    const_iterator cbegin() const { return begin(); }
+    iterator end() { return iterator(this, m_capacity); }
+    const_iterator end() const { return const_iterator(this, m_capacity); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return m_size == 0; }
+    size_type size() const { return m_size; }
+    //! Number of slots, occupied or not.
+    size_type capacity() const { return m_capacity; }
+
+    iterator find(const K& key) { return iterator(this, FindPos(key, m_hash(key))); }
+    const_iterator find(const K& key) const { return const_iterator(this, FindPos(key, m_hash(key))); }
+    size_type count(const K& key) const { return FindPos(key, m_hash(key)) != m_capacity; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const K& key, Args&&... args)
+    {
+        const uint64_t hash = m_hash(key);
+        const std::size_t pos = FindPos(key, hash);
+        if (pos != m_capacity) return {iterator(this, pos), false};
+        return {iterator(this, InsertNew(hash, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...))), true};
+    }
+
+    template <typename KK, typename VV>
+    std::pair<iterator, bool> emplace(KK&& key, VV&& value)
+    {
+        return try_emplace(std::forward<KK>(key), std::forward<VV>(value));
+    }
+
+    template <typename... KArgs, typename... VArgs>
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t, std::tuple<KArgs...> key_args, std::tuple<VArgs...> value_args)
+    {
+        const K key = std::make_from_tuple<K>(std::move(key_args));
+        const uint64_t hash = m_hash(key);
+        const std::size_t pos = FindPos(key, hash);
+        if (pos != m_capacity) return {iterator(this, pos), false};
+        return {iterator(this, InsertNew(hash, std::piecewise_construct, std::forward_as_tuple(key), std::move(value_args))), true};
+    }
+
+    V& operator[](const K& key) { return try_emplace(key).first->second; }
+
+    /** Erase the element at it, and return an iterator to the element after it. Other iterators stay valid. */
+    iterator erase(const_iterator it)
+    {
+        const std::size_t pos = it.m_pos;
+        m_slots[pos].~value_type();
+        if (m_ctrl[Next(pos)] == CTRL_EMPTY) {
+            // No probe sequence continues past this slot.
+            m_ctrl[pos] = CTRL_EMPTY;
+        } else {
+            m_ctrl[pos] = CTRL_DELETED;
+            ++m_deleted;
+        }
+        --m_size;
+        return iterator(this, NextFull(pos + 1));
+    }
+
+    size_type erase(const K& key)
+    {
+        const std::size_t pos = FindPos(key, m_hash(key));
+        if (pos == m_capacity) return 0;
+        erase(const_iterator(this, pos));
+        return 1;
+    }
+
+    /** Remove all elements, keeping the capacity. */
+    void clear()
+    {
+        DestroyAll();
+        if (m_capacity > 0) std::memset(m_ctrl, CTRL_EMPTY, m_capacity);
+        m_size = 0;
+        m_deleted = 0;
+    }
+
+    /**
+     * Whether inserting count more elements rebuilds the table. While it is
+     * rebuilt, the old and the new slot arrays are both allocated.
+     */
+    bool needs_rebuild(size_type count) const { return m_size + m_deleted + count > MaxLoad(m_capacity); }
+
+    /** Capacity of the table once it is rebuilt to insert count more elements. */
+    size_type rebuild_capacity(size_type count) const
+    {
+        // Grow by half, unless dropping the tombstones frees enough room.
+        const size_type capacity = m_size + count <= MaxLoad(m_capacity) / 2 ? m_capacity : m_capacity + m_capacity / 2;
+        return std::max(capacity, capacity_for(m_size + count));
+    }
+
+    /** Make room for count elements without further rebuilding. Never shrinks. */
+    void reserve(size_type count)
+    {
+        if (MaxLoad(m_capacity) < count) Rebuild(capacity_for(count));
+    }
+
+    /** Rebuild the table with the smallest capacity that holds max(count, size()) elements. This may shrink it. */
+    void rehash(size_type count)
+    {
+        Rebuild(capacity_for(std::max(count, m_size)));
+    }
+};
+
+#endif // BITCOIN_FLATMAP_H
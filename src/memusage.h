@@ -5,8 +5,10 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <flatmap.h>
 #include <indirectmap.h>
 #include <prevector.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
@@ -167,6 +169,30 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename W>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z, W>& m, size_t capacity)
+{
+    return capacity ? MallocUsage(sizeof(typename flatmap<X, Y, Z, W>::value_type) * capacity) + MallocUsage(capacity) : 0;
+}
+
+template<typename X, typename Y, typename Z, typename W>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z, W>& m)
+{
+    return DynamicUsage(m, m.capacity());
+}
+
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& pool_resource)
+{
+    // The chunks of the pool resource are counted as a whole, minus the memory
+    // that the pool will hand out again before it requests another chunk. The
+    // chunks are tracked in a std::list, whose nodes hold a pointer besides the
+    // next and previous pointers.
+    const size_t usage_list = MallocUsage(sizeof(void*) * 3) * pool_resource.NumAllocatedChunks();
+    const size_t usage_chunks = MallocUsage(pool_resource.ChunkSizeBytes()) * pool_resource.NumAllocatedChunks() - pool_resource.AvailableBytes();
+    return usage_list + usage_chunks;
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
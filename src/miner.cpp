@@ -85,6 +85,7 @@ BlockAssembler::BlockAssembler(const CTxMemPool& mempool, const CChainParams& pa
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
+    m_min_package_feerate = CFeeRate(MAX_MONEY);
 
     // Reserve space for coinbase tx
     nBlockWeight = 4000;
@@ -165,6 +166,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
     pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
     pblocktemplate->vTxFees[0] = -nFees;
+    pblocktemplate->m_mempool_cursor = m_mempool.GetAddedCursor();
+    pblocktemplate->m_min_package_feerate = m_min_package_feerate;
 
     LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
@@ -186,6 +189,85 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+std::unique_ptr<CBlockTemplate> BlockAssembler::UpdateNewBlock(const CBlockTemplate& blocktemplate)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    LOCK2(cs_main, m_mempool.cs);
+    CBlockIndex* pindexPrev = ::ChainActive().Tip();
+    assert(pindexPrev != nullptr);
+    if (blocktemplate.block.hashPrevBlock != pindexPrev->GetBlockHash()) return nullptr;
+    const Optional<Span<const uint256>> added_txids = m_mempool.GetAddedSince(blocktemplate.m_mempool_cursor);
+    if (!added_txids) return nullptr;
+
+    resetBlock();
+    m_min_package_feerate = blocktemplate.m_min_package_feerate;
+
+    pblocktemplate.reset(new CBlockTemplate(blocktemplate));
+    CBlock* const pblock = &pblocktemplate->block; // pointer for convenience
+
+    nHeight = pindexPrev->nHeight + 1;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : pblock->GetBlockTime();
+    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
+
+    // Restore the state of the block from the transactions in the template
+    for (size_t i = 1; i < pblock->vtx.size(); ++i) {
+        const Optional<CTxMemPool::txiter> it = m_mempool.GetIter(pblock->vtx[i]->GetHash());
+        if (!it) return nullptr;
+        nBlockWeight += (*it)->GetTxWeight();
+        ++nBlockTx;
+        nBlockSigOpsCost += (*it)->GetSigOpCost();
+        nFees += (*it)->GetFee();
+        inBlock.insert(*it);
+    }
+
+    std::vector<CTxMemPool::txiter> added;
+    for (const uint256& txid : *added_txids) {
+        const Optional<CTxMemPool::txiter> it = m_mempool.GetIter(txid);
+        if (it && !inBlock.count(*it)) added.push_back(*it);
+    }
+    std::sort(added.begin(), added.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    });
+    // Transactions may have been removed and added again
+    added.erase(std::unique(added.begin(), added.end()), added.end());
+
+    int nPackagesSelected = 0;
+    if (!addNewPackageTxs(added, nPackagesSelected)) return nullptr;
+
+    int64_t nTime1 = GetTimeMicros();
+
+    m_last_block_num_txs = nBlockTx;
+    m_last_block_weight = nBlockWeight;
+
+    if (nPackagesSelected > 0) {
+        // Pay the new fees to the coinbase and regenerate the witness commitment
+        CMutableTransaction coinbaseTx{*pblock->vtx[0]};
+        coinbaseTx.vout.resize(1);
+        coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+        pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+        pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+        pblocktemplate->vTxFees[0] = -nFees;
+        pblock->fChecked = false;
+    }
+    pblocktemplate->m_mempool_cursor = m_mempool.GetAddedCursor();
+    pblocktemplate->m_min_package_feerate = m_min_package_feerate;
+
+    if (nPackagesSelected > 0) {
+        BlockValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, state.ToString()));
+        }
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint(BCLog::BENCH, "UpdateNewBlock() packages: %.2fms (%d new txs, %d packages), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), added.size(), nPackagesSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+
+    return std::move(pblocktemplate);
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -428,6 +510,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             mapModifiedTx.erase(sortedEntries[i]);
         }
 
+        m_min_package_feerate = std::min(m_min_package_feerate, CFeeRate(packageFees, packageSize));
         ++nPackagesSelected;
 
         // Update transactions that depend on each of these
@@ -435,6 +518,57 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+// Adding packages to a block in feerate order leaves the packages already in
+// the block in place: a new package that fits in the remaining room would also
+// fit in front of the packages with a lower feerate, and packages left out for
+// lack of room would still not fit. A package that does not fit is left out
+// as well if it has a lower feerate than every package in the block, since it
+// would only have been considered after all of them. Otherwise, the packages
+// that make room for it have to be found by selecting the whole block again.
+bool BlockAssembler::addNewPackageTxs(const std::vector<CTxMemPool::txiter>& added, int& nPackagesSelected)
+{
+    for (CTxMemPool::txiter iter : added) {
+        // Already added as the ancestor of another new transaction
+        if (inBlock.count(iter)) continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        m_mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        for (CTxMemPool::txiter it : ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOpsCost += it->GetSigOpCost();
+        }
+
+        if (packageFees < blockMinFeeRate.GetFee(packageSize)) continue;
+
+        if (!TestPackage(packageSize, packageSigOpsCost)) {
+            if (m_min_package_feerate < CFeeRate(packageFees, packageSize)) return false;
+            continue;
+        }
+
+        if (!TestPackageTransactions(ancestors)) continue;
+
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, sortedEntries);
+        for (CTxMemPool::txiter it : sortedEntries) {
+            AddToBlock(it);
+        }
+
+        m_min_package_feerate = std::min(m_min_package_feerate, CFeeRate(packageFees, packageSize));
+        ++nPackagesSelected;
+    }
+    return true;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
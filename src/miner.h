@@ -31,6 +31,10 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
+    // Point in the history of the mempool the template was assembled at, and
+    // lowest feerate of the packages selected, for BlockAssembler::UpdateNewBlock
+    CTxMemPool::AddedCursor m_mempool_cursor;
+    CFeeRate m_min_package_feerate;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -140,6 +144,7 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    CFeeRate m_min_package_feerate;
 
     // Chain context for the block
     int nHeight;
@@ -160,6 +165,14 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
 
+    /** Return a copy of a template made by CreateNewBlock, with the transactions
+     *  that entered the mempool since added to it. Returns nullptr if the
+     *  template has to be made anew instead: when the tip changed, when
+     *  transactions in the template left the mempool or other entries changed,
+     *  or when a new package could only be added by leaving out packages with
+     *  a lower feerate. */
+    std::unique_ptr<CBlockTemplate> UpdateNewBlock(const CBlockTemplate& blocktemplate);
+
     static Optional<int64_t> m_last_block_num_txs;
     static Optional<int64_t> m_last_block_weight;
 
@@ -175,6 +188,11 @@ private:
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int& nPackagesSelected, int& nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
+    /** Add the packages of the given transactions, which are not in the block
+      * yet, to a block whose other transactions were selected by addPackageTxs.
+      * Returns false if addPackageTxs would have selected the packages
+      * differently. */
+    bool addNewPackageTxs(const std::vector<CTxMemPool::txiter>& added, int& nPackagesSelected) EXCLUSIVE_LOCKS_REQUIRED(m_mempool.cs);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -21,6 +21,7 @@
 #include <random.h>
 #include <scheduler.h>
 #include <util/strencodings.h>
+#include <util/string.h>
 #include <util/translation.h>
 
 #ifdef WIN32
@@ -33,6 +34,14 @@
 #include <poll.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef USE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/upnpcommands.h>
@@ -313,6 +322,52 @@ bool IsLocal(const CService& addr)
     return mapLocalHost.count(addr) > 0;
 }
 
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode)
+{
+#ifdef USE_EPOLL
+    if (str == "epoll") {
+        mode = SocketEventsMode::EPOLL;
+        return true;
+    }
+#endif
+#ifdef USE_POLL
+    if (str == "poll") {
+        mode = SocketEventsMode::POLL;
+        return true;
+    }
+#else
+    if (str == "select") {
+        mode = SocketEventsMode::SELECT;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string SocketEventsModeToString(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SocketEventsMode::SELECT: return "select";
+    case SocketEventsMode::POLL: return "poll";
+    case SocketEventsMode::EPOLL: return "epoll";
+    } // no default case, so the compiler can warn about missing cases
+    assert(false);
+}
+
+std::string SupportedSocketEventsModes()
+{
+    std::vector<std::string> modes;
+#ifdef USE_EPOLL
+    modes.push_back(SocketEventsModeToString(SocketEventsMode::EPOLL));
+#endif
+#ifdef USE_POLL
+    modes.push_back(SocketEventsModeToString(SocketEventsMode::POLL));
+#else
+    modes.push_back(SocketEventsModeToString(SocketEventsMode::SELECT));
+#endif
+    return Join(modes, std::string(", "));
+}
+
 CNode* CConnman::FindNode(const CNetAddr& ip)
 {
     LOCK(cs_vNodes);
@@ -665,8 +720,16 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
             assert(i != mapRecvBytesPerMsgCmd.end());
             i->second += result->m_raw_message_size;
 
-            // push the message to the process queue,
-            vRecvMsg.push_back(std::move(*result));
+            // push the message to the process queue, reusing the list node and
+            // buffer of a spent message if there is one
+            if (m_spare_recv_msgs.empty()) {
+                vRecvMsg.push_back(std::move(*result));
+            } else {
+                CNetMessage& spare = m_spare_recv_msgs.front();
+                m_deserializer->RecycleBuffer(std::move(spare.m_recv));
+                spare = std::move(*result);
+                vRecvMsg.splice(vRecvMsg.end(), m_spare_recv_msgs, m_spare_recv_msgs.begin());
+            }
 
             complete = true;
         }
@@ -675,6 +738,24 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
     return true;
 }
 
+void CNode::RecycleRecvMsgs(std::list<CNetMessage>& msgs)
+{
+    msgs.remove_if([](const CNetMessage& msg) { return msg.m_message_size > MAX_SPARE_RECV_MSG_SIZE; });
+    if (msgs.empty()) return;
+    LOCK(cs_vProcessMsg);
+    while (!msgs.empty() && m_spent_recv_msgs.size() < MAX_SPARE_RECV_MSGS) {
+        m_spent_recv_msgs.splice(m_spent_recv_msgs.end(), msgs, msgs.begin());
+    }
+}
+
+void CNode::TakeSpentRecvMsgs()
+{
+    AssertLockHeld(cs_vProcessMsg);
+    while (!m_spent_recv_msgs.empty() && m_spare_recv_msgs.size() < MAX_SPARE_RECV_MSGS) {
+        m_spare_recv_msgs.splice(m_spare_recv_msgs.end(), m_spent_recv_msgs, m_spent_recv_msgs.begin());
+    }
+}
+
 int V1TransportDeserializer::readHeader(Span<const uint8_t> msg_bytes)
 {
     // copy data to temporary parsing buffer
@@ -777,46 +858,145 @@ Optional<CNetMessage> V1TransportDeserializer::GetMessage(const std::chrono::mic
     return msg;
 }
 
-void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) {
+CSharedNetPayload::CSharedNetPayload(std::vector<unsigned char>&& data_in)
+    : hash(Hash(data_in))
+{
+    data = std::make_shared<const std::vector<unsigned char>>(std::move(data_in));
+}
+
+void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, CSerializedNetHeader& header) {
     // create dbl-sha256 checksum
     uint256 hash = Hash(msg.data);
 
+    prepareForTransport(msg.m_type, msg.data.size(), hash, header);
+}
+
+void V1TransportSerializer::prepareForTransport(const std::string& msg_type, size_t payload_size, const uint256& payload_hash, CSerializedNetHeader& header) {
     // create header
-    CMessageHeader hdr(Params().MessageStart(), msg.m_type.c_str(), msg.data.size());
-    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CMessageHeader hdr(Params().MessageStart(), msg_type.c_str(), payload_size);
+    memcpy(hdr.pchChecksum, payload_hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     // serialize header
-    header.reserve(CMessageHeader::HEADER_SIZE);
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, header, 0, hdr};
+    SpanWriter{SER_NETWORK, INIT_PROTO_VERSION, header, hdr};
+}
+
+/** Maximum number of buffers written by a single system call in SocketSendData */
+static constexpr size_t MAX_SEND_BUFFERS = 64;
+
+/** Write buffers to a socket, with a single system call where the platform allows it. Returns like send(). */
+static int SendBuffers(SOCKET hSocket, Span<const Span<const unsigned char>> buffers)
+{
+#ifdef WIN32
+    return send(hSocket, reinterpret_cast<const char*>(buffers[0].data()), buffers[0].size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    struct iovec iov[MAX_SEND_BUFFERS];
+    assert(buffers.size() <= MAX_SEND_BUFFERS);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        iov[i].iov_base = const_cast<unsigned char*>(buffers[i].data());
+        iov[i].iov_len = buffers[i].size();
+    }
+    struct msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = buffers.size();
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
+size_t GatherSendBuffers(SendQueueIterator begin, SendQueueIterator end, size_t offset, Span<Span<const unsigned char>> buffers, size_t& requested)
+{
+    size_t count = 0;
+    requested = 0;
+    for (auto it = begin; it != end && count + 2 <= buffers.size(); ++it) {
+        const Span<const unsigned char> parts[] = {it->header, it->is_file() ? Span<const unsigned char>{} : Span<const unsigned char>{it->bytes()}};
+        for (const Span<const unsigned char>& part : parts) {
+            if (offset >= part.size()) {
+                offset -= part.size();
+                continue;
+            }
+            buffers[count++] = part.subspan(offset);
+            requested += part.size() - offset;
+            offset = 0;
+        }
+        // A file payload ends the batch, as it is sent with sendfile().
+        if (it->is_file()) break;
+    }
+    return count;
+}
+
+SendQueueIterator AdvanceSendQueue(SendQueueIterator it, size_t sent, size_t& offset, size_t& queue_size)
+{
+    // Move past the messages that were sent completely
+    while (sent >= it->size() - offset) {
+        sent -= it->size() - offset;
+        offset = 0;
+        queue_size -= it->size();
+        ++it;
+        if (sent == 0) break;
+    }
+    offset += sent;
+    return it;
 }
 
 size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pnode->cs_vSend)
 {
-    auto it = pnode->vSendMsg.begin();
+    SendQueueIterator it = pnode->vSendMsg.cbegin();
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->size() > pnode->nSendOffset);
+        const bool send_file = it->is_file() && pnode->nSendOffset >= it->header.size();
+        size_t nRequested = 0;
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (send_file) {
+#ifdef USE_SENDFILE
+                if (pnode->m_send_file == nullptr) {
+                    pnode->m_send_file = fsbridge::fopen(it->file_path, "rb");
+                    if (pnode->m_send_file == nullptr) {
+                        // The file may have been pruned since the message was queued
+                        LogPrintf("cannot open %s to send from, disconnecting peer=%d\n", it->file_path.string(), pnode->GetId());
+                        pnode->CloseSocketDisconnect();
+                        break;
+                    }
+                }
+                const size_t payload_offset = pnode->nSendOffset - it->header.size();
+                off_t offset = it->file_offset + payload_offset;
+                nRequested = it->file_size - payload_offset;
+                nBytes = sendfile(pnode->hSocket, fileno(pnode->m_send_file), &offset, nRequested);
+#else
+                assert(!"file ranges are only queued where sendfile is available");
+#endif
+            } else {
+                // Gather what is left of this message and the messages after
+                // it, so that a burst of small messages is written at once.
+                std::array<Span<const unsigned char>, MAX_SEND_BUFFERS> buffers;
+                const size_t count = GatherSendBuffers(it, pnode->vSendMsg.cend(), pnode->nSendOffset, buffers, nRequested);
+                nBytes = SendBuffers(pnode->hSocket, Span<const Span<const unsigned char>>{buffers}.first(count));
+#ifdef WIN32
+                // SendBuffers() writes only the first buffer here. Count only
+                // that, so that the rest is sent rather than taken for a full
+                // socket buffer.
+                nRequested = buffers[0].size();
+#endif
+            }
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
-                pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+            const SendQueueIterator sent_it = it;
+            it = AdvanceSendQueue(it, nBytes, pnode->nSendOffset, pnode->nSendSize);
+            if (send_file && it != sent_it) {
+                // The file range was sent completely
+                fclose(pnode->m_send_file);
+                pnode->m_send_file = nullptr;
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -828,6 +1008,10 @@ size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pno
                     LogPrintf("socket send error %s\n", NetworkErrorString(nErr));
                     pnode->CloseSocketDisconnect();
                 }
+            } else if (send_file) {
+                // the file is shorter than the range that was queued
+                LogPrintf("sendfile reached the end of the file early, disconnecting peer=%d\n", pnode->GetId());
+                pnode->CloseSocketDisconnect();
             }
             // couldn't send anything at all
             break;
@@ -1129,6 +1313,15 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         vNodes.push_back(pnode);
     }
 
+    // Only register the socket once the node is in vNodes: an edge-triggered
+    // event reported before its socket handler can find the node would be lost.
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket != INVALID_SOCKET && !RegisterSocketEvents(pnode->hSocket, /* edge_triggered */ true, SocketHandlerIndex(id))) {
+            pnode->fDisconnect = true;
+        }
+    }
+
     // We received a new connection, harvest entropy from the time (and our peer count)
     RandAddEvent((uint32_t)id);
 }
@@ -1239,16 +1432,26 @@ void CConnman::InactivityCheck(CNode *pnode)
     }
 }
 
-bool CConnman::GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+size_t CConnman::SocketHandlerIndex(NodeId id) const
 {
-    for (const ListenSocket& hListenSocket : vhListenSocket) {
-        recv_set.insert(hListenSocket.socket);
+    if (m_socket_handlers.empty()) return 0;
+    return static_cast<size_t>(id) % m_socket_handlers.size();
+}
+
+bool CConnman::GenerateSelectSet(const SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    if (ctx.index == 0) {
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            recv_set.insert(hListenSocket.socket);
+        }
     }
 
     {
         LOCK(cs_vNodes);
         for (CNode* pnode : vNodes)
         {
+            if (SocketHandlerIndex(pnode->GetId()) != ctx.index) continue;
+
             // Implement the following logic:
             // * If there is data to send, select() for sending data. As this only
             //   happens when optimistic write failed, we choose to first drain the
@@ -1285,11 +1488,82 @@ bool CConnman::GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &s
     return !recv_set.empty() || !send_set.empty() || !error_set.empty();
 }
 
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    // All sockets stay registered with the epoll instance for their whole
+    // lifetime, so unlike poll() and select() there is no set to rebuild here.
+    const int timeout = ctx.events_pending ? 0 : SELECT_TIMEOUT_MILLISECONDS;
+    ctx.events_pending = false;
+
+    struct epoll_event events[256];
+    int nEvents = epoll_wait(ctx.epoll_fd, events, ARRAYLEN(events), timeout);
+
+    if (interruptNet) return;
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; ++i) {
+        const SOCKET hSocket = events[i].data.fd;
+        if (events[i].events & EPOLLIN)              recv_set.insert(hSocket);
+        if (events[i].events & EPOLLOUT)             send_set.insert(hSocket);
+        if (events[i].events & (EPOLLERR|EPOLLHUP))  error_set.insert(hSocket);
+    }
+}
+#endif
+
+bool CConnman::RegisterSocketEvents(SOCKET hSocket, bool edge_triggered, size_t handler_index)
+{
+#ifdef USE_EPOLL
+    if (handler_index >= m_socket_handlers.size()) return true;
+    const int epoll_fd = m_socket_handlers[handler_index].epoll_fd;
+    if (epoll_fd == -1) return true;
+
+    struct epoll_event event{};
+    event.data.fd = hSocket;
+    event.events = edge_triggered ? (EPOLLIN | EPOLLOUT | EPOLLET) : EPOLLIN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, hSocket, &event) != 0) {
+        LogPrintf("Failed to add socket to epoll set: %s\n", NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+#endif
+    return true;
+}
+
+void CConnman::SocketEvents(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    switch (m_socket_events_mode) {
+#ifdef USE_EPOLL
+    case SocketEventsMode::EPOLL:
+        SocketEventsEpoll(ctx, recv_set, send_set, error_set);
+        return;
+#endif
 #ifdef USE_POLL
-void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+    case SocketEventsMode::POLL:
+        SocketEventsPoll(ctx, recv_set, send_set, error_set);
+        return;
+#else
+    case SocketEventsMode::SELECT:
+        SocketEventsSelect(ctx, recv_set, send_set, error_set);
+        return;
+#endif
+    default:
+        assert(false);
+    }
+}
+
+#ifdef USE_POLL
+void CConnman::SocketEventsPoll(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
 {
     std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
-    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+    if (!GenerateSelectSet(ctx, recv_select_set, send_select_set, error_select_set)) {
         interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
         return;
     }
@@ -1328,10 +1602,10 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
     }
 }
 #else
-void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+void CConnman::SocketEventsSelect(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
 {
     std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
-    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+    if (!GenerateSelectSet(ctx, recv_select_set, send_select_set, error_select_set)) {
         interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
         return;
     }
@@ -1403,33 +1677,37 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
 }
 #endif
 
-void CConnman::SocketHandler()
+void CConnman::SocketHandler(SocketHandlerContext& ctx)
 {
     std::set<SOCKET> recv_set, send_set, error_set;
-    SocketEvents(recv_set, send_set, error_set);
+    SocketEvents(ctx, recv_set, send_set, error_set);
 
     if (interruptNet) return;
 
     //
     // Accept new connections
     //
-    for (const ListenSocket& hListenSocket : vhListenSocket)
-    {
-        if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
+    if (ctx.index == 0) {
+        for (const ListenSocket& hListenSocket : vhListenSocket)
         {
-            AcceptConnection(hListenSocket);
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
+            {
+                AcceptConnection(hListenSocket);
+            }
         }
     }
 
     //
-    // Service each socket
+    // Service each socket of this thread's shard
     //
     std::vector<CNode*> vNodesCopy;
     {
         LOCK(cs_vNodes);
-        vNodesCopy = vNodes;
-        for (CNode* pnode : vNodesCopy)
+        for (CNode* pnode : vNodes) {
+            if (SocketHandlerIndex(pnode->GetId()) != ctx.index) continue;
             pnode->AddRef();
+            vNodesCopy.push_back(pnode);
+        }
     }
     for (CNode* pnode : vNodesCopy)
     {
@@ -1450,6 +1728,24 @@ void CConnman::SocketHandler()
             sendSet = send_set.count(pnode->hSocket) > 0;
             errorSet = error_set.count(pnode->hSocket) > 0;
         }
+        if (m_socket_events_mode == SocketEventsMode::EPOLL) {
+            // Edge-triggered events are only reported once, so remember them
+            // until the socket has been drained, and apply the same policy as
+            // GenerateSelectSet: drain the send buffer before receiving more.
+            pnode->m_sock_recv_ready |= recvSet || errorSet;
+            pnode->m_sock_send_ready |= sendSet;
+            if (pnode->m_sock_recv_ready || pnode->m_sock_send_ready) {
+                bool send_pending;
+                {
+                    LOCK(pnode->cs_vSend);
+                    send_pending = !pnode->vSendMsg.empty();
+                }
+                sendSet = pnode->m_sock_send_ready && send_pending;
+                recvSet = pnode->m_sock_recv_ready && !send_pending && !pnode->fPauseRecv;
+            } else {
+                sendSet = recvSet = false;
+            }
+        }
         if (recvSet || errorSet)
         {
             // typical socket buffer is 8K-64K
@@ -1461,6 +1757,16 @@ void CConnman::SocketHandler()
                     continue;
                 nBytes = recv(pnode->hSocket, (char*)pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
             }
+            if (m_socket_events_mode == SocketEventsMode::EPOLL) {
+                // Keep reading until the socket reports that it is drained: a
+                // short read does not mean that, as the end of the stream may
+                // have been reported by the same event as the last data.
+                if (nBytes > 0) {
+                    ctx.events_pending = true;
+                } else {
+                    pnode->m_sock_recv_ready = false;
+                }
+            }
             if (nBytes > 0)
             {
                 bool notify = false;
@@ -1480,8 +1786,9 @@ void CConnman::SocketHandler()
                         pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
                         pnode->nProcessQueueSize += nSizeAdded;
                         pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                        pnode->TakeSpentRecvMsgs();
                     }
-                    WakeMessageHandler();
+                    WakeMessageHandler(pnode->GetId());
                 }
             }
             else if (nBytes == 0)
@@ -1516,6 +1823,23 @@ void CConnman::SocketHandler()
             if (nBytes) {
                 RecordBytesSent(nBytes);
             }
+            // SocketSendData stops at the first short write, so leftover data
+            // means the socket buffer is full until the next EPOLLOUT edge.
+            pnode->m_sock_send_ready = pnode->vSendMsg.empty();
+        }
+
+        if (m_socket_events_mode == SocketEventsMode::EPOLL && pnode->m_sock_recv_ready && !pnode->fPauseRecv && !pnode->fDisconnect) {
+            // Data left unread because the send queue came first won't be
+            // reported again, so don't block waiting for it. When the send
+            // buffer is full, the EPOLLOUT edge wakes us. A peer whose
+            // receiving is paused is picked up again after the usual timeout
+            // once the message handler has caught up, as with poll().
+            bool send_blocked;
+            {
+                LOCK(pnode->cs_vSend);
+                send_blocked = !pnode->vSendMsg.empty() && !pnode->m_sock_send_ready;
+            }
+            if (!send_blocked) ctx.events_pending = true;
         }
 
         InactivityCheck(pnode);
@@ -1527,13 +1851,15 @@ void CConnman::SocketHandler()
     }
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::ThreadSocketHandler(SocketHandlerContext& ctx)
 {
     while (!interruptNet)
     {
-        DisconnectNodes();
-        NotifyNumConnectionsChanged();
-        SocketHandler();
+        if (ctx.index == 0) {
+            DisconnectNodes();
+            NotifyNumConnectionsChanged();
+        }
+        SocketHandler(ctx);
     }
 }
 
@@ -1541,9 +1867,29 @@ void CConnman::WakeMessageHandler()
 {
     {
         LOCK(mutexMsgProc);
-        fMsgProcWake = true;
+        for (MessageHandlerContext& ctx : m_msg_handlers) {
+            ctx.wake = true;
+        }
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
+}
+
+void CConnman::WakeMessageHandler(NodeId id)
+{
+    {
+        LOCK(mutexMsgProc);
+        if (m_msg_handlers.empty()) return;
+        m_msg_handlers[MessageHandlerIndex(id)].wake = true;
+    }
+    // The threads share condMsgProc, so wake them all and let the ones
+    // without a wake flag go back to sleep.
+    condMsgProc.notify_all();
+}
+
+size_t CConnman::MessageHandlerIndex(NodeId id) const
+{
+    if (m_msg_handlers.empty()) return 0;
+    return static_cast<size_t>(id) % m_msg_handlers.size();
 }
 
 
@@ -2222,18 +2568,27 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+
+    // See AcceptConnection: register only once the node can be found.
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket != INVALID_SOCKET && !RegisterSocketEvents(pnode->hSocket, /* edge_triggered */ true, SocketHandlerIndex(pnode->GetId()))) {
+            pnode->fDisconnect = true;
+        }
+    }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(MessageHandlerContext& ctx)
 {
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            for (CNode* pnode : vNodes) {
+                if (MessageHandlerIndex(pnode->GetId()) != ctx.index) continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -2267,9 +2622,9 @@ void CConnman::ThreadMessageHandler()
 
         WAIT_LOCK(mutexMsgProc, lock);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this]() EXCLUSIVE_LOCKS_REQUIRED(mutexMsgProc) { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [&ctx]() EXCLUSIVE_LOCKS_REQUIRED(mutexMsgProc) { return ctx.wake; });
         }
-        fMsgProcWake = false;
+        ctx.wake = false;
     }
 }
 
@@ -2333,6 +2688,13 @@ bool CConnman::BindListenPort(const CService& addrBind, bilingual_str& strError,
         return false;
     }
 
+    if (!RegisterSocketEvents(hListenSocket, /* edge_triggered */ false, /* handler_index */ 0)) {
+        strError = strprintf(Untranslated("Error: Unable to wait for incoming connections on %s"), addrBind.ToString());
+        LogPrintf("%s\n", strError.original);
+        CloseSocket(hListenSocket);
+        return false;
+    }
+
     vhListenSocket.push_back(ListenSocket(hListenSocket, permissions));
     return true;
 }
@@ -2466,6 +2828,26 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 {
     Init(connOptions);
 
+    m_socket_handlers = std::vector<SocketHandlerContext>(m_socket_threads);
+    for (size_t i = 0; i < m_socket_handlers.size(); ++i) {
+        SocketHandlerContext& ctx = m_socket_handlers[i];
+        ctx.index = i;
+#ifdef USE_EPOLL
+        if (m_socket_events_mode == SocketEventsMode::EPOLL) {
+            ctx.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if (ctx.epoll_fd == -1) {
+                LogPrintf("epoll_create1 failed: %s\n", NetworkErrorString(WSAGetLastError()));
+                if (clientInterface) {
+                    clientInterface->ThreadSafeMessageBox(
+                        _("Failed to create the epoll instance used for network events. Use -socketevents=poll to avoid epoll."),
+                        "", CClientUIInterface::MSG_ERROR);
+                }
+                return false;
+            }
+        }
+#endif
+    }
+
     if (fListen && !InitBinds(connOptions.vBinds, connOptions.vWhiteBinds, connOptions.onion_binds)) {
         if (clientInterface) {
             clientInterface->ThreadSafeMessageBox(
@@ -2527,11 +2909,22 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+        m_msg_handlers = std::vector<MessageHandlerContext>(m_msghand_threads);
+        for (size_t i = 0; i < m_msg_handlers.size(); ++i) {
+            m_msg_handlers[i].index = i;
+        }
     }
 
     // Send and receive from sockets, accept connections
-    threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
+    for (SocketHandlerContext& ctx : m_socket_handlers) {
+        std::string thread_name = ctx.index == 0 ? "net" : strprintf("net.%u", ctx.index);
+        ctx.thread = std::thread([this, &ctx, thread_name] {
+            TraceThread(thread_name.c_str(), [this, &ctx] { ThreadSocketHandler(ctx); });
+        });
+    }
+    if (m_socket_handlers.size() > 1) {
+        LogPrintf("Using %u socket handler threads\n", m_socket_handlers.size());
+    }
 
     if (!gArgs.GetBoolArg("-dnsseed", true))
         LogPrintf("DNS seeding disabled\n");
@@ -2553,7 +2946,15 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (MessageHandlerContext& ctx : m_msg_handlers) {
+        std::string thread_name = ctx.index == 0 ? "msghand" : strprintf("msghand.%u", ctx.index);
+        ctx.thread = std::thread([this, &ctx, thread_name] {
+            TraceThread(thread_name.c_str(), [this, &ctx] { ThreadMessageHandler(ctx); });
+        });
+    }
+    if (m_msg_handlers.size() > 1) {
+        LogPrintf("Using %u message handler threads\n", m_msg_handlers.size());
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery([this] { DumpAddresses(); }, DUMP_PEERS_INTERVAL);
@@ -2602,16 +3003,20 @@ void CConnman::Interrupt()
 
 void CConnman::StopThreads()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (MessageHandlerContext& ctx : m_msg_handlers) {
+        if (ctx.thread.joinable())
+            ctx.thread.join();
+    }
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
         threadOpenAddedConnections.join();
     if (threadDNSAddressSeed.joinable())
         threadDNSAddressSeed.join();
-    if (threadSocketHandler.joinable())
-        threadSocketHandler.join();
+    for (SocketHandlerContext& ctx : m_socket_handlers) {
+        if (ctx.thread.joinable())
+            ctx.thread.join();
+    }
 }
 
 void CConnman::StopNodes()
@@ -2651,6 +3056,15 @@ void CConnman::StopNodes()
     vhListenSocket.clear();
     semOutbound.reset();
     semAddnode.reset();
+
+#ifdef USE_EPOLL
+    for (SocketHandlerContext& ctx : m_socket_handlers) {
+        if (ctx.epoll_fd != -1) {
+            close(ctx.epoll_fd);
+            ctx.epoll_fd = -1;
+        }
+    }
+#endif
 }
 
 void CConnman::DeleteNode(CNode* pnode)
@@ -2706,6 +3120,7 @@ std::vector<CAddress> CConnman::GetAddresses(CNode& requestor, size_t max_addres
         .Write(local_socket_bytes.data(), local_socket_bytes.size())
         .Finalize();
     const auto current_time = GetTime<std::chrono::microseconds>();
+    LOCK(m_addr_response_caches_mutex);
     auto r = m_addr_response_caches.emplace(cache_id, CachedAddrResponse{});
     CachedAddrResponse& cache_entry = r.first->second;
     if (cache_entry.m_cache_entry_expiration < current_time) { // If emplace() added new one it has expiration 0.
@@ -2964,6 +3379,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, SOCKET hSocketIn, const
 CNode::~CNode()
 {
     CloseSocket(hSocket);
+    if (m_send_file != nullptr) fclose(m_send_file);
 }
 
 bool CConnman::NodeFullyConnected(const CNode* pnode)
@@ -2977,9 +3393,67 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.m_type), nMessageSize, pnode->GetId());
 
     // make sure we use the appropriate network transport format
-    std::vector<unsigned char> serializedHeader;
+    CSerializedNetHeader serializedHeader;
     pnode->m_serializer->prepareForTransport(msg, serializedHeader);
-    size_t nTotalSize = nMessageSize + serializedHeader.size();
+
+    CSendQueueEntry entry{std::move(msg.data)};
+    entry.header = serializedHeader;
+    PushSendQueue(pnode, msg.m_type, std::move(entry));
+}
+
+void CConnman::PushMessage(CNode* pnode, const std::string& msg_type, const CSharedNetPayload& payload)
+{
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg_type), payload.data->size(), pnode->GetId());
+
+    CSendQueueEntry entry{payload.data};
+    pnode->m_serializer->prepareForTransport(msg_type, payload.data->size(), payload.hash, entry.header);
+    PushSendQueue(pnode, msg_type, std::move(entry));
+}
+
+bool CConnman::PushMessageFromFile(CNode* pnode, const std::string& msg_type, FILE* filein, const fs::path& path, uint64_t offset, size_t size)
+{
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg_type), size, pnode->GetId());
+
+    CAutoFile file{filein, SER_DISK, CLIENT_VERSION};
+    assert(!file.IsNull());
+#ifdef USE_SENDFILE
+    // The header carries a checksum of the payload, so it still has to be
+    // read once, but in chunks rather than into a buffer of the full size.
+    CHash256 hasher;
+    std::vector<unsigned char> buf(std::min<size_t>(size, 0x10000));
+    const int fd = fileno(file.Get());
+    for (size_t pos = 0; pos < size;) {
+        const ssize_t nRead = pread(fd, buf.data(), std::min(buf.size(), size - pos), offset + pos);
+        if (nRead < 0 && errno == EINTR) continue;
+        if (nRead <= 0) {
+            LogPrintf("%s: failed to read %s payload from file: %s\n", __func__, SanitizeString(msg_type), NetworkErrorString(errno));
+            return false;
+        }
+        hasher.Write(MakeSpan(buf).first(nRead));
+        pos += nRead;
+    }
+    uint256 hash;
+    hasher.Finalize(hash);
+
+    CSendQueueEntry entry{path, offset, size};
+    pnode->m_serializer->prepareForTransport(msg_type, size, hash, entry.header);
+    PushSendQueue(pnode, msg_type, std::move(entry), file.release());
+#else
+    CSerializedNetMsg msg;
+    msg.m_type = msg_type;
+    msg.data.resize(size);
+    if (fseek(file.Get(), offset, SEEK_SET) != 0 || fread(msg.data.data(), 1, size, file.Get()) != size) {
+        LogPrintf("%s: failed to read %s payload from file\n", __func__, SanitizeString(msg_type));
+        return false;
+    }
+    PushMessage(pnode, std::move(msg));
+#endif
+    return true;
+}
+
+void CConnman::PushSendQueue(CNode* pnode, const std::string& msg_type, CSendQueueEntry&& msg, FILE* file)
+{
+    size_t nTotalSize = msg.size();
 
     size_t nBytesSent = 0;
     {
@@ -2987,14 +3461,23 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per message type
-        pnode->mapSendBytesPerMsgCmd[msg.m_type] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[msg_type] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(std::move(msg));
+        if (file != nullptr) {
+            // Keep the file the payload was read from for sending it, unless
+            // other messages go first. It is then opened again once this
+            // message is at the front of the queue, so that a peer with many
+            // queued file ranges doesn't hold a file descriptor for each.
+            if (optimisticSend && pnode->m_send_file == nullptr) {
+                pnode->m_send_file = file;
+            } else {
+                fclose(file);
+            }
+        }
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
@@ -13,6 +13,7 @@
 #include <chainparams.h>
 #include <compat.h>
 #include <crypto/siphash.h>
+#include <fs.h>
 #include <hash.h>
 #include <net_permissions.h>
 #include <netaddress.h>
@@ -26,6 +27,7 @@
 #include <uint256.h>
 #include <util/check.h>
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
@@ -55,6 +57,10 @@ static const int EXTRA_BLOCK_RELAY_ONLY_PEER_INTERVAL = 300;
 static constexpr size_t MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Number of processed messages per peer whose memory is kept for receiving later messages. */
+static const size_t MAX_SPARE_RECV_MSGS = 4;
+/** Only messages up to this payload size are kept for reuse, so that large messages don't pin memory. */
+static const unsigned int MAX_SPARE_RECV_MSG_SIZE = 64 * 1024;
 /** Maximum length of the user agent string in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** Maximum number of automatic outgoing nodes over which we'll relay everything (blocks, tx, addrs, etc) */
@@ -86,6 +92,38 @@ static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
+/** Mechanism used by the socket handler thread to wait for socket readiness. */
+enum class SocketEventsMode {
+    SELECT,
+    POLL,
+    EPOLL,
+};
+
+/** -socketevents default */
+#if defined(USE_EPOLL)
+static const SocketEventsMode DEFAULT_SOCKET_EVENTS_MODE = SocketEventsMode::EPOLL;
+#elif defined(USE_POLL)
+static const SocketEventsMode DEFAULT_SOCKET_EVENTS_MODE = SocketEventsMode::POLL;
+#else
+static const SocketEventsMode DEFAULT_SOCKET_EVENTS_MODE = SocketEventsMode::SELECT;
+#endif
+
+/** -socketthreads default */
+static const int DEFAULT_SOCKET_THREADS = 1;
+/** Maximum number of socket handler threads */
+static const int MAX_SOCKET_THREADS = 64;
+
+/** -msghandthreads default */
+static const int DEFAULT_MSGHAND_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 64;
+
+/** Parse a -socketevents value. Only modes supported by this build are accepted. */
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode);
+std::string SocketEventsModeToString(SocketEventsMode mode);
+/** Comma-separated list of the -socketevents values supported by this build. */
+std::string SupportedSocketEventsModes();
+
 typedef int64_t NodeId;
 
 struct AddedNodeInfo
@@ -98,6 +136,7 @@ struct AddedNodeInfo
 
 class CNodeStats;
 class CClientUIInterface;
+struct CSendQueueEntry;
 
 struct CSerializedNetMsg
 {
@@ -112,6 +151,20 @@ struct CSerializedNetMsg
     std::string m_type;
 };
 
+/**
+ * A message payload that is serialized once and queued for any number of
+ * peers without being copied. hash is the double-SHA256 of data, from which
+ * the checksum in the message header is taken.
+ */
+struct CSharedNetPayload
+{
+    std::shared_ptr<const std::vector<unsigned char>> data;
+    uint256 hash;
+
+    CSharedNetPayload() = default;
+    explicit CSharedNetPayload(std::vector<unsigned char>&& data_in);
+};
+
 /** Different types of connections to a peer. This enum encapsulates the
  * information we have available at the time of opening or accepting the
  * connection. Aside from INBOUND, all types are initiated by us.
@@ -207,6 +260,9 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundLimit = 0;
         int64_t m_peer_connect_timeout = DEFAULT_PEER_CONNECT_TIMEOUT;
+        SocketEventsMode m_socket_events_mode = DEFAULT_SOCKET_EVENTS_MODE;
+        int m_socket_threads = DEFAULT_SOCKET_THREADS;
+        int m_msghand_threads = DEFAULT_MSGHAND_THREADS;
         std::vector<std::string> vSeedNodes;
         std::vector<NetWhitelistPermissions> vWhitelistedRange;
         std::vector<NetWhitebindPermissions> vWhiteBinds;
@@ -233,6 +289,9 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         m_peer_connect_timeout = connOptions.m_peer_connect_timeout;
+        m_socket_events_mode = connOptions.m_socket_events_mode;
+        m_socket_threads = std::max(1, std::min(connOptions.m_socket_threads, MAX_SOCKET_THREADS));
+        m_msghand_threads = std::max(1, std::min(connOptions.m_msghand_threads, MAX_MSGHAND_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
@@ -267,6 +326,18 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    /** Push a message whose payload may be shared with other peers. */
+    void PushMessage(CNode* pnode, const std::string& msg_type, const CSharedNetPayload& payload);
+    /**
+     * Push a message whose payload is the size bytes at offset in file, which
+     * is open at path and owned by this function. Where sendfile() is
+     * available, the payload is sent straight from the file instead of being
+     * copied into the send buffer; the file is read once here for the
+     * checksum, and sent from while the message is at the front of the send
+     * queue. Returns false, without queueing anything, if the file could not
+     * be read.
+     */
+    bool PushMessageFromFile(CNode* pnode, const std::string& msg_type, FILE* file, const fs::path& path, uint64_t offset, size_t size);
 
     using NodeFn = std::function<void(CNode*)>;
     void ForEachNode(const NodeFn& func)
@@ -347,6 +418,7 @@ public:
     std::vector<AddedNodeInfo> GetAddedNodeInfo();
 
     size_t GetNodeCount(NumConnections num);
+    int GetMessageHandlerThreads() const { return m_msghand_threads; }
     void GetNodeStats(std::vector<CNodeStats>& vstats);
     bool DisconnectNode(const std::string& node);
     bool DisconnectNode(const CSubNet& subnet);
@@ -385,7 +457,10 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake all message handler threads */
     void WakeMessageHandler();
+    /** Wake the message handler thread that processes the messages of the given node */
+    void WakeMessageHandler(NodeId id);
 
     /** Attempts to obfuscate tx time through exponentially distributed emitting.
         Works assuming that a single interval is used.
@@ -416,15 +491,64 @@ private:
     void AddAddrFetch(const std::string& strDest);
     void ProcessAddrFetch();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+
+    /**
+     * State owned by one message handler thread. Peers are sharded across the
+     * message handler threads by node id, see MessageHandlerIndex(), so the
+     * messages of one peer are still processed in order by a single thread,
+     * while peers with unrelated work don't wait for each other.
+     */
+    struct MessageHandlerContext {
+        size_t index{0};
+        std::thread thread;
+        /** flag for waking this message handler thread, protected by mutexMsgProc */
+        bool wake{false};
+    };
+
+    /** Index of the message handler thread that processes the messages of the given node. */
+    size_t MessageHandlerIndex(NodeId id) const;
+    void ThreadMessageHandler(MessageHandlerContext& ctx);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void DisconnectNodes();
     void NotifyNumConnectionsChanged();
     void InactivityCheck(CNode *pnode);
-    bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
-    void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
-    void SocketHandler();
-    void ThreadSocketHandler();
+
+    /**
+     * State owned by one socket handler thread. Peers are sharded across the
+     * socket handler threads by node id, see SocketHandlerIndex(). The first
+     * thread also accepts new connections and cleans up disconnected nodes.
+     */
+    struct SocketHandlerContext {
+        size_t index{0};
+        std::thread thread;
+        /** epoll instance holding the sockets serviced by this thread, when m_socket_events_mode is EPOLL */
+        int epoll_fd{-1};
+        /** Some peer socket may still have data to read, so don't block in the next SocketEvents call */
+        bool events_pending{false};
+    };
+
+    /** Index of the socket handler thread that services the sockets of the given node. */
+    size_t SocketHandlerIndex(NodeId id) const;
+    bool GenerateSelectSet(const SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    void SocketEvents(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#ifdef USE_EPOLL
+    void SocketEventsEpoll(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#endif
+#ifdef USE_POLL
+    void SocketEventsPoll(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#else
+    void SocketEventsSelect(SocketHandlerContext& ctx, std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#endif
+    /**
+     * Add a socket to the epoll set of the given socket handler thread, if the
+     * epoll backend is in use. Listening sockets are level-triggered; peer
+     * sockets are edge-triggered and their readiness is tracked in
+     * CNode::m_sock_recv_ready/m_sock_send_ready. Sockets are removed from the
+     * set automatically when they are closed.
+     */
+    bool RegisterSocketEvents(SOCKET hSocket, bool edge_triggered, size_t handler_index);
+    void SocketHandler(SocketHandlerContext& ctx);
+    void ThreadSocketHandler(SocketHandlerContext& ctx);
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -449,6 +573,9 @@ private:
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    /** Queue a serialized message header and its payload, and attempt an optimistic write.
+     *  file, if set, is the open file of a file range payload and is owned by this function. */
+    void PushSendQueue(CNode* pnode, const std::string& msg_type, CSendQueueEntry&& msg, FILE* file = nullptr);
     void DumpAddresses();
 
     // Network stats
@@ -477,6 +604,10 @@ private:
     // P2P timeout in seconds
     int64_t m_peer_connect_timeout;
 
+    SocketEventsMode m_socket_events_mode{DEFAULT_SOCKET_EVENTS_MODE};
+    int m_socket_threads{DEFAULT_SOCKET_THREADS};
+    int m_msghand_threads{DEFAULT_MSGHAND_THREADS};
+
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
     std::vector<NetWhitelistPermissions> vWhitelistedRange;
@@ -523,7 +654,8 @@ private:
      * resulting in at most ~196 KB. Every separate local socket may
      * add up to ~196 KB extra.
      */
-    std::map<uint64_t, CachedAddrResponse> m_addr_response_caches;
+    std::map<uint64_t, CachedAddrResponse> m_addr_response_caches GUARDED_BY(m_addr_response_caches_mutex);
+    Mutex m_addr_response_caches_mutex;
 
     /**
      * Services this instance offers.
@@ -568,9 +700,6 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake GUARDED_BY(mutexMsgProc);
-
     std::condition_variable condMsgProc;
     Mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc{false};
@@ -578,10 +707,12 @@ private:
     CThreadInterrupt interruptNet;
 
     std::thread threadDNSAddressSeed;
-    std::thread threadSocketHandler;
+    /** Sized in Start() and not resized while the socket handler threads run */
+    std::vector<SocketHandlerContext> m_socket_handlers;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    /** Sized in Start() and not resized while the message handler threads run */
+    std::vector<MessageHandlerContext> m_msg_handlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of m_max_outbound_full_relay
@@ -756,6 +887,8 @@ public:
     virtual int Read(Span<const uint8_t>& msg_bytes) = 0;
     // decomposes a message from the context
     virtual Optional<CNetMessage> GetMessage(std::chrono::microseconds time, uint32_t& out_err) = 0;
+    // hands back the buffer of a processed message, so that a later message can be received into it without allocating
+    virtual void RecycleBuffer(CDataStream&& buffer) = 0;
     virtual ~TransportDeserializer() {}
 };
 
@@ -820,22 +953,86 @@ public:
         return ret;
     }
     Optional<CNetMessage> GetMessage(std::chrono::microseconds time, uint32_t& out_err_raw_size) override;
+    void RecycleBuffer(CDataStream&& buffer) override
+    {
+        // Only swap in the buffer while no message data is being received
+        if (in_data) return;
+        buffer.clear();
+        buffer.SetType(vRecv.GetType());
+        buffer.SetVersion(vRecv.GetVersion());
+        vRecv = std::move(buffer);
+    }
 };
 
+/** A serialized message header, kept inline in the send queue */
+using CSerializedNetHeader = std::array<unsigned char, CMessageHeader::HEADER_SIZE>;
+
 /** The TransportSerializer prepares messages for the network transport
  */
 class TransportSerializer {
 public:
     // prepare message for transport (header construction, error-correction computation, payload encryption, etc.)
-    virtual void prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) = 0;
+    virtual void prepareForTransport(CSerializedNetMsg& msg, CSerializedNetHeader& header) = 0;
+    // prepare the header of a message whose payload is sent unmodified from elsewhere, given the payload's size and dbl-sha256
+    virtual void prepareForTransport(const std::string& msg_type, size_t payload_size, const uint256& payload_hash, CSerializedNetHeader& header) = 0;
     virtual ~TransportSerializer() {}
 };
 
 class V1TransportSerializer  : public TransportSerializer {
 public:
-    void prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) override;
+    void prepareForTransport(CSerializedNetMsg& msg, CSerializedNetHeader& header) override;
+    void prepareForTransport(const std::string& msg_type, size_t payload_size, const uint256& payload_hash, CSerializedNetHeader& header) override;
+};
+
+/**
+ * A message queued for sending to a peer. The header is stored inline, so
+ * that queueing a message doesn't allocate for it. The payload is either
+ * bytes in memory, owned or shared with other peers, or, when file_path is
+ * set, file_size bytes of that file starting at file_offset. A file range is
+ * sent with sendfile(), without copying it into memory first. The file is
+ * only open while the entry is at the front of the queue (see
+ * CNode::m_send_file), so that a peer requesting many blocks doesn't hold a
+ * file descriptor for each of them.
+ */
+struct CSendQueueEntry
+{
+    CSerializedNetHeader header;
+    std::vector<unsigned char> data;
+    std::shared_ptr<const std::vector<unsigned char>> shared_data;
+    fs::path file_path;
+    uint64_t file_offset{0};
+    size_t file_size{0};
+
+    explicit CSendQueueEntry(std::vector<unsigned char>&& data_in) : data(std::move(data_in)) {}
+    explicit CSendQueueEntry(std::shared_ptr<const std::vector<unsigned char>> data_in) : shared_data(std::move(data_in)) {}
+    CSendQueueEntry(fs::path path, uint64_t offset, size_t size) : file_path(std::move(path)), file_offset(offset), file_size(size) {}
+
+    bool is_file() const { return !file_path.empty(); }
+    /** The payload bytes to send, unless the payload is a file range. */
+    const std::vector<unsigned char>& bytes() const { return shared_data ? *shared_data : data; }
+    size_t payload_size() const { return is_file() ? file_size : bytes().size(); }
+    /** Size of the message, including its header. */
+    size_t size() const { return header.size() + payload_size(); }
 };
 
+using SendQueueIterator = std::deque<CSendQueueEntry>::const_iterator;
+
+/**
+ * Fill buffers with the unsent parts of the queued messages [begin, end),
+ * skipping the first offset bytes of *begin. Gathering stops after a message
+ * with a file payload, which is sent on its own, or when buffers is full.
+ * Returns the number of buffers filled and sets requested to the number of
+ * bytes they hold.
+ */
+size_t GatherSendBuffers(SendQueueIterator begin, SendQueueIterator end, size_t offset, Span<Span<const unsigned char>> buffers, size_t& requested);
+
+/**
+ * Account for sent bytes written from the queue, starting offset bytes into
+ * *it. Returns the first message not sent completely, and updates offset to
+ * the bytes of it that were sent and queue_size by the messages that were.
+ */
+SendQueueIterator AdvanceSendQueue(SendQueueIterator it, size_t sent, size_t& offset, size_t& queue_size);
+
 /** Information about a peer */
 class CNode
 {
@@ -850,9 +1047,11 @@ public:
     std::atomic<ServiceFlags> nServices{NODE_NONE};
     SOCKET hSocket GUARDED_BY(cs_hSocket);
     size_t nSendSize{0}; // total size of all vSendMsg entries
-    size_t nSendOffset{0}; // offset inside the first vSendMsg already sent
+    size_t nSendOffset{0}; // offset inside the first vSendMsg message already sent
     uint64_t nSendBytes GUARDED_BY(cs_vSend){0};
-    std::deque<std::vector<unsigned char>> vSendMsg GUARDED_BY(cs_vSend);
+    std::deque<CSendQueueEntry> vSendMsg GUARDED_BY(cs_vSend);
+    //! The open file of the file range at the front of vSendMsg, if any
+    FILE* m_send_file GUARDED_BY(cs_vSend){nullptr};
     RecursiveMutex cs_vSend;
     RecursiveMutex cs_hSocket;
     RecursiveMutex cs_vRecv;
@@ -860,6 +1059,8 @@ public:
     RecursiveMutex cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg GUARDED_BY(cs_vProcessMsg);
     size_t nProcessQueueSize{0};
+    //! Processed messages handed back by the message handler, see RecycleRecvMsgs()
+    std::list<CNetMessage> m_spent_recv_msgs GUARDED_BY(cs_vProcessMsg);
 
     RecursiveMutex cs_sendProcessing;
 
@@ -901,6 +1102,10 @@ public:
 
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv{false};
+    // Edge-triggered socket readiness, used only by the SocketHandler thread
+    // servicing this node when the epoll backend is in use.
+    bool m_sock_recv_ready{false};
+    bool m_sock_send_ready{false};
     std::atomic_bool fPauseSend{false};
 
     bool IsOutboundOrBlockRelayConn() const {
@@ -989,8 +1194,10 @@ public:
     std::atomic<bool> m_bip152_highbandwidth_from{false};
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    std::unique_ptr<CRollingBloomFilter> m_addr_known{nullptr};
+    /** Protects the addr relay data members, which other peers' message processing may update through PushAddress */
+    Mutex m_addr_send_mutex;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(m_addr_send_mutex);
+    std::unique_ptr<CRollingBloomFilter> m_addr_known PT_GUARDED_BY(m_addr_send_mutex){nullptr};
     bool fGetAddr{false};
     std::chrono::microseconds m_next_addr_send GUARDED_BY(cs_sendProcessing){0};
     std::chrono::microseconds m_next_local_addr_send GUARDED_BY(cs_sendProcessing){0};
@@ -1080,6 +1287,11 @@ private:
 
     NetPermissionFlags m_permissionFlags{ PF_NONE };
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    //! Spent messages whose list node and buffer are reused for the next received ones. Used only by SocketHandler thread.
+    std::list<CNetMessage> m_spare_recv_msgs;
+
+    /** Move messages handed back by the message handler to the spares of the socket handler. */
+    void TakeSpentRecvMsgs() EXCLUSIVE_LOCKS_REQUIRED(cs_vProcessMsg);
 
     mutable RecursiveMutex cs_addrName;
     std::string addrName GUARDED_BY(cs_addrName);
@@ -1118,6 +1330,13 @@ public:
      */
     bool ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete);
 
+    /**
+     * Hand processed messages back to the connection. Up to
+     * MAX_SPARE_RECV_MSGS small ones are kept, and their list nodes and
+     * buffers reused for later messages; the others are left in msgs.
+     */
+    void RecycleRecvMsgs(std::list<CNetMessage>& msgs);
+
     void SetCommonVersion(int greatest_common_version)
     {
         Assume(m_greatest_common_version == INIT_PROTO_VERSION);
@@ -1145,9 +1364,10 @@ public:
 
 
 
-    void AddAddressKnown(const CAddress& _addr)
+    void AddAddressKnown(const CAddress& _addr) LOCKS_EXCLUDED(m_addr_send_mutex)
     {
         assert(m_addr_known);
+        LOCK(m_addr_send_mutex);
         m_addr_known->insert(_addr.GetKey());
     }
 
@@ -1161,12 +1381,13 @@ public:
         return m_wants_addrv2 || addr.IsAddrV1Compatible();
     }
 
-    void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand)
+    void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand) LOCKS_EXCLUDED(m_addr_send_mutex)
     {
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
         assert(m_addr_known);
+        LOCK(m_addr_send_mutex);
         if (_addr.IsValid() && !m_addr_known->contains(_addr.GetKey()) && IsAddrCompatible(_addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
@@ -9,6 +9,7 @@
 #include <consensus/params.h>
 #include <net.h>
 #include <sync.h>
+#include <txmempool.h>
 #include <txrequest.h>
 #include <validationinterface.h>
 
@@ -219,6 +220,11 @@ private:
     /** Send a version message to a peer */
     void PushNodeVersion(CNode& pnode, int64_t nTime);
 
+    /** Sort the transactions with the given hashes, which must be sorted by
+     *  hash, in the order they are announced to a peer. The ones no longer
+     *  in the mempool are left out. */
+    std::vector<TxMempoolInfo> SortForRelay(const std::vector<uint256>& hashes, bool wtxid) LOCKS_EXCLUDED(m_relay_order_mutex);
+
     const CChainParams& m_chainparams;
     CConnman& m_connman;
     /** Pointer to this node's banman. May be nullptr - check existence before dereferencing. */
@@ -249,6 +255,20 @@ private:
      * their own locks.
      */
     std::map<NodeId, PeerRef> m_peer_map GUARDED_BY(m_peer_mutex);
+
+    /** Transactions to announce, sorted once for all the peers that trickle
+     *  them until the mempool changes. */
+    struct RelayOrder {
+        //! GetTransactionsUpdated() of the mempool when the order was looked up
+        unsigned int mempool_updates{0};
+        //! All hashes looked up, including the ones not in the mempool
+        std::set<uint256> requested;
+        //! The requested transactions found in the mempool, in announcement order
+        std::vector<TxMempoolInfo> order;
+    };
+    Mutex m_relay_order_mutex;
+    //! One order for peers relaying by txid, one for peers relaying by wtxid
+    RelayOrder m_relay_order[2] GUARDED_BY(m_relay_order_mutex);
 };
 
 /** Relay transaction to every node */
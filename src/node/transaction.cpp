@@ -7,6 +7,8 @@
 #include <net.h>
 #include <net_processing.h>
 #include <node/context.h>
+#include <policy/policy.h>
+#include <util/translation.h>
 #include <validation.h>
 #include <validationinterface.h>
 #include <node/transaction.h>
@@ -105,3 +107,63 @@ TransactionError BroadcastTransaction(NodeContext& node, const CTransactionRef t
 
     return TransactionError::OK;
 }
+
+TransactionError BroadcastPackage(NodeContext& node, const std::vector<CTransactionRef>& package, std::string& err_string, const CFeeRate& max_tx_fee_rate)
+{
+    assert(node.connman);
+    assert(node.mempool);
+    std::promise<void> promise;
+
+    { // cs_main scope
+    LOCK(cs_main);
+    TxValidationState state;
+    std::vector<TxValidationState> tx_states;
+    // The state of the transaction that made the package invalid, if any,
+    // prefixed with its txid.
+    const auto handle_error = [&]() {
+        const TransactionError error = HandleATMPError(state, err_string);
+        if (!tx_states.empty() && tx_states.back().IsInvalid()) {
+            err_string = strprintf("%s: %s", package[tx_states.size() - 1]->GetHash().ToString(), err_string);
+        }
+        return error;
+    };
+    if (max_tx_fee_rate > CFeeRate(0)) {
+        // First, test the package and check the fees. If it fails here,
+        // return error immediately.
+        std::vector<CAmount> fees;
+        if (!AcceptPackageToMemoryPool(*node.mempool, state, tx_states, package, /* test_accept */ true, &fees)) {
+            return handle_error();
+        }
+        for (size_t i = 0; i < package.size(); ++i) {
+            if (fees[i] > max_tx_fee_rate.GetFee(GetVirtualTransactionSize(*package[i]))) {
+                err_string = strprintf("%s: %s", package[i]->GetHash().ToString(), TransactionErrorString(TransactionError::MAX_FEE_EXCEEDED).original);
+                return TransactionError::MAX_FEE_EXCEEDED;
+            }
+        }
+    }
+    // Try to submit the package to the mempool.
+    if (!AcceptPackageToMemoryPool(*node.mempool, state, tx_states, package, /* test_accept */ false)) {
+        return handle_error();
+    }
+
+    // Make sure that the wallet has been notified of the transactions before
+    // returning, as BroadcastTransaction() does.
+    CallFunctionInValidationInterfaceQueue([&promise] {
+        promise.set_value();
+    });
+    } // cs_main
+
+    promise.get_future().wait();
+
+    // the mempool tracks locally submitted transactions to make a
+    // best-effort of initial broadcast
+    for (const CTransactionRef& tx : package) {
+        node.mempool->AddUnbroadcastTx(tx->GetHash());
+    }
+    LOCK(cs_main);
+    for (const CTransactionRef& tx : package) {
+        RelayTransaction(tx->GetHash(), tx->GetWitnessHash(), *node.connman);
+    }
+
+    return TransactionError::OK;
+}
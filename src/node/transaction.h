@@ -38,4 +38,18 @@ static const CFeeRate DEFAULT_MAX_RAW_TX_FEE_RATE{COIN / 10};
  */
 [[nodiscard]] TransactionError BroadcastTransaction(NodeContext& node, CTransactionRef tx, std::string& err_string, const CAmount& max_tx_fee, bool relay, bool wait_callback);
 
+/**
+ * Submit a package of transactions to the mempool, all of them or none, and
+ * relay them to all P2P peers. The transactions of the package must come after
+ * those they spend. Waits for the mempool entry notifications, so MUST NOT be
+ * called while cs_main, cs_mempool or cs_wallet are held.
+ *
+ * @param[in]  node reference to node context
+ * @param[in]  package the transactions to broadcast
+ * @param[out] err_string reference to std::string to fill with error string if available
+ * @param[in]  max_tx_fee_rate reject packages with a transaction paying a higher fee rate than this (if 0, accept any fee)
+ * return error
+ */
+[[nodiscard]] TransactionError BroadcastPackage(NodeContext& node, const std::vector<CTransactionRef>& package, std::string& err_string, const CFeeRate& max_tx_fee_rate);
+
 #endif // BITCOIN_NODE_TRANSACTION_H
@@ -13,8 +13,10 @@
 
 extern RecursiveMutex cs_main;
 
+class CAutoFile;
 class CBlock;
 class CBlockIndex;
+class CChainState;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class ChainstateManager;
@@ -57,4 +59,10 @@ CTxMemPool& EnsureMemPool(const util::Ref& context);
 ChainstateManager& EnsureChainman(const util::Ref& context);
 CBlockPolicyEstimator& EnsureFeeEstimator(const util::Ref& context);
 
+/**
+ * Helper to create UTXO snapshots given a chainstate and a file handle.
+ * @return a UniValue map containing metadata about the snapshot.
+ */
+UniValue CreateUTXOSnapshot(NodeContext& node, CChainState& chainstate, CAutoFile& afile);
+
 #endif
@@ -723,6 +723,15 @@ static RPCHelpMan getblocktemplate()
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
+    if (pindexPrev == ::ChainActive().Tip() && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast) {
+        // Add new transactions to the current template, unless it has to be made anew
+        unsigned int nTransactionsUpdatedNew = mempool.GetTransactionsUpdated();
+        std::unique_ptr<CBlockTemplate> pblocktemplateNew = BlockAssembler(mempool, Params()).UpdateNewBlock(*pblocktemplate);
+        if (pblocktemplateNew) {
+            pblocktemplate = std::move(pblocktemplateNew);
+            nTransactionsUpdatedLast = nTransactionsUpdatedNew;
+        }
+    }
     if (pindexPrev != ::ChainActive().Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
@@ -880,7 +880,8 @@ static RPCHelpMan testmempoolaccept()
                 "\nSee sendrawtransaction call.\n",
                 {
                     {"rawtxs", RPCArg::Type::ARR, RPCArg::Optional::NO, "An array of hex strings of raw transactions.\n"
-            "                                        Length must be one for now.",
+            "                                        Several transactions are tested as a package, in which a transaction\n"
+            "                                        may only spend the outputs of earlier ones (at most " + ToString(MAX_PACKAGE_COUNT) + ").",
                         {
                             {"rawtx", RPCArg::Type::STR_HEX, RPCArg::Optional::OMITTED, ""},
                         },
@@ -889,18 +890,18 @@ static RPCHelpMan testmempoolaccept()
                 },
                 RPCResult{
                     RPCResult::Type::ARR, "", "The result of the mempool acceptance test for each raw transaction in the input array.\n"
-                        "Length is exactly one for now.",
+                        "A package is accepted if all of its transactions are.",
                     {
                         {RPCResult::Type::OBJ, "", "",
                         {
                             {RPCResult::Type::STR_HEX, "txid", "The transaction hash in hex"},
-                            {RPCResult::Type::BOOL, "allowed", "If the mempool allows this tx to be inserted"},
+                            {RPCResult::Type::BOOL, "allowed", /* optional */ true, "If the mempool allows this tx to be inserted (not present for the transactions of a package not fully checked because another one was rejected)"},
                             {RPCResult::Type::NUM, "vsize", "Virtual transaction size as defined in BIP 141. This is different from actual serialized size for witness transactions as witness data is discounted (only present when 'allowed' is true)"},
                             {RPCResult::Type::OBJ, "fees", "Transaction fees (only present if 'allowed' is true)",
                             {
                                 {RPCResult::Type::STR_AMOUNT, "base", "transaction fee in " + CURRENCY_UNIT},
                             }},
-                            {RPCResult::Type::STR, "reject-reason", "Rejection string (only present when 'allowed' is false)"},
+                            {RPCResult::Type::STR, "reject-reason", /* optional */ true, "Rejection string (only present when 'allowed' is false)"},
                         }},
                     }
                 },
@@ -921,67 +922,156 @@ static RPCHelpMan testmempoolaccept()
         UniValueType(), // VNUM or VSTR, checked inside AmountFromValue()
     });
 
-    if (request.params[0].get_array().size() != 1) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Array must contain exactly one raw transaction for now");
+    const UniValue raw_transactions = request.params[0].get_array();
+    if (raw_transactions.size() < 1 || raw_transactions.size() > MAX_PACKAGE_COUNT) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           "Array must contain between 1 and " + ToString(MAX_PACKAGE_COUNT) + " transactions.");
     }
 
-    CMutableTransaction mtx;
-    if (!DecodeHexTx(mtx, request.params[0].get_array()[0].get_str())) {
-        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed. Make sure the tx has at least one input.");
+    std::vector<CTransactionRef> txns;
+    txns.reserve(raw_transactions.size());
+    for (const auto& rawtx : raw_transactions.getValues()) {
+        CMutableTransaction mtx;
+        if (!DecodeHexTx(mtx, rawtx.get_str())) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR,
+                               "TX decode failed. Make sure the tx has at least one input.");
+        }
+        txns.emplace_back(MakeTransactionRef(std::move(mtx)));
     }
-    CTransactionRef tx(MakeTransactionRef(std::move(mtx)));
-    const uint256& tx_hash = tx->GetHash();
 
     const CFeeRate max_raw_tx_fee_rate = request.params[1].isNull() ?
                                              DEFAULT_MAX_RAW_TX_FEE_RATE :
                                              CFeeRate(AmountFromValue(request.params[1]));
 
     CTxMemPool& mempool = EnsureMemPool(request.context);
-    int64_t virtual_size = GetVirtualTransactionSize(*tx);
-    CAmount max_raw_tx_fee = max_raw_tx_fee_rate.GetFee(virtual_size);
-
-    UniValue result(UniValue::VARR);
-    UniValue result_0(UniValue::VOBJ);
-    result_0.pushKV("txid", tx_hash.GetHex());
 
     TxValidationState state;
+    std::vector<TxValidationState> tx_states;
     bool test_accept_res;
-    CAmount fee{0};
+    std::vector<CAmount> fees(txns.size());
     {
         LOCK(cs_main);
-        test_accept_res = AcceptToMemoryPool(mempool, state, std::move(tx),
-            nullptr /* plTxnReplaced */, false /* bypass_limits */, /* test_accept */ true, &fee);
-    }
-
-    // Check that fee does not exceed maximum fee
-    if (test_accept_res && max_raw_tx_fee && fee > max_raw_tx_fee) {
-        result_0.pushKV("allowed", false);
-        result_0.pushKV("reject-reason", "max-fee-exceeded");
-        result.push_back(std::move(result_0));
-        return result;
-    }
-    result_0.pushKV("allowed", test_accept_res);
-
-    // Only return the fee and vsize if the transaction would pass ATMP.
-    // These can be used to calculate the feerate.
-    if (test_accept_res) {
-        result_0.pushKV("vsize", virtual_size);
-        UniValue fees(UniValue::VOBJ);
-        fees.pushKV("base", ValueFromAmount(fee));
-        result_0.pushKV("fees", fees);
-    } else {
-        if (state.IsInvalid()) {
-            if (state.GetResult() == TxValidationResult::TX_MISSING_INPUTS) {
-                result_0.pushKV("reject-reason", "missing-inputs");
+        if (txns.size() == 1) {
+            test_accept_res = AcceptToMemoryPool(mempool, state, txns[0],
+                nullptr /* plTxnReplaced */, false /* bypass_limits */, /* test_accept */ true, &fees[0]);
+            tx_states.push_back(state);
+        } else {
+            test_accept_res = AcceptPackageToMemoryPool(mempool, state, tx_states, txns, /* test_accept */ true, &fees);
+        }
+    }
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < txns.size(); ++i) {
+        const CTransactionRef& tx = txns[i];
+        UniValue result_inner(UniValue::VOBJ);
+        result_inner.pushKV("txid", tx->GetHash().GetHex());
+        int64_t virtual_size = GetVirtualTransactionSize(*tx);
+        CAmount max_raw_tx_fee = max_raw_tx_fee_rate.GetFee(virtual_size);
+
+        if (test_accept_res) {
+            // Check that fee does not exceed maximum fee
+            if (max_raw_tx_fee && fees[i] > max_raw_tx_fee) {
+                result_inner.pushKV("allowed", false);
+                result_inner.pushKV("reject-reason", "max-fee-exceeded");
             } else {
-                result_0.pushKV("reject-reason", strprintf("%s", state.GetRejectReason()));
+                result_inner.pushKV("allowed", true);
+                // Only return the fee and vsize if the transaction would pass ATMP.
+                // These can be used to calculate the feerate.
+                result_inner.pushKV("vsize", virtual_size);
+                UniValue fees_obj(UniValue::VOBJ);
+                fees_obj.pushKV("base", ValueFromAmount(fees[i]));
+                result_inner.pushKV("fees", fees_obj);
             }
         } else {
-            result_0.pushKV("reject-reason", state.GetRejectReason());
+            // The package was rejected either because of one of its
+            // transactions, which is the last one checked, or as a whole.
+            const bool tx_rejected = i + 1 == tx_states.size() && tx_states[i].IsInvalid();
+            const bool package_rejected = tx_states.empty() || !tx_states.back().IsInvalid();
+            if (tx_rejected || package_rejected) {
+                const TxValidationState& reject_state = tx_rejected ? tx_states[i] : state;
+                result_inner.pushKV("allowed", false);
+                if (reject_state.GetResult() == TxValidationResult::TX_MISSING_INPUTS) {
+                    result_inner.pushKV("reject-reason", "missing-inputs");
+                } else {
+                    result_inner.pushKV("reject-reason", reject_state.GetRejectReason());
+                }
+            }
         }
+        result.push_back(std::move(result_inner));
     }
+    return result;
+},
+    };
+}
 
-    result.push_back(std::move(result_0));
+static RPCHelpMan submitpackage()
+{
+    return RPCHelpMan{"submitpackage",
+                "\nSubmit a package of raw transactions (serialized, hex-encoded) to local node and network.\n"
+                "\nThe transactions are added to the mempool together, all of them or none, so that\n"
+                "a transaction may spend the outputs of earlier ones of the package.\n"
+                "\nSee sendrawtransaction and testmempoolaccept calls.\n",
+                {
+                    {"rawtxs", RPCArg::Type::ARR, RPCArg::Optional::NO, "An array of hex strings of raw transactions, each one after those it spends (at most " + ToString(MAX_PACKAGE_COUNT) + ").",
+                        {
+                            {"rawtx", RPCArg::Type::STR_HEX, RPCArg::Optional::OMITTED, ""},
+                        },
+                        },
+                    {"maxfeerate", RPCArg::Type::AMOUNT, /* default */ FormatMoney(DEFAULT_MAX_RAW_TX_FEE_RATE.GetFeePerK()),
+                        "Reject packages with a transaction whose fee rate is higher than the specified value, expressed in " + CURRENCY_UNIT +
+                            "/kB.\nSet to 0 to accept any fee rate.\n"},
+                },
+                RPCResult{
+                    RPCResult::Type::ARR, "", "The hashes of the transactions submitted",
+                    {
+                        {RPCResult::Type::STR_HEX, "", "The transaction hash in hex"},
+                    }
+                },
+                RPCExamples{
+            "\nSubmit a parent and its child (signed hex)\n"
+            + HelpExampleCli("submitpackage", R"('["signedparenthex", "signedchildhex"]')") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("submitpackage", "[\"signedparenthex\", \"signedchildhex\"]")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    RPCTypeCheck(request.params, {
+        UniValue::VARR,
+        UniValueType(), // VNUM or VSTR, checked inside AmountFromValue()
+    });
+
+    const UniValue raw_transactions = request.params[0].get_array();
+    if (raw_transactions.size() < 1 || raw_transactions.size() > MAX_PACKAGE_COUNT) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           "Array must contain between 1 and " + ToString(MAX_PACKAGE_COUNT) + " transactions.");
+    }
+
+    std::vector<CTransactionRef> txns;
+    txns.reserve(raw_transactions.size());
+    for (const auto& rawtx : raw_transactions.getValues()) {
+        CMutableTransaction mtx;
+        if (!DecodeHexTx(mtx, rawtx.get_str())) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed. Make sure the tx has at least one input.");
+        }
+        txns.emplace_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    const CFeeRate max_raw_tx_fee_rate = request.params[1].isNull() ?
+                                             DEFAULT_MAX_RAW_TX_FEE_RATE :
+                                             CFeeRate(AmountFromValue(request.params[1]));
+
+    std::string err_string;
+    AssertLockNotHeld(cs_main);
+    NodeContext& node = EnsureNodeContext(request.context);
+    const TransactionError err = BroadcastPackage(node, txns, err_string, max_raw_tx_fee_rate);
+    if (TransactionError::OK != err) {
+        throw JSONRPCTransactionError(err, err_string);
+    }
+
+    UniValue result(UniValue::VARR);
+    for (const CTransactionRef& tx : txns) {
+        result.push_back(tx->GetHash().GetHex());
+    }
     return result;
 },
     };
@@ -1868,6 +1958,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "combinerawtransaction",        &combinerawtransaction,     {"txs"} },
     { "rawtransactions",    "signrawtransactionwithkey",    &signrawtransactionwithkey, {"hexstring","privkeys","prevtxs","sighashtype"} },
     { "rawtransactions",    "testmempoolaccept",            &testmempoolaccept,         {"rawtxs","maxfeerate"} },
+    { "rawtransactions",    "submitpackage",                &submitpackage,             {"rawtxs","maxfeerate"} },
     { "rawtransactions",    "decodepsbt",                   &decodepsbt,                {"psbt"} },
     { "rawtransactions",    "combinepsbt",                  &combinepsbt,               {"txs"} },
     { "rawtransactions",    "finalizepsbt",                 &finalizepsbt,              {"psbt", "extract"} },
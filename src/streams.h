@@ -126,6 +126,47 @@ private:
     size_t nPos;
 };
 
+/** Minimal stream for writing to a fixed-size byte span
+ *
+ * Writing past the end of the span throws.
+ */
+class SpanWriter
+{
+public:
+    SpanWriter(int type, int version, Span<unsigned char> data) : m_type(type), m_version(version), m_data(data) {}
+
+    template <typename... Args>
+    SpanWriter(int type, int version, Span<unsigned char> data, Args&&... args) : SpanWriter(type, version, data)
+    {
+        ::SerializeMany(*this, std::forward<Args>(args)...);
+    }
+
+    void write(const char* pch, size_t size)
+    {
+        if (size > m_data.size() - m_pos) {
+            throw std::ios_base::failure("SpanWriter::write(): exceeded buffer size");
+        }
+        memcpy(m_data.data() + m_pos, pch, size);
+        m_pos += size;
+    }
+
+    template <typename T>
+    SpanWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+
+    int GetVersion() const { return m_version; }
+    int GetType() const { return m_type; }
+
+private:
+    const int m_type;
+    const int m_version;
+    const Span<unsigned char> m_data;
+    size_t m_pos{0};
+};
+
 /** Minimal stream for reading from an existing vector by reference
  */
 class VectorReader
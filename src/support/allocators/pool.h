@@ -0,0 +1,177 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <list>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A memory resource similar to std::pmr::unsynchronized_pool_resource, but
+ * optimized for many small allocations of a few fixed sizes, such as one per
+ * element of a container.
+ *
+ * Memory is requested from the system in chunks of chunk_size_bytes, and
+ * handed out in blocks that are a multiple of ALIGN_BYTES. A freed block is
+ * put on a free list for its size and reused by the next allocation of that
+ * size. Memory is only returned to the system when the resource is
+ * destroyed, all at once.
+ *
+ * Allocations larger than MAX_BLOCK_SIZE_BYTES, or with a stricter alignment
+ * than ALIGN_BYTES, are forwarded to ::operator new().
+ *
+ * This resource is not thread safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource final
+{
+    static_assert(ALIGN_BYTES > 0, "ALIGN_BYTES must be nonzero");
+    static_assert((ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+
+    /**
+     * A free block. Its storage is the freed memory itself.
+     */
+    struct ListNode {
+        ListNode* m_next;
+
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+    static_assert(std::is_trivially_destructible<ListNode>::value, "Make sure we don't need to manually call a destructor");
+
+    //! Every block is a multiple of this, and large enough to hold a ListNode.
+    static constexpr std::size_t ELEM_ALIGN_BYTES = std::max(alignof(ListNode), ALIGN_BYTES);
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "Units of size ELEM_SIZE_ALIGN need to be able to store a ListNode");
+    static_assert((MAX_BLOCK_SIZE_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "MAX_BLOCK_SIZE_BYTES needs to be a multiple of the alignment.");
+
+    const std::size_t m_chunk_size_bytes;
+
+    //! All chunks requested from the system so far.
+    std::list<std::byte*> m_allocated_chunks{};
+
+    //! Free lists, indexed by block size in units of ELEM_ALIGN_BYTES.
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists{};
+
+    //! Start and end of the part of the current chunk that has not been handed out yet.
+    std::byte* m_available_memory_it = nullptr;
+    std::byte* m_available_memory_end = nullptr;
+
+    //! Bytes of the allocated chunks that are not handed out, i.e. on a free list or not used yet.
+    std::size_t m_available_bytes = 0;
+
+    //! Number of ELEM_ALIGN_BYTES units needed to hold bytes. Zero byte allocations take one unit.
+    static constexpr std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static constexpr bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    static void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode{node};
+    }
+
+    void AllocateChunk()
+    {
+        // Don't waste the rest of the current chunk: it is smaller than the
+        // block that did not fit, so it can go on the free list for its size.
+        const std::size_t remaining_available_bytes = m_available_memory_end - m_available_memory_it;
+        if (remaining_available_bytes != 0) {
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_available_bytes / ELEM_ALIGN_BYTES]);
+        }
+
+        m_available_memory_it = static_cast<std::byte*>(::operator new (m_chunk_size_bytes, std::align_val_t{ELEM_ALIGN_BYTES}));
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+        m_available_bytes += m_chunk_size_bytes;
+        m_allocated_chunks.emplace_back(m_available_memory_it);
+    }
+
+public:
+    /**
+     * @param[in] chunk_size_bytes Number of bytes to request from the system at once. Rounded
+     *                             up to a multiple of ELEM_ALIGN_BYTES, and at least MAX_BLOCK_SIZE_BYTES.
+     */
+    explicit PoolResource(std::size_t chunk_size_bytes)
+        : m_chunk_size_bytes(std::max(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES, MAX_BLOCK_SIZE_BYTES))
+    {
+    }
+
+    /** Construct a resource that requests 256 KiB chunks. */
+    PoolResource() : PoolResource(262144) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (std::byte* chunk : m_allocated_chunks) {
+            ::operator delete (chunk, std::align_val_t{ELEM_ALIGN_BYTES});
+        }
+    }
+
+    /** Allocate bytes bytes of memory aligned to alignment. */
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            return ::operator new (bytes, std::align_val_t{alignment});
+        }
+
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+        if (m_free_lists[num_alignments] != nullptr) {
+            // Reuse a previously freed block of the same size.
+            m_available_bytes -= round_bytes;
+            return std::exchange(m_free_lists[num_alignments], m_free_lists[num_alignments]->m_next);
+        }
+        if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+            AllocateChunk();
+        }
+        m_available_bytes -= round_bytes;
+        return std::exchange(m_available_memory_it, m_available_memory_it + round_bytes);
+    }
+
+    /** Return memory obtained from Allocate() with the same bytes and alignment. */
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete (p, std::align_val_t{alignment});
+            return;
+        }
+
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        PlacementAddToList(p, m_free_lists[num_alignments]);
+        m_available_bytes += num_alignments * ELEM_ALIGN_BYTES;
+    }
+
+    /** Number of chunks requested from the system. */
+    std::size_t NumAllocatedChunks() const
+    {
+        return m_allocated_chunks.size();
+    }
+
+    /** Size of each chunk requested from the system. */
+    std::size_t ChunkSizeBytes() const
+    {
+        return m_chunk_size_bytes;
+    }
+
+    /** Bytes of the chunks that are not handed out. They are reused before another chunk is requested. */
+    std::size_t AvailableBytes() const
+    {
+        return m_available_bytes;
+    }
+};
+
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
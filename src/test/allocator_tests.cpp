@@ -2,12 +2,15 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <memusage.h>
+#include <support/allocators/pool.h>
 #include <util/memory.h>
 #include <util/system.h>
 
 #include <test/util/setup_common.h>
 
 #include <memory>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -233,4 +236,73 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<32, 8> resource(100);
+    // The chunk size is rounded up to the alignment.
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 104U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 0U);
+
+    // Blocks are handed out from a chunk, rounded up to the alignment.
+    void* a0 = resource.Allocate(8, 8);
+    void* a1 = resource.Allocate(13, 4);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 104U - 8 - 16);
+    BOOST_CHECK_EQUAL(static_cast<char*>(a1) - static_cast<char*>(a0), 8);
+
+    // A freed block is reused by the next allocation of the same size.
+    resource.Deallocate(a1, 13, 4);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 104U - 8);
+    BOOST_CHECK(resource.Allocate(16, 8) == a1);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 104U - 8 - 16);
+
+    // Large or overaligned allocations do not come from the pool.
+    void* a2 = resource.Allocate(33, 8);
+    void* a3 = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 104U - 8 - 16);
+    resource.Deallocate(a2, 33, 8);
+    resource.Deallocate(a3, 8, 16);
+
+    // When the current chunk is exhausted, its rest is kept on a free list.
+    for (int i = 0; i < 2; ++i) {
+        resource.Allocate(32, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 16U);
+    resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 104U - 24 + 16);
+    BOOST_CHECK(resource.Allocate(16, 8) != nullptr);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK_EQUAL(resource.AvailableBytes(), 104U - 24);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_memusage)
+{
+    PoolResource<32, 8> resource(1024);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(resource), 0U);
+
+    std::vector<void*> blocks;
+    for (int i = 0; i < 100; ++i) {
+        blocks.push_back(resource.Allocate(24, 8));
+    }
+    const size_t chunks = resource.NumAllocatedChunks();
+    const size_t full_usage = memusage::DynamicUsage(resource);
+    BOOST_CHECK(chunks > 1);
+    BOOST_CHECK(full_usage >= 100 * 24);
+
+    // Freed blocks are handed back to the pool, which reuses them for new
+    // allocations rather than requesting more chunks.
+    for (int i = 0; i < 50; ++i) {
+        resource.Deallocate(blocks[i], 24, 8);
+    }
+    BOOST_CHECK(memusage::DynamicUsage(resource) < full_usage);
+    for (int i = 0; i < 50; ++i) {
+        blocks[i] = resource.Allocate(24, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(resource), full_usage);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcache.h>
+#include <blockencodings.h>
+#include <consensus/merkle.h>
+#include <hash.h>
+#include <streams.h>
+#include <version.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+static std::shared_ptr<const CBlock> BuildBlock()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    // A transaction with a witness, so that the encodings with and without
+    // witnesses differ
+    tx.vin[0].prevout.hash = InsecureRand256();
+    tx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(100, 1));
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    block.nVersion = 42;
+    block.hashPrevBlock = InsecureRand256();
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return std::make_shared<const CBlock>(block);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_encodings)
+{
+    using Encoding = RecentBlockCache::Encoding;
+    RecentBlockCache cache{MAX_RECENT_BLOCKS_CACHE_BLOCKS, MAX_RECENT_BLOCKS_CACHE_MEMORY};
+    const auto block = BuildBlock();
+    cache.Add(block);
+    BOOST_CHECK(cache.GetBlock(block->GetHash()) == block);
+    BOOST_CHECK(cache.GetMostRecentBlock() == block);
+
+    for (const bool witness : {true, false}) {
+        const int version = PROTOCOL_VERSION | (witness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS);
+        const CSharedNetPayload payload = cache.GetEncoding(block, witness ? Encoding::BLOCK : Encoding::BLOCK_NO_WITNESS);
+        std::vector<unsigned char> expected;
+        CVectorWriter(SER_NETWORK, version, expected, 0, *block);
+        BOOST_CHECK(*payload.data == expected);
+        BOOST_CHECK(payload.hash == Hash(expected));
+
+        // Later requests share the same serialization
+        BOOST_CHECK(cache.GetEncoding(block, witness ? Encoding::BLOCK : Encoding::BLOCK_NO_WITNESS).data == payload.data);
+
+        const CSharedNetPayload cmpct = cache.GetEncoding(block, witness ? Encoding::CMPCTBLOCK : Encoding::CMPCTBLOCK_NO_WITNESS);
+        CDataStream stream(*cmpct.data, SER_NETWORK, version);
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        stream >> cmpctblock;
+        BOOST_CHECK(cmpctblock.header.GetHash() == block->GetHash());
+        BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), block->vtx.size());
+        BOOST_CHECK(cmpct.hash == Hash(*cmpct.data));
+    }
+    BOOST_CHECK(*cache.GetEncoding(block, Encoding::BLOCK).data != *cache.GetEncoding(block, Encoding::BLOCK_NO_WITNESS).data);
+
+    // Blocks that aren't cached are serialized, but not kept
+    const auto other = BuildBlock();
+    const CSharedNetPayload payload = cache.GetEncoding(other, Encoding::BLOCK);
+    BOOST_CHECK(cache.GetEncoding(other, Encoding::BLOCK).data != payload.data);
+    BOOST_CHECK(*cache.GetEncoding(other, Encoding::BLOCK).data == *payload.data);
+    BOOST_CHECK(cache.GetBlock(other->GetHash()) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_limits)
+{
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    for (int i = 0; i < 5; ++i) blocks.push_back(BuildBlock());
+
+    // Only the last three blocks are kept
+    RecentBlockCache cache{3, MAX_RECENT_BLOCKS_CACHE_MEMORY};
+    for (const auto& block : blocks) cache.Add(block);
+    // Adding a block again doesn't change the order
+    cache.Add(blocks[2]);
+    BOOST_CHECK_EQUAL(cache.Size(), 3U);
+    BOOST_CHECK(cache.GetBlock(blocks[1]->GetHash()) == nullptr);
+    BOOST_CHECK(cache.GetBlock(blocks[2]->GetHash()) == blocks[2]);
+    BOOST_CHECK(cache.GetMostRecentBlock() == blocks[4]);
+
+    // Serializations are accounted for and evict older blocks
+    const size_t block_usage = cache.DynamicMemoryUsage() / 3;
+    RecentBlockCache small_cache{10, 2 * block_usage + 1};
+    for (const auto& block : blocks) small_cache.Add(block);
+    BOOST_CHECK_EQUAL(small_cache.Size(), 2U);
+    small_cache.GetEncoding(blocks[3], RecentBlockCache::Encoding::BLOCK);
+    BOOST_CHECK_EQUAL(small_cache.Size(), 1U);
+    BOOST_CHECK(small_cache.GetMostRecentBlock() == blocks[4]);
+
+    // The most recent block is kept whatever its size
+    RecentBlockCache tiny_cache{10, 0};
+    tiny_cache.Add(blocks[0]);
+    tiny_cache.GetEncoding(blocks[0], RecentBlockCache::Encoding::BLOCK);
+    BOOST_CHECK(tiny_cache.GetBlock(blocks[0]->GetHash()) == blocks[0]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -530,4 +530,38 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     g_mock_deterministic_tests = false;
 }
 
+BOOST_AUTO_TEST_CASE(rolling_bloom_hashes)
+{
+    // Filters using 7 and 20 hash functions
+    for (const double fp_rate : {0.01, 0.000001}) {
+        CRollingBloomFilter rb(100, fp_rate);
+        std::vector<uint256> hashes;
+        for (int i = 0; i < 100; ++i) {
+            hashes.push_back(InsecureRand256());
+            // Hashes and their bytes are inserted the same way
+            if (i % 2) {
+                rb.insert(hashes.back());
+            } else {
+                rb.insert(std::vector<unsigned char>(hashes.back().begin(), hashes.back().end()));
+            }
+        }
+        for (int i = 0; i < 1000; ++i) {
+            hashes.push_back(InsecureRand256());
+        }
+        const std::vector<bool> batch = rb.contains(hashes);
+        BOOST_REQUIRE_EQUAL(batch.size(), hashes.size());
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            const bool contains = rb.contains(std::vector<unsigned char>(hashes[i].begin(), hashes[i].end()));
+            BOOST_CHECK(contains || i >= 100);
+            BOOST_CHECK_EQUAL(rb.contains(hashes[i]), contains);
+            BOOST_CHECK_EQUAL(batch[i], contains);
+        }
+
+        rb.reset();
+        rb.insert(Span<const uint256>{hashes.data(), 100});
+        BOOST_CHECK(rb.contains(hashes[0]));
+        BOOST_CHECK(rb.contains(hashes[99]));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
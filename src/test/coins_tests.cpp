@@ -12,7 +12,9 @@
 #include <uint256.h>
 #include <undo.h>
 #include <util/strencodings.h>
+#include <util/string.h>
 
+#include <algorithm>
 #include <map>
 #include <vector>
 
@@ -54,7 +56,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase = true) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -65,7 +67,11 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (erase) {
+                mapCoins.erase(it++);
+            } else {
+                ++it;
+            }
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -793,6 +799,41 @@ BOOST_AUTO_TEST_CASE(ccoins_add)
     CheckAddCoin(VALUE2, VALUE3, VALUE3, DIRTY|FRESH, DIRTY|FRESH, true );
 }
 
+static void CheckEmplacePrefetchedCoin(CAmount cache_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+    Coin coin;
+    SetCoinsValue(VALUE3, coin);
+    test.cache.EmplacePrefetchedCoin(OUTPOINT, std::move(coin));
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_emplace_prefetched)
+{
+    /* Check EmplacePrefetchedCoin behavior, adding a coin that was looked up
+     * in the base view out of band, and checking the resulting entry in the
+     * cache. Existing entries, in particular spent ones, must be kept as is.
+     *
+     *                         Cache   Result  Cache        Result
+     *                         Value   Value   Flags        Flags
+     */
+    CheckEmplacePrefetchedCoin(ABSENT, VALUE3, NO_ENTRY   , 0          );
+    CheckEmplacePrefetchedCoin(SPENT , SPENT , 0          , 0          );
+    CheckEmplacePrefetchedCoin(SPENT , SPENT , FRESH      , FRESH      );
+    CheckEmplacePrefetchedCoin(SPENT , SPENT , DIRTY      , DIRTY      );
+    CheckEmplacePrefetchedCoin(SPENT , SPENT , DIRTY|FRESH, DIRTY|FRESH);
+    CheckEmplacePrefetchedCoin(VALUE2, VALUE2, 0          , 0          );
+    CheckEmplacePrefetchedCoin(VALUE2, VALUE2, FRESH      , FRESH      );
+    CheckEmplacePrefetchedCoin(VALUE2, VALUE2, DIRTY      , DIRTY      );
+    CheckEmplacePrefetchedCoin(VALUE2, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
+}
+
 void CheckWriteCoins(CAmount parent_value, CAmount child_value, CAmount expected_value, char parent_flags, char child_flags, char expected_flags)
 {
     SingleEntryCacheTest test(ABSENT, parent_value, parent_flags);
@@ -878,4 +919,205 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+static void CheckSyncCoins(CAmount base_value, CAmount cache_value, CAmount expected_base_value, CAmount expected_cache_value, char cache_flags, char expected_base_flags, char expected_cache_flags)
+{
+    SingleEntryCacheTest test(base_value, cache_value, cache_flags);
+    BOOST_CHECK(test.cache.Sync(std::numeric_limits<size_t>::max()));
+    test.cache.SelfTest();
+    test.base.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.base.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_base_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_base_flags);
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_cache_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_cache_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync)
+{
+    /* Check Sync behavior without eviction, writing one entry from a cache
+     * to its base, and checking the resulting entries in both. Spent entries
+     * are dropped from the cache and unspent ones are kept as clean entries.
+     *
+     *             Base    Cache   Result  Result  Cache        Result       Result
+     *             Value   Value   Base    Cache   Flags        Base Flags   Cache Flags
+     */
+    CheckSyncCoins(ABSENT, ABSENT, ABSENT, ABSENT, NO_ENTRY   , NO_ENTRY   , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, SPENT , ABSENT, ABSENT, FRESH      , NO_ENTRY   , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, SPENT , SPENT , ABSENT, DIRTY      , DIRTY      , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, SPENT , ABSENT, ABSENT, DIRTY|FRESH, NO_ENTRY   , NO_ENTRY   );
+    CheckSyncCoins(ABSENT, VALUE2, VALUE2, VALUE2, DIRTY      , DIRTY      , 0          );
+    CheckSyncCoins(ABSENT, VALUE2, VALUE2, VALUE2, DIRTY|FRESH, DIRTY|FRESH, 0          );
+    CheckSyncCoins(VALUE1, ABSENT, VALUE1, ABSENT, NO_ENTRY   , DIRTY      , NO_ENTRY   );
+    CheckSyncCoins(VALUE1, SPENT , SPENT , ABSENT, DIRTY      , DIRTY      , NO_ENTRY   );
+    CheckSyncCoins(VALUE1, VALUE1, VALUE1, VALUE1, 0          , DIRTY      , 0          );
+    CheckSyncCoins(VALUE1, VALUE2, VALUE2, VALUE2, DIRTY      , DIRTY      , 0          );
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync_evict)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest base{&root};
+    CCoinsViewCacheTest cache{&base};
+
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 100; ++i) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        Coin coin;
+        SetCoinsValue(VALUE1 + i, coin);
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    BOOST_CHECK(cache.Sync(std::numeric_limits<size_t>::max()));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    cache.SelfTest();
+
+    // Every entry was referenced when it was added. Evicting any entry
+    // clears all referenced bits, as no entry may be evicted before that.
+    BOOST_CHECK(cache.Sync(cache.DynamicMemoryUsage() - 1));
+    const size_t size = cache.GetCacheSize();
+    BOOST_CHECK(size > 0 && size < outpoints.size());
+    for (const auto& entry : cache.map()) {
+        BOOST_CHECK(!entry.second.referenced);
+    }
+
+    // A coin that is looked up again gets a second chance.
+    const COutPoint& hot = *std::find_if(outpoints.begin(), outpoints.end(), [&](const COutPoint& outpoint) { return cache.HaveCoinInCache(outpoint); });
+    BOOST_CHECK(!cache.AccessCoin(hot).IsSpent());
+    const size_t target_usage = cache.DynamicMemoryUsage() / 2;
+    BOOST_CHECK(cache.Sync(target_usage));
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= target_usage);
+    BOOST_CHECK(cache.GetCacheSize() < size);
+    BOOST_CHECK(cache.HaveCoinInCache(hot));
+    cache.SelfTest();
+
+    // Evicted coins are still available from the base.
+    BOOST_CHECK(cache.Sync(0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    cache.SelfTest();
+    for (uint32_t i = 0; i < outpoints.size(); ++i) {
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[i]).out.nValue, VALUE1 + i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_peak_memory_usage)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest cache{&root};
+
+    // Nothing is allocated before the first coin is added.
+    BOOST_CHECK_EQUAL(cache.PeakMemoryUsage(1000), cache.DynamicMemoryUsage());
+
+    for (uint32_t i = 0; i < 10; ++i) {
+        Coin coin;
+        SetCoinsValue(VALUE1, coin);
+        cache.AddCoin(COutPoint(InsecureRand256(), i), std::move(coin), false);
+    }
+    const size_t capacity = cache.map().capacity();
+    BOOST_CHECK_EQUAL(cache.PeakMemoryUsage(0), cache.DynamicMemoryUsage());
+
+    // Growing the table allocates a larger one before the old one is freed.
+    const size_t peak = cache.PeakMemoryUsage(capacity);
+    BOOST_CHECK_EQUAL(peak, cache.DynamicMemoryUsage() + memusage::DynamicUsage(cache.map(), cache.map().rebuild_capacity(capacity)));
+    for (uint32_t i = 0; i < capacity; ++i) {
+        Coin coin;
+        SetCoinsValue(VALUE1, coin);
+        cache.AddCoin(COutPoint(InsecureRand256(), i), std::move(coin), false);
+    }
+    BOOST_CHECK(cache.map().capacity() > capacity);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < peak);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_flushing_view)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest base{&root};
+    CCoinsViewFlushing flushing{&base};
+    CCoinsViewCacheTest cache{&flushing};
+
+    const COutPoint spent{InsecureRand256(), 0};
+    const COutPoint added{InsecureRand256(), 0};
+    Coin coin;
+    SetCoinsValue(VALUE1, coin);
+    base.AddCoin(spent, std::move(coin), false);
+    BOOST_CHECK(cache.SpendCoin(spent));
+    SetCoinsValue(VALUE2, coin);
+    cache.AddCoin(added, std::move(coin), false);
+    const uint256 best_block = InsecureRand256();
+    cache.SetBestBlock(best_block);
+
+    // Taking the coins empties the cache, but they remain visible through the
+    // flushing view until they are in its base.
+    std::shared_ptr<CCoinsMap> coins = cache.TakeCoins();
+    BOOST_CHECK_EQUAL(coins->size(), 2U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    cache.SelfTest();
+    flushing.SetFlushingCoins(coins, best_block);
+    BOOST_CHECK(flushing.IsFlushing());
+    BOOST_CHECK(flushing.GetBestBlock() == best_block);
+    BOOST_CHECK(base.HaveCoin(spent));
+    BOOST_CHECK(!base.HaveCoin(added));
+    BOOST_CHECK(!cache.HaveCoin(spent));
+    BOOST_CHECK_EQUAL(cache.AccessCoin(added).out.nValue, VALUE2);
+
+    BOOST_CHECK(base.BatchWrite(*coins, best_block, /* erase */ false));
+    flushing.ClearFlushingCoins();
+    BOOST_CHECK(!flushing.IsFlushing());
+    BOOST_CHECK(flushing.GetBestBlock() == best_block);
+    BOOST_CHECK(!base.HaveCoin(spent));
+    BOOST_CHECK_EQUAL(base.AccessCoin(added).out.nValue, VALUE2);
+
+    // The cache keeps working on top of the base.
+    BOOST_CHECK(cache.SpendCoin(added));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.HaveCoin(added));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_db_batch_write)
+{
+    // Use small batches, so that the coins are serialized in many chunks
+    // across the write threads.
+    gArgs.ForceSetArg("-dbbatchsize", "1000");
+    gArgs.ForceSetArg("-dbwritethreads", "4");
+
+    CCoinsViewDB db{"test", /*nCacheSize*/ 1 << 23, /*fMemory*/ true, /*fWipe*/ false};
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCacheTest cache{&db};
+        for (uint32_t i = 0; i < 1000; ++i) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            Coin coin;
+            SetCoinsValue(VALUE1 + i, coin);
+            cache.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    }
+
+    // Spend every other coin in a second flush.
+    const uint256 best_block = InsecureRand256();
+    {
+        CCoinsViewCacheTest cache{&db};
+        for (uint32_t i = 0; i < outpoints.size(); i += 2) {
+            BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+        }
+        cache.SetBestBlock(best_block);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    BOOST_CHECK(db.GetBestBlock() == best_block);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    for (uint32_t i = 0; i < outpoints.size(); ++i) {
+        Coin coin;
+        BOOST_CHECK_EQUAL(db.GetCoin(outpoints[i], coin), i % 2 == 1);
+        if (i % 2 == 1) BOOST_CHECK_EQUAL(coin.out.nValue, VALUE1 + i);
+    }
+
+    gArgs.ForceSetArg("-dbbatchsize", ToString(nDefaultDbBatchSize));
+    gArgs.ForceSetArg("-dbwritethreads", ToString(DEFAULT_DB_WRITE_THREADS));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
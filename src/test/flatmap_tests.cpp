@@ -0,0 +1,127 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flatmap.h>
+#include <memusage.h>
+#include <test/util/setup_common.h>
+
+#include <string>
+#include <unordered_map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+namespace {
+//! A poor hash, to exercise long probe sequences.
+struct BadHash {
+    size_t operator()(uint32_t key) const { return key % 64; }
+};
+
+template <typename Map>
+void CheckEqual(const Map& map, const std::unordered_map<uint32_t, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t count = 0;
+    for (const auto& entry : map) {
+        ++count;
+        auto it = expected.find(entry.first);
+        BOOST_REQUIRE(it != expected.end());
+        BOOST_CHECK_EQUAL(entry.second, it->second);
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+}
+} // namespace
+
+template <typename Hash>
+static void FlatMapSimulation()
+{
+    flatmap<uint32_t, std::string, Hash> map;
+    std::unordered_map<uint32_t, std::string> expected;
+
+    for (int i = 0; i < 20000; ++i) {
+        const uint32_t key = InsecureRandRange(2000);
+        switch (InsecureRandRange(5)) {
+        case 0: {
+            const std::string value = std::to_string(i);
+            const bool inserted = map.emplace(key, value).second;
+            BOOST_CHECK_EQUAL(inserted, expected.emplace(key, value).second);
+            break;
+        }
+        case 1:
+            map[key] = std::to_string(i);
+            expected[key] = std::to_string(i);
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 3: {
+            auto it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), expected.count(key));
+            if (it != map.end()) {
+                BOOST_CHECK_EQUAL(it->second, expected.at(key));
+            }
+            break;
+        }
+        case 4:
+            // Erase a run of elements while iterating.
+            for (auto it = map.find(key); it != map.end() && InsecureRandBool();) {
+                expected.erase(it->first);
+                it = map.erase(it);
+            }
+            break;
+        }
+        // At least an eighth of the slots is always empty.
+        BOOST_CHECK(map.size() <= map.capacity() - map.capacity() / 8);
+    }
+    CheckEqual(map, expected);
+
+    map.rehash(0);
+    BOOST_CHECK_EQUAL(map.capacity(), map.capacity_for(map.size()));
+    CheckEqual(map, expected);
+
+    map.clear();
+    expected.clear();
+    CheckEqual(map, expected);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_simulation)
+{
+    FlatMapSimulation<std::hash<uint32_t>>();
+    FlatMapSimulation<BadHash>();
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_memusage)
+{
+    flatmap<uint64_t, uint64_t> map;
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+    map.reserve(1000);
+    const size_t capacity = map.capacity();
+    BOOST_CHECK(capacity >= 1000);
+    const size_t usage = memusage::DynamicUsage(map);
+    BOOST_CHECK_EQUAL(usage, memusage::MallocUsage(capacity * sizeof(std::pair<const uint64_t, uint64_t>)) + memusage::MallocUsage(capacity));
+
+    // Neither inserting up to the reserved size nor erasing changes the usage.
+    for (uint64_t i = 0; i < 1000; ++i) {
+        map[i] = i;
+    }
+    BOOST_CHECK_EQUAL(map.capacity(), capacity);
+    BOOST_CHECK(!map.needs_rebuild(0));
+    BOOST_CHECK(map.needs_rebuild(capacity));
+    BOOST_CHECK(map.rebuild_capacity(capacity) >= map.capacity_for(1000 + capacity));
+    for (uint64_t i = 0; i < 1000; i += 2) {
+        map.erase(i);
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+
+    // Shrinking does.
+    map.rehash(0);
+    BOOST_CHECK(memusage::DynamicUsage(map) < usage);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::DynamicUsage(map, map.capacity_for(500)));
+    for (uint64_t i = 1; i < 1000; i += 2) {
+        BOOST_CHECK_EQUAL(map.find(i)->second, i);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
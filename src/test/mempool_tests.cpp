@@ -788,4 +788,189 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 4ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolInfoForRelayTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // [tx1].0 <- [tx2], and an unrelated tx3 paying more than tx1
+    CTransactionRef tx1 = make_tx(/* output_values */ {10 * COIN});
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(tx1));
+    CTransactionRef tx2 = make_tx(/* output_values */ {9 * COIN}, /* inputs */ {tx1});
+    pool.addUnchecked(entry.Fee(100000LL).FromTx(tx2));
+    CTransactionRef tx3 = make_tx(/* output_values */ {5 * COIN});
+    pool.addUnchecked(entry.Fee(5000LL).FromTx(tx3));
+    CTransactionRef missing = make_tx(/* output_values */ {1 * COIN});
+
+    // Transactions not in the mempool are left out, and the others are sorted
+    // by number of ancestors first, fee rate second
+    for (const bool wtxid : {false, true}) {
+        const auto infos = pool.infoForRelay({tx2->GetHash(), missing->GetHash(), tx1->GetHash(), tx3->GetHash()}, wtxid);
+        BOOST_REQUIRE_EQUAL(infos.size(), 3U);
+        BOOST_CHECK(infos[0].tx == tx3);
+        BOOST_CHECK(infos[1].tx == tx1);
+        BOOST_CHECK(infos[2].tx == tx2);
+        BOOST_CHECK_EQUAL(infos[2].fee, 100000LL);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // A parent with more children than fit in the pool resource of the links,
+    // and a transaction spending all of them
+    const uint32_t num_children = 40;
+    CTransactionRef parent = make_tx(std::vector<CAmount>(num_children, COIN));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(parent));
+    std::vector<CTransactionRef> children;
+    for (uint32_t i = 0; i < num_children; ++i) {
+        children.push_back(make_tx(/* output_values */ {COIN - 1000}, /* inputs */ {parent}, /* input_indices */ {i}));
+        pool.addUnchecked(entry.Fee(1000LL).FromTx(children.back()));
+    }
+    std::vector<CTransactionRef> inputs = children;
+    CTransactionRef sweep = make_tx(/* output_values */ {num_children * (COIN - 2000)}, std::move(inputs), std::vector<uint32_t>(num_children, 0));
+    pool.addUnchecked(entry.Fee(1000LL * num_children).FromTx(sweep));
+
+    const auto check_links = [&](const CTxMemPoolEntry::Children& links, size_t expected_size) {
+        BOOST_CHECK_EQUAL(links.size(), expected_size);
+        BOOST_CHECK(std::is_sorted(links.begin(), links.end(), CompareIteratorByHash()));
+        for (const CTxMemPoolEntry& link : links) {
+            BOOST_CHECK_EQUAL(links.count(link), 1U);
+        }
+    };
+    const CTxMemPoolEntry& parent_entry = *pool.mapTx.find(parent->GetHash());
+    const CTxMemPoolEntry& sweep_entry = *pool.mapTx.find(sweep->GetHash());
+    check_links(parent_entry.GetMemPoolChildrenConst(), num_children);
+    check_links(sweep_entry.GetMemPoolParentsConst(), num_children);
+    BOOST_CHECK_EQUAL(sweep_entry.GetCountWithAncestors(), num_children + 2);
+
+    CTxMemPool::setEntries ancestors;
+    std::string dummy;
+    const uint64_t no_limit = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(sweep_entry, ancestors, no_limit, no_limit, no_limit, no_limit, dummy, false));
+    BOOST_CHECK_EQUAL(ancestors.size(), num_children + 1);
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(sweep_entry, ancestors, num_children, no_limit, no_limit, no_limit, dummy, false));
+
+    // Copies of entries have their own links
+    {
+        const CTxMemPoolEntry copy = parent_entry;
+        BOOST_CHECK(std::equal(copy.GetMemPoolChildrenConst().begin(), copy.GetMemPoolChildrenConst().end(),
+                               parent_entry.GetMemPoolChildrenConst().begin(), parent_entry.GetMemPoolChildrenConst().end(),
+                               [](const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) { return &a == &b; }));
+    }
+
+    // Links shrink back in place as the children leave the mempool
+    pool.removeRecursive(*sweep, REMOVAL_REASON_DUMMY);
+    const size_t usage = pool.DynamicMemoryUsage();
+    for (uint32_t i = 0; i < num_children; ++i) {
+        pool.removeRecursive(*children[i], REMOVAL_REASON_DUMMY);
+        check_links(parent_entry.GetMemPoolChildrenConst(), num_children - i - 1);
+    }
+    BOOST_CHECK(pool.DynamicMemoryUsage() < usage);
+    BOOST_CHECK_EQUAL(parent_entry.GetCountWithDescendants(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // Compare the cached ancestor and descendant state of an entry to the one
+    // recomputed from the links left in the mempool
+    const auto check_state = [&](const CTransactionRef& tx) NO_THREAD_SAFETY_ANALYSIS {
+        CTxMemPool::txiter it = pool.mapTx.find(tx->GetHash());
+        BOOST_REQUIRE(it != pool.mapTx.end());
+        CTxMemPool::setEntries ancestors;
+        std::string dummy;
+        const uint64_t no_limit = std::numeric_limits<uint64_t>::max();
+        pool.CalculateMemPoolAncestors(*it, ancestors, no_limit, no_limit, no_limit, no_limit, dummy, false);
+        ancestors.insert(it);
+        uint64_t size = 0;
+        CAmount fees = 0;
+        int64_t sigops = 0;
+        for (CTxMemPool::txiter ancestor : ancestors) {
+            size += ancestor->GetTxSize();
+            fees += ancestor->GetModifiedFee();
+            sigops += ancestor->GetSigOpCost();
+        }
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), ancestors.size());
+        BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), size);
+        BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), fees);
+        BOOST_CHECK_EQUAL(it->GetSigOpCostWithAncestors(), sigops);
+        CTxMemPool::setEntries descendants;
+        pool.CalculateDescendants(it, descendants);
+        size = 0;
+        fees = 0;
+        for (CTxMemPool::txiter descendant : descendants) {
+            size += descendant->GetTxSize();
+            fees += descendant->GetModifiedFee();
+        }
+        BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), descendants.size());
+        BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), size);
+        BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), fees);
+    };
+
+    // [tx1].0 <- [tx2].0 <- [tx3].0 <- [tx4]
+    // [tx1].1 <------------ [tx3]
+    // [tx2].1 <- [tx5]
+    CTransactionRef tx1 = make_tx(/* output_values */ {10 * COIN, 10 * COIN});
+    pool.addUnchecked(entry.Fee(1000LL).SigOpsCost(4).FromTx(tx1));
+    CTransactionRef tx2 = make_tx(/* output_values */ {5 * COIN, 4 * COIN}, /* inputs */ {tx1});
+    pool.addUnchecked(entry.Fee(2000LL).SigOpsCost(8).FromTx(tx2));
+    CTransactionRef tx3 = make_tx(/* output_values */ {14 * COIN}, /* inputs */ {tx2, tx1}, /* input_indices */ {0, 1});
+    pool.addUnchecked(entry.Fee(3000LL).SigOpsCost(12).FromTx(tx3));
+    CTransactionRef tx4 = make_tx(/* output_values */ {13 * COIN}, /* inputs */ {tx3});
+    pool.addUnchecked(entry.Fee(4000LL).SigOpsCost(16).FromTx(tx4));
+    CTransactionRef tx5 = make_tx(/* output_values */ {3 * COIN}, /* inputs */ {tx2}, /* input_indices */ {1});
+    pool.addUnchecked(entry.Fee(5000LL).SigOpsCost(20).FromTx(tx5));
+
+    // [funding].0 <- [tx6].0 <- [tx7], conflicting with [block_tx] from a block
+    CTransactionRef funding = make_tx(/* output_values */ {50 * COIN});
+    CTransactionRef tx6 = make_tx(/* output_values */ {49 * COIN}, /* inputs */ {funding});
+    pool.addUnchecked(entry.Fee(6000LL).FromTx(tx6));
+    CTransactionRef tx7 = make_tx(/* output_values */ {48 * COIN}, /* inputs */ {tx6});
+    pool.addUnchecked(entry.Fee(7000LL).FromTx(tx7));
+    CTransactionRef block_tx = make_tx(/* output_values */ {47 * COIN}, /* inputs */ {funding});
+    BOOST_CHECK_EQUAL(pool.size(), 7U);
+
+    // The descendants left in the mempool only lose the confirmed ancestors
+    pool.removeForBlock({tx1, tx2, block_tx}, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    BOOST_CHECK(!pool.exists(tx6->GetHash()));
+    BOOST_CHECK(!pool.exists(tx7->GetHash()));
+    for (const CTransactionRef& tx : {tx3, tx4, tx5}) {
+        check_state(tx);
+    }
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx3->GetHash())->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx4->GetHash())->GetModFeesWithAncestors(), 7000LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx5->GetHash())->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx3->GetHash())->GetCountWithDescendants(), 2U);
+
+    // A confirmed transaction whose in-mempool parent stays leaves the
+    // descendant state of that parent too
+    // [tx8].0 <- [tx9].0 <- [tx10]
+    // [tx8].1 <------------ [tx10]
+    CTransactionRef tx8 = make_tx(/* output_values */ {20 * COIN, 20 * COIN});
+    pool.addUnchecked(entry.Fee(8000LL).SigOpsCost(4).FromTx(tx8));
+    CTransactionRef tx9 = make_tx(/* output_values */ {19 * COIN}, /* inputs */ {tx8});
+    pool.addUnchecked(entry.Fee(9000LL).SigOpsCost(8).FromTx(tx9));
+    CTransactionRef tx10 = make_tx(/* output_values */ {38 * COIN}, /* inputs */ {tx9, tx8}, /* input_indices */ {0, 1});
+    pool.addUnchecked(entry.Fee(10000LL).SigOpsCost(12).FromTx(tx10));
+    pool.removeForBlock({tx9}, 2);
+    BOOST_CHECK_EQUAL(pool.size(), 5U);
+    for (const CTransactionRef& tx : {tx8, tx10}) {
+        check_state(tx);
+    }
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx8->GetHash())->GetCountWithDescendants(), 2U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx8->GetHash())->GetModFeesWithDescendants(), 18000LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx10->GetHash())->GetCountWithAncestors(), 2U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx10->GetHash())->GetSigOpCostWithAncestors(), 16);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
+#include <consensus/validation.h>
 #include <miner.h>
 #include <policy/policy.h>
 #include <script/standard.h>
@@ -26,6 +27,7 @@
 namespace miner_tests {
 struct MinerTestingSetup : public TestingSetup {
     void TestPackageSelection(const CChainParams& chainparams, const CScript& scriptPubKey, const std::vector<CTransactionRef>& txFirst) EXCLUSIVE_LOCKS_REQUIRED(::cs_main, m_node.mempool->cs);
+    void TestUpdateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKey, const std::vector<CTransactionRef>& txFirst) EXCLUSIVE_LOCKS_REQUIRED(::cs_main, m_node.mempool->cs);
     bool TestSequenceLocks(const CTransaction& tx, int flags) EXCLUSIVE_LOCKS_REQUIRED(::cs_main, m_node.mempool->cs)
     {
         return CheckSequenceLocks(*m_node.mempool, tx, flags);
@@ -194,6 +196,92 @@ void MinerTestingSetup::TestPackageSelection(const CChainParams& chainparams, co
     BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
 }
 
+static std::set<uint256> TemplateTxids(const CBlockTemplate& blocktemplate)
+{
+    std::set<uint256> txids;
+    for (size_t i = 1; i < blocktemplate.block.vtx.size(); ++i) {
+        txids.insert(blocktemplate.block.vtx[i]->GetHash());
+    }
+    return txids;
+}
+
+// Test extending a template with the transactions added to the mempool since.
+void MinerTestingSetup::TestUpdateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKey, const std::vector<CTransactionRef>& txFirst)
+{
+    TestMemPoolEntryHelper entry;
+    entry.Time(GetTime());
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    const uint256 hashParentTx = tx.GetHash();
+    m_node.mempool->addUnchecked(entry.Fee(10000).SpendsCoinbase(true).FromTx(tx));
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+
+    // Nothing changed: the template is copied as is
+    std::unique_ptr<CBlockTemplate> updated = AssemblerForTest(chainparams).UpdateNewBlock(*pblocktemplate);
+    BOOST_REQUIRE(updated);
+    BOOST_CHECK(updated->block.GetHash() == pblocktemplate->block.GetHash());
+
+    // A new transaction, and a child of the one already in the template
+    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+    tx.vout[0].nValue = 5000000000LL - 20000;
+    m_node.mempool->addUnchecked(entry.Fee(20000).SpendsCoinbase(true).FromTx(tx));
+    tx.vin[0].prevout.hash = hashParentTx;
+    tx.vout[0].nValue = 5000000000LL - 10000 - 5000;
+    m_node.mempool->addUnchecked(entry.Fee(5000).SpendsCoinbase(false).FromTx(tx));
+    // A package below the block min tx fee stays out, as in a new template
+    tx.vin[0].prevout.hash = txFirst[2]->GetHash();
+    tx.vout[0].nValue = 5000000000LL;
+    m_node.mempool->addUnchecked(entry.Fee(0).SpendsCoinbase(true).FromTx(tx));
+
+    updated = AssemblerForTest(chainparams).UpdateNewBlock(*pblocktemplate);
+    BOOST_REQUIRE(updated);
+    std::unique_ptr<CBlockTemplate> fresh = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(updated->block.vtx.size(), 4U);
+    BOOST_CHECK(TemplateTxids(*updated) == TemplateTxids(*fresh));
+    BOOST_CHECK_EQUAL(updated->block.vtx[0]->vout[0].nValue, fresh->block.vtx[0]->vout[0].nValue);
+    BOOST_CHECK_EQUAL(updated->vTxFees[0], -35000);
+    // The original template is left untouched
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+
+    // Transactions in the template left the mempool
+    pblocktemplate = std::move(updated);
+    m_node.mempool->removeRecursive(CTransaction(tx), MemPoolRemovalReason::REPLACED);
+    BOOST_CHECK(AssemblerForTest(chainparams).UpdateNewBlock(*pblocktemplate));
+    m_node.mempool->removeRecursive(*pblocktemplate->block.vtx[3], MemPoolRemovalReason::REPLACED);
+    BOOST_CHECK(!AssemblerForTest(chainparams).UpdateNewBlock(*pblocktemplate));
+
+    // The fee of a transaction in the mempool changed
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    m_node.mempool->PrioritiseTransaction(hashParentTx, 1000);
+    BOOST_CHECK(!AssemblerForTest(chainparams).UpdateNewBlock(*pblocktemplate));
+
+    // A package that does not fit in a full block, with a higher feerate than
+    // packages in the block, needs a new template.
+    BlockAssembler::Options options;
+    options.nBlockMaxWeight = 4000 + GetTransactionWeight(*pblocktemplate->block.vtx[1]) + GetTransactionWeight(*pblocktemplate->block.vtx[2]) + 1;
+    options.blockMinFeeRate = blockMinFeeRate;
+    pblocktemplate = BlockAssembler(*m_node.mempool, chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    tx.vin[0].prevout.hash = txFirst[3]->GetHash();
+    tx.vout[0].nValue = 5000000000LL - 1000;
+    m_node.mempool->addUnchecked(entry.Fee(1000).SpendsCoinbase(true).FromTx(tx));
+    updated = BlockAssembler(*m_node.mempool, chainparams, options).UpdateNewBlock(*pblocktemplate);
+    BOOST_REQUIRE(updated);
+    BOOST_CHECK_EQUAL(updated->block.vtx.size(), 3U);
+    m_node.mempool->removeRecursive(CTransaction(tx), MemPoolRemovalReason::REPLACED);
+    tx.vout[0].nValue = 5000000000LL - 100000;
+    m_node.mempool->addUnchecked(entry.Fee(100000).SpendsCoinbase(true).FromTx(tx));
+    BOOST_CHECK(!BlockAssembler(*m_node.mempool, chainparams, options).UpdateNewBlock(*pblocktemplate));
+}
+
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -512,6 +600,10 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
 
+    m_node.mempool->clear();
+
+    TestUpdateNewBlock(chainparams, scriptPubKey, txFirst);
+
     fCheckpointsEnabled = true;
 }
 
@@ -7,12 +7,17 @@
 #include <chainparams.h>
 #include <clientversion.h>
 #include <cstdint>
+#include <fs.h>
+#include <hash.h>
 #include <net.h>
 #include <netbase.h>
+#include <netmessagemaker.h>
 #include <optional.h>
+#include <protocol.h>
 #include <serialize.h>
 #include <span.h>
 #include <streams.h>
+#include <test/util/net.h>
 #include <test/util/setup_common.h>
 #include <util/memory.h>
 #include <util/strencodings.h>
@@ -24,6 +29,7 @@
 
 #include <algorithm>
 #include <ios>
+#include <list>
 #include <memory>
 #include <string>
 
@@ -835,6 +841,201 @@ constexpr int NODE_EVICTION_TEST_ROUNDS{10};
 constexpr int NODE_EVICTION_TEST_UP_TO_N_NODES{200};
 } // namespace
 
+BOOST_AUTO_TEST_CASE(recv_msg_recycling)
+{
+    V1TransportSerializer serializer;
+    V1TransportDeserializer deserializer{Params(), /* node_id */ 0, SER_NETWORK, INIT_PROTO_VERSION};
+    const auto receive = [&](CSerializedNetMsg msg) {
+        CSerializedNetHeader header;
+        serializer.prepareForTransport(msg, header);
+        std::vector<uint8_t> bytes{header.begin(), header.end()};
+        bytes.insert(bytes.end(), msg.data.begin(), msg.data.end());
+        Span<const uint8_t> msg_bytes{bytes};
+        while (!msg_bytes.empty()) BOOST_REQUIRE(deserializer.Read(msg_bytes) > 0);
+        BOOST_REQUIRE(deserializer.Complete());
+        uint32_t out_err_raw_size{0};
+        Optional<CNetMessage> result{deserializer.GetMessage(GetTime<std::chrono::microseconds>(), out_err_raw_size)};
+        BOOST_REQUIRE(result);
+        return std::move(*result);
+    };
+    const CNetMsgMaker maker{INIT_PROTO_VERSION};
+
+    CNetMessage first{receive(maker.Make(NetMsgType::PING, uint64_t{1}))};
+    const auto* const first_buffer = first.m_recv.data();
+    uint64_t nonce;
+    first.m_recv >> nonce;
+    BOOST_CHECK_EQUAL(nonce, 1U);
+
+    // A message received after recycling the buffer of the first one is read into it
+    deserializer.RecycleBuffer(std::move(first.m_recv));
+    CNetMessage second{receive(maker.Make(NetMsgType::PING, uint64_t{2}))};
+    BOOST_CHECK(second.m_recv.data() == first_buffer);
+    BOOST_CHECK_EQUAL(second.m_command, NetMsgType::PING);
+    second.m_recv >> nonce;
+    BOOST_CHECK_EQUAL(nonce, 2U);
+    BOOST_CHECK(second.m_recv.empty());
+
+    // Only a few small messages are kept by a connection for reuse
+    CNode node{/* id */ 0, NODE_NETWORK, INVALID_SOCKET, CAddress{}, /* nKeyedNetGroupIn */ 0, /* nLocalHostNonceIn */ 0, CAddress{}, /* pszDest */ "", ConnectionType::OUTBOUND_FULL_RELAY};
+    std::list<CNetMessage> msgs;
+    msgs.push_back(receive(maker.Make(NetMsgType::TX, std::vector<uint8_t>(MAX_SPARE_RECV_MSG_SIZE))));
+    for (size_t i = 0; i <= MAX_SPARE_RECV_MSGS; ++i) {
+        msgs.push_back(receive(maker.Make(NetMsgType::PING, uint64_t{i})));
+    }
+    node.RecycleRecvMsgs(msgs);
+    BOOST_CHECK_EQUAL(msgs.size(), 1U);
+    LOCK(node.cs_vProcessMsg);
+    BOOST_CHECK_EQUAL(node.m_spent_recv_msgs.size(), MAX_SPARE_RECV_MSGS);
+}
+
+BOOST_AUTO_TEST_CASE(send_queue_gather_and_advance)
+{
+    // Three queued messages with distinct header and payload bytes
+    std::deque<CSendQueueEntry> queue;
+    std::vector<unsigned char> stream;
+    for (unsigned char i = 0; i < 3; ++i) {
+        CSendQueueEntry& entry = queue.emplace_back(std::vector<unsigned char>(10 + i, 0xa0 + i));
+        entry.header.fill(0x10 + i);
+        stream.insert(stream.end(), entry.header.begin(), entry.header.end());
+        stream.insert(stream.end(), entry.bytes().begin(), entry.bytes().end());
+    }
+    const size_t header_size = CMessageHeader::HEADER_SIZE;
+    size_t queue_size = stream.size();
+    size_t offset = 0;
+    SendQueueIterator it = queue.cbegin();
+    std::vector<unsigned char> written;
+
+    // Gather the unsent bytes and "write" the first sent of them, like a short send would
+    const auto write = [&](size_t sent, size_t expected_count) {
+        std::array<Span<const unsigned char>, 8> buffers;
+        size_t requested;
+        const size_t count = GatherSendBuffers(it, queue.cend(), offset, buffers, requested);
+        BOOST_CHECK_EQUAL(count, expected_count);
+        BOOST_CHECK_EQUAL(requested, stream.size() - written.size());
+        for (size_t i = 0, left = sent; i < count && left > 0; ++i) {
+            const Span<const unsigned char> part = buffers[i].first(std::min(left, buffers[i].size()));
+            written.insert(written.end(), part.begin(), part.end());
+            left -= part.size();
+        }
+        it = AdvanceSendQueue(it, sent, offset, queue_size);
+        BOOST_CHECK(Span<const unsigned char>{written} == Span<const unsigned char>{stream}.first(written.size()));
+    };
+
+    // A write that stops in the middle of the first header
+    write(5, 6);
+    BOOST_CHECK(it == queue.cbegin());
+    BOOST_CHECK_EQUAL(offset, 5U);
+    BOOST_CHECK_EQUAL(queue_size, stream.size());
+
+    // One that stops in the middle of the first payload
+    write(header_size - 5 + 3, 6);
+    BOOST_CHECK(it == queue.cbegin());
+    BOOST_CHECK_EQUAL(offset, header_size + 3);
+
+    // One that completes the first message and stops in the middle of the second payload
+    write(7 + header_size + 4, 5);
+    BOOST_CHECK(it == queue.cbegin() + 1);
+    BOOST_CHECK_EQUAL(offset, header_size + 4);
+    BOOST_CHECK_EQUAL(queue_size, stream.size() - (header_size + 10));
+
+    // One that ends exactly at the end of the second message
+    write(7, 3);
+    BOOST_CHECK(it == queue.cbegin() + 2);
+    BOOST_CHECK_EQUAL(offset, 0U);
+    BOOST_CHECK_EQUAL(queue_size, header_size + 12);
+
+    // One that stops in the middle of the last header, and the rest
+    write(header_size - 1, 2);
+    BOOST_CHECK(it == queue.cbegin() + 2);
+    BOOST_CHECK_EQUAL(offset, header_size - 1);
+    write(1 + 12, 2);
+    BOOST_CHECK(it == queue.cend());
+    BOOST_CHECK_EQUAL(offset, 0U);
+    BOOST_CHECK_EQUAL(queue_size, 0U);
+    BOOST_CHECK(written == stream);
+
+    // Gathering stops when the buffers are full, and after a file payload,
+    // which is sent separately
+    std::array<Span<const unsigned char>, 3> few_buffers;
+    size_t requested;
+    BOOST_CHECK_EQUAL(GatherSendBuffers(queue.cbegin(), queue.cend(), 0, few_buffers, requested), 2U);
+    BOOST_CHECK_EQUAL(requested, header_size + 10);
+    queue.emplace(queue.cbegin() + 1, fs::path{"blk00000.dat"}, 0, 100);
+    std::array<Span<const unsigned char>, 8> buffers;
+    BOOST_CHECK_EQUAL(GatherSendBuffers(queue.cbegin(), queue.cend(), 0, buffers, requested), 3U);
+    BOOST_CHECK_EQUAL(requested, header_size + 10 + header_size);
+}
+
+#ifdef USE_SENDFILE
+BOOST_AUTO_TEST_CASE(push_message_from_file)
+{
+    // A payload of 1 MiB, at an offset in its file
+    const fs::path path = GetDataDir() / "payload.dat";
+    const size_t payload_offset = 1000;
+    std::vector<unsigned char> contents(payload_offset + (1 << 20));
+    for (size_t i = 0; i < contents.size(); ++i) contents[i] = i * 7;
+    {
+        CAutoFile file{fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION};
+        file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+    }
+    const Span<const unsigned char> payload = Span<const unsigned char>{contents}.subspan(payload_offset);
+
+    uint256 hash;
+    CHash256().Write(payload).Finalize(hash);
+    CSerializedNetHeader header;
+    V1TransportSerializer{}.prepareForTransport(NetMsgType::BLOCK, payload.size(), hash, header);
+    std::vector<unsigned char> expected{header.begin(), header.end()};
+    expected.insert(expected.end(), payload.begin(), payload.end());
+
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    // The node closes its end, the receiving end is closed on every way out
+    const std::unique_ptr<int, void (*)(int*)> receiver{&fds[1], [](int* fd) { close(*fd); }};
+    ConnmanTestMsg connman{0x1337, 0x1337};
+    CNode node{/* id */ 0, NODE_NETWORK, static_cast<SOCKET>(fds[0]), CAddress{}, /* nKeyedNetGroupIn */ 0, /* nLocalHostNonceIn */ 0, CAddress{}, /* pszDest */ "", ConnectionType::OUTBOUND_FULL_RELAY};
+    BOOST_REQUIRE(connman.PushMessageFromFile(&node, NetMsgType::BLOCK, fsbridge::fopen(path, "rb"), path, payload_offset, payload.size()));
+
+    // The optimistic write fills the socket buffer and stops within the
+    // payload, keeping the file open for the rest
+    {
+        LOCK(node.cs_vSend);
+        BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 1U);
+        BOOST_CHECK(node.m_send_file != nullptr);
+        BOOST_CHECK_GT(node.nSendOffset, header.size());
+        BOOST_CHECK_EQUAL(node.nSendOffset, node.nSendBytes);
+        BOOST_CHECK_EQUAL(node.nSendSize, expected.size());
+    }
+
+    // Drain the other end and resume sending until the whole message is received
+    std::vector<unsigned char> received;
+    size_t resumed = 0;
+    while (received.size() < expected.size()) {
+        unsigned char buf[0x10000];
+        ssize_t nRead;
+        while ((nRead = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            received.insert(received.end(), buf, buf + nRead);
+        }
+        LOCK(node.cs_vSend);
+        if (node.vSendMsg.empty()) continue;
+        const size_t offset = node.nSendOffset;
+        const size_t sent = connman.SendQueuedData(node);
+        BOOST_REQUIRE_GT(sent, 0U);
+        ++resumed;
+        // Each send picks up where the previous one stopped
+        BOOST_CHECK_EQUAL(node.nSendBytes, offset + sent);
+        BOOST_CHECK_EQUAL(node.nSendOffset, node.vSendMsg.empty() ? 0 : offset + sent);
+    }
+    BOOST_CHECK_GT(resumed, 0U);
+    BOOST_CHECK(received == expected);
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK(node.vSendMsg.empty());
+        BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+        BOOST_CHECK(node.m_send_file == nullptr);
+    }
+}
+#endif
+
 BOOST_AUTO_TEST_CASE(node_eviction_test)
 {
     FastRandomContext random_context{true};
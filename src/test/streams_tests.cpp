@@ -67,6 +67,24 @@ BOOST_AUTO_TEST_CASE(streams_vector_writer)
     vch.clear();
 }
 
+BOOST_AUTO_TEST_CASE(streams_span_writer)
+{
+    unsigned char a(1);
+    unsigned char b(2);
+    std::array<unsigned char, 4> buf{};
+
+    SpanWriter(SER_NETWORK, INIT_PROTO_VERSION, buf, a, b);
+    BOOST_CHECK((buf == std::array<unsigned char, 4>{{1, 2, 0, 0}}));
+
+    SpanWriter writer(SER_NETWORK, INIT_PROTO_VERSION, MakeSpan(buf).subspan(1));
+    writer << a << b << a;
+    BOOST_CHECK((buf == std::array<unsigned char, 4>{{1, 1, 2, 1}}));
+
+    // Writing past the end of the span fails
+    BOOST_CHECK_THROW(writer << b, std::ios_base::failure);
+    BOOST_CHECK_THROW(SpanWriter(SER_NETWORK, INIT_PROTO_VERSION, buf, uint64_t{0}), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_CASE(streams_vector_reader)
 {
     std::vector<unsigned char> vch = {1, 255, 3, 4, 5, 6};
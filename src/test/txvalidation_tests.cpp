@@ -3,7 +3,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <consensus/validation.h>
+#include <key.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
 #include <test/util/setup_common.h>
 #include <validation.h>
@@ -13,6 +15,30 @@
 
 BOOST_AUTO_TEST_SUITE(txvalidation_tests)
 
+/**
+ * Spend the first output of prev, which pays to key, to key again. The
+ * signature is corrupted unless valid_signature is set.
+ */
+static CTransactionRef MakeSpend(const CKey& key, const CTransactionRef& prev, CAmount value, bool valid_signature)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(prev->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = value;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    if (!valid_signature) vchSig[vchSig.size() / 2] ^= 1;
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    return MakeTransactionRef(spend);
+}
+
 /**
  * Ensure that the mempool won't accept coinbase transactions.
  */
@@ -51,4 +77,89 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK(state.GetResult() == TxValidationResult::TX_CONSENSUS);
 }
 
+/**
+ * Ensure that transactions checked ahead of mempool acceptance are accepted
+ * or rejected the same way afterwards.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_precheck_scripts, TestChain100Setup)
+{
+    const CTransactionRef good = MakeSpend(coinbaseKey, m_coinbase_txns[0], 11 * CENT, true);
+    const CTransactionRef bad = MakeSpend(coinbaseKey, m_coinbase_txns[0], 11 * CENT, false);
+    const COutPoint spent(m_coinbase_txns[0]->GetHash(), 0);
+    WITH_LOCK(cs_main, ::ChainstateActive().ForceFlushStateToDisk());
+    BOOST_CHECK(!WITH_LOCK(cs_main, return ::ChainstateActive().CoinsTip().HaveCoinInCache(spent)));
+    TransactionScriptChecks good_checks;
+    TransactionScriptChecks bad_checks;
+    BOOST_CHECK(WITH_LOCK(cs_main, return PrepareTransactionScriptChecks(*m_node.mempool, good, good_checks)));
+    BOOST_CHECK(WITH_LOCK(cs_main, return PrepareTransactionScriptChecks(*m_node.mempool, bad, bad_checks)));
+    BOOST_CHECK(RunTransactionScriptChecks(good_checks));
+    BOOST_CHECK(!RunTransactionScriptChecks(bad_checks));
+    // The coins looked up are listed to be uncached
+    BOOST_CHECK(good_checks.coins_to_uncache == std::vector<COutPoint>{spent});
+    BOOST_CHECK(bad_checks.coins_to_uncache.empty());
+
+    {
+        LOCK(cs_main);
+        TxValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(*m_node.mempool, state, bad, nullptr /* plTxnReplaced */, false /* bypass_limits */));
+        BOOST_CHECK(state.GetRejectReason().find("script-verify-flag") != std::string::npos);
+        state = TxValidationState();
+        BOOST_CHECK(AcceptToMemoryPool(*m_node.mempool, state, good, nullptr /* plTxnReplaced */, false /* bypass_limits */));
+        BOOST_CHECK_EQUAL(m_node.mempool->size(), 1U);
+    }
+
+    // The policy checks run first, so a transaction already in the mempool
+    // fails without its scripts being prepared
+    TransactionScriptChecks again_checks;
+    BOOST_CHECK(!WITH_LOCK(cs_main, return PrepareTransactionScriptChecks(*m_node.mempool, good, again_checks)));
+    BOOST_CHECK(again_checks.checks.empty());
+}
+
+/**
+ * Ensure that a package is accepted to the mempool as a whole or not at all.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_package, TestChain100Setup)
+{
+    const CTransactionRef parent = MakeSpend(coinbaseKey, m_coinbase_txns[0], 49 * COIN, true);
+    const CTransactionRef child = MakeSpend(coinbaseKey, parent, 48 * COIN, true);
+    const CTransactionRef bad_child = MakeSpend(coinbaseKey, parent, 48 * COIN, false);
+
+    LOCK(cs_main);
+    TxValidationState state;
+    std::vector<TxValidationState> tx_states;
+    std::vector<CAmount> fees;
+
+    // The child spends an output of the parent, which is not in the mempool
+    BOOST_CHECK(AcceptPackageToMemoryPool(*m_node.mempool, state, tx_states, {parent, child}, /* test_accept */ true, &fees));
+    BOOST_CHECK_EQUAL(tx_states.size(), 2U);
+    BOOST_CHECK(fees == std::vector<CAmount>({1 * COIN, 1 * COIN}));
+    BOOST_CHECK_EQUAL(m_node.mempool->size(), 0U);
+
+    state = TxValidationState();
+    BOOST_CHECK(!AcceptPackageToMemoryPool(*m_node.mempool, state, tx_states, {child, parent}, /* test_accept */ true));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "package-not-sorted");
+    BOOST_CHECK(tx_states.empty());
+
+    // An invalid transaction makes the whole package invalid
+    state = TxValidationState();
+    BOOST_CHECK(!AcceptPackageToMemoryPool(*m_node.mempool, state, tx_states, {parent, bad_child}, /* test_accept */ false));
+    BOOST_CHECK_EQUAL(tx_states.size(), 2U);
+    BOOST_CHECK(tx_states[0].IsValid());
+    BOOST_CHECK(state.GetRejectReason().find("script-verify-flag") != std::string::npos);
+    BOOST_CHECK_EQUAL(m_node.mempool->size(), 0U);
+
+    // A parent already in the mempool is skipped, for a child to be added
+    state = TxValidationState();
+    BOOST_CHECK(AcceptToMemoryPool(*m_node.mempool, state, parent, nullptr /* plTxnReplaced */, false /* bypass_limits */));
+    BOOST_CHECK_EQUAL(m_node.mempool->size(), 1U);
+    BOOST_CHECK(AcceptPackageToMemoryPool(*m_node.mempool, state, tx_states, {parent, child}, /* test_accept */ true, &fees));
+    BOOST_CHECK(fees == std::vector<CAmount>({1 * COIN, 1 * COIN}));
+
+    state = TxValidationState();
+    BOOST_CHECK(AcceptPackageToMemoryPool(*m_node.mempool, state, tx_states, {parent, child}, /* test_accept */ false));
+    BOOST_CHECK_EQUAL(m_node.mempool->size(), 2U);
+    BOOST_CHECK(m_node.mempool->exists(parent->GetHash()));
+    BOOST_CHECK(m_node.mempool->exists(child->GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
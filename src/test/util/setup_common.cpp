@@ -147,6 +147,13 @@ ChainTestingSetup::ChainTestingSetup(const std::string& chainName, const std::ve
         threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
     }
     g_parallel_script_checks = true;
+
+    // Start coins prefetch threads, so that ConnectTip() exercises them.
+    constexpr int prefetch_threads = 2;
+    for (int i = 0; i < prefetch_threads; ++i) {
+        threadGroup.create_thread([i]() { return ThreadCoinsPrefetch(i); });
+    }
+    g_parallel_coins_prefetch = true;
 }
 
 ChainTestingSetup::~ChainTestingSetup()
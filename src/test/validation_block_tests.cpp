@@ -15,6 +15,7 @@
 #include <util/time.h>
 #include <validation.h>
 #include <validationinterface.h>
+#include <versionbits.h>
 
 #include <thread>
 
@@ -338,6 +339,48 @@ BOOST_AUTO_TEST_CASE(mempool_locks_reorg)
     }
 }
 
+BOOST_AUTO_TEST_CASE(processnewblockheaders_batch)
+{
+    // Enough headers for their proof of work to be checked on several threads
+    const size_t count = 2 * HEADERS_POW_CHECK_BATCH + 10;
+    const size_t invalid_pos = HEADERS_POW_CHECK_BATCH + 5;
+    std::vector<CBlockHeader> headers;
+    CBlockHeader prev = Params().GenesisBlock().GetBlockHeader();
+    for (size_t i = 0; i < count; ++i) {
+        CBlockHeader header;
+        header.nVersion = VERSIONBITS_TOP_BITS;
+        header.hashPrevBlock = prev.GetHash();
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = prev.nTime + 1;
+        header.nBits = prev.nBits;
+        // All headers have a valid proof of work but one
+        while (CheckProofOfWork(header.GetHash(), header.nBits, Params().GetConsensus()) == (i == invalid_pos)) {
+            ++header.nNonce;
+        }
+        headers.push_back(header);
+        prev = header;
+    }
+
+    // Headers are accepted in order, up to the one with an invalid proof of work
+    BlockValidationState state;
+    BOOST_CHECK(!Assert(m_node.chainman)->ProcessNewBlockHeaders(headers, state, Params()));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    {
+        LOCK(cs_main);
+        const CBlockIndex* last = LookupBlockIndex(headers[invalid_pos - 1].GetHash());
+        BOOST_REQUIRE(last);
+        BOOST_CHECK_EQUAL(last->nHeight, int(invalid_pos));
+        BOOST_CHECK(LookupBlockIndex(headers[invalid_pos].GetHash()) == nullptr);
+    }
+
+    const std::vector<CBlockHeader> valid(headers.begin(), headers.begin() + invalid_pos);
+    const CBlockIndex* tip = nullptr;
+    state = BlockValidationState{};
+    BOOST_CHECK(Assert(m_node.chainman)->ProcessNewBlockHeaders(valid, state, Params(), &tip));
+    BOOST_REQUIRE(tip);
+    BOOST_CHECK(tip->GetBlockHash() == valid.back().GetHash());
+}
+
 BOOST_AUTO_TEST_CASE(witness_commitment_index)
 {
     CScript pubKey;
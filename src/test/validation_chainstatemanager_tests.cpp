@@ -4,15 +4,23 @@
 //
 #include <chainparams.h>
 #include <consensus/validation.h>
+#include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
 #include <random.h>
+#include <rpc/blockchain.h>
+#include <streams.h>
 #include <sync.h>
 #include <test/util/setup_common.h>
 #include <uint256.h>
+#include <util/system.h>
 #include <validation.h>
 #include <validationinterface.h>
 
+#include <functional>
 #include <vector>
 
+#include <univalue.h>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(validation_chainstatemanager_tests, ChainTestingSetup)
@@ -155,4 +163,81 @@ BOOST_AUTO_TEST_CASE(chainstatemanager_rebalance_caches)
     BOOST_CHECK_CLOSE(c2.m_coinsdb_cache_size_bytes, max_cache * 0.95, 1);
 }
 
+//! Test loading a UTXO snapshot and validating it in the background.
+BOOST_FIXTURE_TEST_CASE(chainstatemanager_activate_snapshot, TestChain100Setup)
+{
+    ChainstateManager& chainman = *Assert(m_node.chainman);
+    CChainState& ibd_chainstate = chainman.ActiveChainstate();
+    const CBlockIndex* base = WITH_LOCK(::cs_main, return chainman.ActiveTip());
+
+    const fs::path snapshot_path = GetDataDir() / "test_snapshot.dat";
+    {
+        FILE* outfile{fsbridge::fopen(snapshot_path, "wb")};
+        CAutoFile auto_outfile{outfile, SER_DISK, CLIENT_VERSION};
+        UniValue result = CreateUTXOSnapshot(m_node, ibd_chainstate, auto_outfile);
+        BOOST_CHECK_EQUAL(result["base_height"].get_int(), base->nHeight);
+    }
+
+    CCoinsStats stats;
+    BOOST_REQUIRE(GetUTXOStats(WITH_LOCK(::cs_main, return &ibd_chainstate.CoinsDB()), stats, CoinStatsHashType::HASH_SERIALIZED, [] {}));
+
+    auto make_params = [&](const uint256& hash_serialized) {
+        ArgsManager args;
+        args.ForceSetArg("-assumeutxo", strprintf("%d:%s:%d", base->nHeight, hash_serialized.ToString(), base->nChainTx));
+        return CreateChainParams(args, CBaseChainParams::REGTEST);
+    };
+    const auto params = make_params(stats.hashSerialized);
+    BOOST_CHECK_EQUAL(params->Assumeutxo().at(base->nHeight).hash_serialized, stats.hashSerialized);
+
+    auto load_snapshot = [&](const CChainParams& chainparams, std::function<void(SnapshotMetadata&)> malleation = {}) {
+        FILE* infile{fsbridge::fopen(snapshot_path, "rb")};
+        CAutoFile auto_infile{infile, SER_DISK, CLIENT_VERSION};
+        SnapshotMetadata metadata;
+        auto_infile >> metadata;
+        if (malleation) malleation(metadata);
+        return chainman.ActivateSnapshot(auto_infile, metadata, chainparams, /* in_memory */ true);
+    };
+
+    // The chain doesn't accept snapshots at this height.
+    BOOST_CHECK(!load_snapshot(Params()));
+    // The content of the snapshot doesn't match the hash.
+    BOOST_CHECK(!load_snapshot(*make_params(InsecureRand256())));
+    // The snapshot is truncated or has coins left over.
+    BOOST_CHECK(!load_snapshot(*params, [](SnapshotMetadata& metadata) { metadata.m_coins_count += 1; }));
+    BOOST_CHECK(!load_snapshot(*params, [](SnapshotMetadata& metadata) { metadata.m_coins_count -= 1; }));
+    // The base block is unknown.
+    BOOST_CHECK(!load_snapshot(*params, [](SnapshotMetadata& metadata) { metadata.m_base_blockhash = InsecureRand256(); }));
+    BOOST_CHECK(!chainman.IsSnapshotActive());
+    BOOST_CHECK_EQUAL(&chainman.ActiveChainstate(), &ibd_chainstate);
+
+    BOOST_REQUIRE(load_snapshot(*params));
+    BOOST_CHECK(chainman.IsSnapshotActive());
+    BOOST_CHECK(!chainman.IsSnapshotValidated());
+    BOOST_CHECK_EQUAL(WITH_LOCK(::cs_main, return chainman.ActiveTip()), base);
+    BOOST_CHECK_EQUAL(WITH_LOCK(::cs_main, return chainman.BackgroundValidationChainstate()), &ibd_chainstate);
+    CChainState& snapshot_chainstate = chainman.ActiveChainstate();
+    BOOST_CHECK(&snapshot_chainstate != &ibd_chainstate);
+
+    CCoinsStats snapshot_stats;
+    BOOST_REQUIRE(GetUTXOStats(WITH_LOCK(::cs_main, return &snapshot_chainstate.CoinsDB()), snapshot_stats, CoinStatsHashType::HASH_SERIALIZED, [] {}));
+    BOOST_CHECK_EQUAL(snapshot_stats.coins_count, stats.coins_count);
+    BOOST_CHECK_EQUAL(snapshot_stats.hashSerialized, stats.hashSerialized);
+
+    // A snapshot can only be loaded once.
+    BOOST_CHECK(!load_snapshot(*params));
+
+    // New blocks extend the snapshot chainstate. The background chainstate is
+    // already at the snapshot base, so its UTXO set gets checked right away.
+    CScript script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, script_pub_key);
+    BOOST_CHECK_EQUAL(WITH_LOCK(::cs_main, return chainman.ActiveHeight()), base->nHeight + 1);
+    BOOST_CHECK_EQUAL(WITH_LOCK(::cs_main, return ibd_chainstate.m_chain.Tip()), base);
+    BOOST_CHECK(chainman.IsSnapshotValidated());
+    BOOST_CHECK(WITH_LOCK(::cs_main, return chainman.BackgroundValidationChainstate()) == nullptr);
+    BOOST_CHECK_EQUAL(&chainman.ValidatedChainstate(), &snapshot_chainstate);
+
+    SyncWithValidationInterfaceQueue();
+    fs::remove(snapshot_path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
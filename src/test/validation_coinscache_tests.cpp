@@ -0,0 +1,108 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <fs.h>
+#include <random.h>
+#include <sync.h>
+#include <test/util/setup_common.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validation_coinscache_tests, TestChain100Setup)
+
+namespace {
+//! Overwrite part of the coins cache file.
+void WriteAt(long offset, const std::vector<unsigned char>& data)
+{
+    FILE* file = fsbridge::fopen(GetDataDir() / "coinscache.dat", "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fseek(file, offset, SEEK_SET), 0);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+} // namespace
+
+//! A dump of the coins cache loads back into it, unless the file is corrupt or
+//! out of date, and is removed once it has been read.
+BOOST_AUTO_TEST_CASE(coins_cache_dump_load)
+{
+    const fs::path path = GetDataDir() / "coinscache.dat";
+    std::vector<COutPoint> outpoints;
+    for (const CTransactionRef& coinbase : m_coinbase_txns) {
+        outpoints.emplace_back(coinbase->GetHash(), 0);
+    }
+
+    // Warm the cache with coins from the database, and dump them.
+    const auto dump = [&] {
+        LOCK(cs_main);
+        ::ChainstateActive().ForceFlushStateToDisk();
+        for (const COutPoint& outpoint : outpoints) {
+            BOOST_CHECK(!::ChainstateActive().CoinsTip().AccessCoin(outpoint).IsSpent());
+        }
+        BOOST_CHECK(DumpCoinsCache(::ChainstateActive()));
+        ::ChainstateActive().ForceFlushStateToDisk();
+        BOOST_CHECK_EQUAL(::ChainstateActive().CoinsTip().GetCacheSize(), 0U);
+    };
+    const auto num_cached = [&] {
+        LOCK(cs_main);
+        size_t num = 0;
+        for (const COutPoint& outpoint : outpoints) {
+            num += ::ChainstateActive().CoinsTip().HaveCoinInCache(outpoint);
+        }
+        return num;
+    };
+
+    dump();
+    BOOST_CHECK(fs::exists(path));
+    BOOST_CHECK(LoadCoinsCache(::ChainstateActive()));
+    BOOST_CHECK_EQUAL(num_cached(), outpoints.size());
+    BOOST_CHECK(!fs::exists(path));
+    // There is nothing left to load after an unclean shutdown.
+    BOOST_CHECK(!LoadCoinsCache(::ChainstateActive()));
+
+    // A truncated file
+    dump();
+    fs::resize_file(path, fs::file_size(path) - 10);
+    BOOST_CHECK(!LoadCoinsCache(::ChainstateActive()));
+    BOOST_CHECK_EQUAL(num_cached(), 0U);
+    BOOST_CHECK(!fs::exists(path));
+
+    // A file for another best block, 8 bytes in after the version
+    dump();
+    WriteAt(8, std::vector<unsigned char>(32, 0x42));
+    BOOST_CHECK(!LoadCoinsCache(::ChainstateActive()));
+    BOOST_CHECK_EQUAL(num_cached(), 0U);
+    BOOST_CHECK(!fs::exists(path));
+
+    // While a flush is being written in the background. The database still
+    // reports the best block of the dump, but the cache no longer has the
+    // coins that the flushed blocks spent.
+    dump();
+    {
+        LOCK(cs_main);
+        auto flushing = std::make_shared<CCoinsMap>();
+        (*flushing)[outpoints[0]].flags = CCoinsCacheEntry::DIRTY;
+        ::ChainstateActive().CoinsFlushing().SetFlushingCoins(flushing, InsecureRand256());
+    }
+    BOOST_CHECK(!LoadCoinsCache(::ChainstateActive()));
+    BOOST_CHECK_EQUAL(num_cached(), 0U);
+    BOOST_CHECK(!fs::exists(path));
+    WITH_LOCK(cs_main, ::ChainstateActive().CoinsFlushing().ClearFlushingCoins());
+
+    // A file of an unknown version
+    dump();
+    WriteAt(0, {2, 0, 0, 0, 0, 0, 0, 0});
+    BOOST_CHECK(!LoadCoinsCache(::ChainstateActive()));
+    BOOST_CHECK_EQUAL(num_cached(), 0U);
+    BOOST_CHECK(!fs::exists(path));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
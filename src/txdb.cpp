@@ -17,6 +17,10 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <deque>
+#include <future>
+
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
@@ -47,6 +51,10 @@ CCoinsViewDB::CCoinsViewDB(fs::path ldb_path, size_t nCacheSize, bool fMemory, b
 
 void CCoinsViewDB::ResizeCache(size_t new_cache_size)
 {
+    // Reopening an in-memory database would lose all the coins.
+    if (m_is_memory) {
+        return;
+    }
     // Have to do a reset first to get the original `m_db` state to release its
     // filesystem lock.
     m_db.reset();
@@ -77,12 +85,35 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+namespace {
+
+/** Dirty coins to be serialized into one database batch. */
+using CoinsChunk = std::vector<std::pair<const COutPoint*, const Coin*>>;
+
+std::unique_ptr<CDBBatch> SerializeCoins(const CDBWrapper& db, const CoinsChunk& chunk)
+{
+    auto batch = MakeUnique<CDBBatch>(db);
+    for (const auto& [outpoint, coin] : chunk) {
+        CoinEntry entry(outpoint);
+        if (coin->IsSpent())
+            batch->Erase(entry);
+        else
+            batch->Write(entry, *coin);
+    }
+    return batch;
+}
+
+} // namespace
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
     CDBBatch batch(*m_db);
     size_t count = 0;
     size_t changed = 0;
     size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+    int write_threads = gArgs.GetArg("-dbwritethreads", DEFAULT_DB_WRITE_THREADS);
+    if (write_threads <= 0) write_threads = GetNumCores();
+    write_threads = std::max(1, std::min(write_threads, MAX_DB_WRITE_THREADS));
     assert(!hashBlock.IsNull());
 
     uint256 old_tip = GetBestBlock();
@@ -99,41 +130,62 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     // transition from old_tip to hashBlock.
     // A vector is used for future extensibility, as we may want to support
     // interrupting after partial writes from multiple independent reorgs.
+    // Coin batches may be serialized out of order, so this one is written
+    // on its own before any of them.
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, Vector(hashBlock, old_tip));
+    m_db->WriteBatch(batch);
+    batch.Clear();
+
+    // Dirty coins are split into chunks of about batch_size bytes, which are
+    // serialized on up to write_threads threads at once. Each batch is written
+    // as soon as it is ready, while the following chunks are being serialized.
+    // mapCoins is not modified until all of them are done.
+    std::deque<std::future<std::unique_ptr<CDBBatch>>> pending;
+    const auto write_oldest = [&] {
+        std::unique_ptr<CDBBatch> ready = pending.front().get();
+        pending.pop_front();
+        LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", ready->SizeEstimate() * (1.0 / 1048576.0));
+        m_db->WriteBatch(*ready);
+        if (crash_simulate) {
+            static FastRandomContext rng;
+            if (rng.randrange(crash_simulate) == 0) {
+                LogPrintf("Simulating a crash. Goodbye.\n");
+                _Exit(0);
+            }
+        }
+    };
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    CoinsChunk chunk;
+    size_t chunk_size = 0;
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            CoinEntry entry(&it->first);
-            if (it->second.coin.IsSpent())
-                batch.Erase(entry);
-            else
-                batch.Write(entry, it->second.coin);
+            chunk.emplace_back(&it->first, &it->second.coin);
+            // Roughly the serialized key, value and LevelDB record overhead.
+            chunk_size += 48 + it->second.coin.out.scriptPubKey.size();
             changed++;
-        }
-        count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
-        if (batch.SizeEstimate() > batch_size) {
-            LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
-            m_db->WriteBatch(batch);
-            batch.Clear();
-            if (crash_simulate) {
-                static FastRandomContext rng;
-                if (rng.randrange(crash_simulate) == 0) {
-                    LogPrintf("Simulating a crash. Goodbye.\n");
-                    _Exit(0);
-                }
+            if (chunk_size > batch_size) {
+                if (pending.size() >= (size_t)write_threads) write_oldest();
+                pending.push_back(std::async(write_threads > 1 ? std::launch::async : std::launch::deferred,
+                                             SerializeCoins, std::cref(*m_db), std::move(chunk)));
+                chunk.clear();
+                chunk_size = 0;
             }
         }
+        count++;
     }
 
+    // The remaining coins go in the last batch, together with the marker.
+    std::unique_ptr<CDBBatch> last = SerializeCoins(*m_db, chunk);
+    while (!pending.empty()) write_oldest();
+    if (erase) mapCoins.clear();
+
     // In the last batch, mark the database as consistent with hashBlock again.
-    batch.Erase(DB_HEAD_BLOCKS);
-    batch.Write(DB_BEST_BLOCK, hashBlock);
+    last->Erase(DB_HEAD_BLOCKS);
+    last->Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
-    bool ret = m_db->WriteBatch(batch);
+    LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", last->SizeEstimate() * (1.0 / 1048576.0));
+    bool ret = m_db->WriteBatch(*last);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
@@ -19,6 +19,100 @@
 #include <util/time.h>
 #include <validationinterface.h>
 
+#include <algorithm>
+#include <cstring>
+
+MemPoolLinks::MemPoolLinks(const MemPoolLinks& other)
+{
+    *this = other;
+}
+
+MemPoolLinks& MemPoolLinks::operator=(const MemPoolLinks& other)
+{
+    if (this == &other) return *this;
+    Free();
+    if (!other.IsInline()) {
+        Reallocate(other.m_capacity, other.m_block->resource);
+    }
+    m_size = other.m_size;
+    std::memcpy(data(), other.data(), m_size * sizeof(value_type));
+    return *this;
+}
+
+size_t MemPoolLinks::count(const CTxMemPoolEntry& entry) const
+{
+    const value_type link{entry};
+    const const_iterator it = std::lower_bound(begin(), end(), link, CompareIteratorByHash());
+    return it != end() && !CompareIteratorByHash()(link, *it);
+}
+
+bool MemPoolLinks::insert(const CTxMemPoolEntry& entry, MemPoolLinksResource& resource)
+{
+    const value_type link{entry};
+    const size_t index = std::lower_bound(begin(), end(), link, CompareIteratorByHash()) - begin();
+    if (index < m_size && !CompareIteratorByHash()(link, data()[index])) return false;
+    if (m_size == m_capacity) {
+        Reallocate(m_capacity * 2, &resource);
+    }
+    value_type* const links = data();
+    std::memmove(links + index + 1, links + index, (m_size - index) * sizeof(value_type));
+    new (links + index) value_type(link);
+    ++m_size;
+    return true;
+}
+
+bool MemPoolLinks::erase(const CTxMemPoolEntry& entry)
+{
+    const value_type link{entry};
+    const size_t index = std::lower_bound(begin(), end(), link, CompareIteratorByHash()) - begin();
+    if (index == m_size || CompareIteratorByHash()(link, data()[index])) return false;
+    value_type* const links = data();
+    std::memmove(links + index, links + index + 1, (m_size - index - 1) * sizeof(value_type));
+    --m_size;
+    if (!IsInline() && m_size <= INLINE_LINKS) {
+        Reallocate(INLINE_LINKS, nullptr);
+    }
+    return true;
+}
+
+size_t MemPoolLinks::DynamicMemoryUsage() const
+{
+    if (IsInline() || BlockBytes(m_capacity) <= MEMPOOL_LINKS_MAX_BLOCK_BYTES) return 0;
+    return memusage::MallocUsage(BlockBytes(m_capacity));
+}
+
+void MemPoolLinks::Reallocate(uint32_t capacity, MemPoolLinksResource* resource)
+{
+    assert(capacity >= m_size);
+    Block* const old_block = IsInline() ? nullptr : m_block;
+    const uint32_t old_capacity = m_capacity;
+    const value_type* const old_links = data();
+    if (old_block) resource = old_block->resource;
+    // The inline links share their storage with m_block, so copy them before
+    // overwriting it, and copy into them after old_block was saved.
+    if (capacity == INLINE_LINKS) {
+        std::memcpy(m_inline, old_links, m_size * sizeof(value_type));
+    } else {
+        Block* const block = static_cast<Block*>(resource->Allocate(BlockBytes(capacity), alignof(Block)));
+        block->resource = resource;
+        std::memcpy(block + 1, old_links, m_size * sizeof(value_type));
+        m_block = block;
+    }
+    m_capacity = capacity;
+    if (old_block) {
+        resource->Deallocate(old_block, BlockBytes(old_capacity), alignof(Block));
+    }
+}
+
+void MemPoolLinks::Free()
+{
+    if (!IsInline()) {
+        m_block->resource->Deallocate(m_block, BlockBytes(m_capacity), alignof(Block));
+        m_capacity = INLINE_LINKS;
+    }
+    m_size = 0;
+}
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp)
@@ -59,8 +153,8 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    CTxMemPoolEntry::Children stageEntries, descendants;
-    stageEntries = updateIt->GetMemPoolChildrenConst();
+    const CTxMemPoolEntry::Children& updateChildren = updateIt->GetMemPoolChildrenConst();
+    std::set<CTxMemPoolEntry::CTxMemPoolEntryRef, CompareIteratorByHash> stageEntries(updateChildren.begin(), updateChildren.end()), descendants;
 
     while (!stageEntries.empty()) {
         const CTxMemPoolEntry& descendant = *stageEntries.begin();
@@ -107,6 +201,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
 void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
 {
     AssertLockHeld(cs);
+    RestartAddedTxids();
     // For each entry in vHashesToUpdate, store the set of in-mempool, but not
     // in-vHashesToUpdate transactions, so that we don't have to recalculate
     // descendants when we come across a previously seen entry.
@@ -151,7 +246,13 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
-    CTxMemPoolEntry::Parents staged_ancestors;
+    // Ancestors to visit, marked as visited in the epoch when they are
+    // staged, so that each of them is staged only once.
+    std::vector<txiter> staged_ancestors;
+    const auto epoch = GetFreshEpoch();
+    for (txiter ancestorIt : setAncestors) {
+        visited(ancestorIt);
+    }
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -160,8 +261,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             Optional<txiter> piter = GetIter(tx.vin[i].prevout.hash);
-            if (piter) {
-                staged_ancestors.insert(**piter);
+            if (piter && !visited(*piter)) {
+                staged_ancestors.push_back(*piter);
                 if (staged_ancestors.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
@@ -172,17 +273,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        staged_ancestors = it->GetMemPoolParentsConst();
+        for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+            txiter parent_it = mapTx.iterator_to(parent);
+            if (!visited(parent_it)) staged_ancestors.push_back(parent_it);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
     while (!staged_ancestors.empty()) {
-        const CTxMemPoolEntry& stage = staged_ancestors.begin()->get();
-        txiter stageit = mapTx.iterator_to(stage);
+        txiter stageit = staged_ancestors.back();
+        staged_ancestors.pop_back();
 
         setAncestors.insert(stageit);
-        staged_ancestors.erase(stage);
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -201,8 +304,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             txiter parent_it = mapTx.iterator_to(parent);
 
             // If this is a new ancestor, add it.
-            if (setAncestors.count(parent_it) == 0) {
-                staged_ancestors.insert(parent);
+            if (!visited(parent_it)) {
+                staged_ancestors.push_back(parent_it);
             }
             if (staged_ancestors.size() + setAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
@@ -216,7 +319,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    CTxMemPoolEntry::Parents parents = it->GetMemPoolParents();
+    const CTxMemPoolEntry::Parents& parents = it->GetMemPoolParentsConst();
     // add or remove this tx as a child of each parent
     for (const CTxMemPoolEntry& parent : parents) {
         UpdateChild(mapTx.iterator_to(parent), it, add);
@@ -400,6 +503,11 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAnces
 
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
+
+    if (m_added_txids.size() >= MAX_TEMPLATE_ADDED_TXIDS) {
+        RestartAddedTxids();
+    }
+    m_added_txids.push_back(tx.GetHash());
 }
 
 void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
@@ -420,6 +528,12 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     for (const CTxIn& txin : it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
 
+    // Transactions removed for a block or a reorg may leave descendants behind,
+    // with their ancestor state changed.
+    if (reason == MemPoolRemovalReason::BLOCK || reason == MemPoolRemovalReason::REORG) {
+        RestartAddedTxids();
+    }
+
     RemoveUnbroadcastTx(hash, true /* add logging because unchecked */ );
 
     if (vTxHashes.size() > 1) {
@@ -433,7 +547,7 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
+    cachedInnerUsage -= it->GetMemPoolParentsConst().DynamicMemoryUsage() + it->GetMemPoolChildrenConst().DynamicMemoryUsage();
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
@@ -536,23 +650,6 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     RemoveStaged(setAllRemoves, false, MemPoolRemovalReason::REORG);
 }
 
-void CTxMemPool::removeConflicts(const CTransaction &tx)
-{
-    // Remove transactions which depend on inputs of tx, recursively
-    AssertLockHeld(cs);
-    for (const CTxIn &txin : tx.vin) {
-        auto it = mapNextTx.find(txin.prevout);
-        if (it != mapNextTx.end()) {
-            const CTransaction &txConflict = *it->second;
-            if (txConflict != tx)
-            {
-                ClearPrioritisation(txConflict.GetHash());
-                removeRecursive(txConflict, MemPoolRemovalReason::CONFLICT);
-            }
-        }
-    }
-}
-
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
  */
@@ -570,15 +667,26 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
     }
     // Before the txs in the new block have been removed from the mempool, update policy estimates
     if (minerPolicyEstimator) {minerPolicyEstimator->processBlock(nBlockHeight, entries);}
-    for (const auto& tx : vtx)
-    {
-        txiter it = mapTx.find(tx->GetHash());
-        if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+    std::vector<txiter> confirmed;
+    confirmed.reserve(entries.size());
+    for (const CTxMemPoolEntry* entry : entries) {
+        confirmed.push_back(mapTx.iterator_to(*entry));
+    }
+    RemoveConfirmed(confirmed);
+    // Remove the transactions left that spend the same inputs as the block,
+    // with all their descendants, in one go as well
+    setEntries conflicts;
+    for (const auto& tx : vtx) {
+        for (const CTxIn& txin : tx->vin) {
+            auto it = mapNextTx.find(txin.prevout);
+            if (it != mapNextTx.end() && *it->second != *tx) {
+                ClearPrioritisation(it->second->GetHash());
+                CalculateDescendants(mapTx.find(it->second->GetHash()), conflicts);
+            }
         }
-        removeConflicts(*tx);
+    }
+    RemoveStaged(conflicts, false, MemPoolRemovalReason::CONFLICT);
+    for (const auto& tx : vtx) {
         ClearPrioritisation(tx->GetHash());
     }
     lastRollingFeeUpdate = GetTime();
@@ -595,6 +703,7 @@ void CTxMemPool::_clear()
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    RestartAddedTxids();
 }
 
 void CTxMemPool::clear()
@@ -633,9 +742,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        innerUsage += memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
+        innerUsage += it->GetMemPoolParentsConst().DynamicMemoryUsage() + it->GetMemPoolChildrenConst().DynamicMemoryUsage();
         bool fDependsWait = false;
-        CTxMemPoolEntry::Parents setParentCheck;
+        std::set<CTxMemPoolEntry::CTxMemPoolEntryRef, CompareIteratorByHash> setParentCheck;
         for (const CTxIn &txin : tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
             indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
@@ -681,7 +790,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(it->GetModFeesWithAncestors() == nFeesCheck);
 
         // Check children against mapNextTx
-        CTxMemPoolEntry::Children setChildrenCheck;
+        std::set<CTxMemPoolEntry::CTxMemPoolEntryRef, CompareIteratorByHash> setChildrenCheck;
         auto iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
         uint64_t child_sizes = 0;
         for (; iter != mapNextTx.end() && iter->first->hash == it->GetTx().GetHash(); ++iter) {
@@ -824,6 +933,25 @@ TxMempoolInfo CTxMemPool::info(const GenTxid& gtxid) const
 
 TxMempoolInfo CTxMemPool::info(const uint256& txid) const { return info(GenTxid{false, txid}); }
 
+std::vector<TxMempoolInfo> CTxMemPool::infoForRelay(const std::vector<uint256>& hashes, bool wtxid) const
+{
+    LOCK(cs);
+    std::vector<indexed_transaction_set::const_iterator> iters;
+    iters.reserve(hashes.size());
+    for (const uint256& hash : hashes) {
+        indexed_transaction_set::const_iterator i = wtxid ? get_iter_from_wtxid(hash) : mapTx.find(hash);
+        if (i != mapTx.end()) iters.push_back(i);
+    }
+    std::sort(iters.begin(), iters.end(), DepthAndScoreComparator());
+
+    std::vector<TxMempoolInfo> ret;
+    ret.reserve(iters.size());
+    for (auto it : iters) {
+        ret.push_back(GetInfo(it));
+    }
+    return ret;
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeDelta)
 {
     {
@@ -849,6 +977,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
             ++nTransactionsUpdated;
+            RestartAddedTxids();
         }
     }
     LogPrintf("PrioritiseTransaction: %s feerate += %s\n", hash.ToString(), FormatMoney(nFeeDelta));
@@ -864,6 +993,23 @@ void CTxMemPool::ApplyDelta(const uint256& hash, CAmount &nFeeDelta) const
     nFeeDelta += delta;
 }
 
+void CTxMemPool::RestartAddedTxids()
+{
+    AssertLockHeld(cs);
+    // Release the memory of the log rather than keeping its capacity around.
+    std::vector<uint256>().swap(m_added_txids);
+    ++m_added_generation;
+}
+
+Optional<Span<const uint256>> CTxMemPool::GetAddedSince(const AddedCursor& cursor) const
+{
+    AssertLockHeld(cs);
+    if (cursor.generation != m_added_generation || cursor.position > m_added_txids.size()) {
+        return nullopt;
+    }
+    return Span<const uint256>(m_added_txids).subspan(cursor.position);
+}
+
 void CTxMemPool::ClearPrioritisation(const uint256& hash)
 {
     AssertLockHeld(cs);
@@ -916,13 +1062,25 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
             return false;
         }
     }
+    auto it = m_temp_added.find(outpoint);
+    if (it != m_temp_added.end()) {
+        coin = it->second;
+        return true;
+    }
     return base->GetCoin(outpoint, coin);
 }
 
+void CCoinsViewMemPool::PackageAddTransaction(const CTransactionRef& tx)
+{
+    for (unsigned int n = 0; n < tx->vout.size(); ++n) {
+        m_temp_added.emplace(COutPoint(tx->GetHash(), n), Coin(tx->vout[n], MEMPOOL_HEIGHT, false));
+    }
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(m_links_resource) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveUnbroadcastTx(const uint256& txid, const bool unchecked) {
@@ -934,6 +1092,120 @@ void CTxMemPool::RemoveUnbroadcastTx(const uint256& txid, const bool unchecked)
     }
 }
 
+void CTxMemPool::RemoveConfirmed(const std::vector<txiter>& entries)
+{
+    AssertLockHeld(cs);
+    std::vector<const CTxMemPoolEntry*> removed;
+    removed.reserve(entries.size());
+    for (txiter it : entries) {
+        removed.push_back(&*it);
+    }
+    std::sort(removed.begin(), removed.end());
+    const auto is_removed = [&](const CTxMemPoolEntry& entry) {
+        return std::binary_search(removed.begin(), removed.end(), &entry);
+    };
+
+    // The in-mempool ancestors of a block's transactions are normally in the
+    // block too. Only when some are not, walk the ancestors of each removed
+    // entry and take it out of the descendant state of those that stay.
+    bool ancestors_stay = false;
+    for (txiter it : entries) {
+        for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+            if (!is_removed(parent)) ancestors_stay = true;
+        }
+    }
+    if (ancestors_stay) {
+        std::vector<txiter> stack;
+        for (txiter removeIt : entries) {
+            const auto epoch = GetFreshEpoch();
+            stack.assign(1, removeIt);
+            visited(removeIt);
+            while (!stack.empty()) {
+                txiter it = stack.back();
+                stack.pop_back();
+                for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+                    txiter parent_it = mapTx.iterator_to(parent);
+                    if (visited(parent_it)) continue;
+                    stack.push_back(parent_it);
+                    if (!is_removed(parent)) {
+                        mapTx.modify(parent_it, update_descendant_state(-(int64_t)removeIt->GetTxSize(), -removeIt->GetModifiedFee(), -1));
+                    }
+                }
+            }
+        }
+    }
+
+    // Collect the descendants that stay in the mempool
+    std::vector<txiter> descendants;
+    {
+        const auto epoch = GetFreshEpoch();
+        for (txiter it : entries) {
+            visited(it);
+        }
+        std::vector<txiter> stack(entries);
+        while (!stack.empty()) {
+            txiter it = stack.back();
+            stack.pop_back();
+            for (const CTxMemPoolEntry& child : it->GetMemPoolChildrenConst()) {
+                txiter child_it = mapTx.iterator_to(child);
+                if (visited(child_it)) continue;
+                stack.push_back(child_it);
+                descendants.push_back(child_it);
+            }
+        }
+    }
+    std::vector<const CTxMemPoolEntry*> staying;
+    staying.reserve(descendants.size());
+    for (txiter it : descendants) {
+        staying.push_back(&*it);
+    }
+    std::sort(staying.begin(), staying.end());
+
+    // Every path from a descendant to a removed ancestor only goes through
+    // removed entries and other descendants, so only those are walked to sum
+    // up what leaves the descendant's ancestor state.
+    for (txiter descendant : descendants) {
+        int64_t modifySize = 0;
+        CAmount modifyFee = 0;
+        int64_t modifyCount = 0;
+        int64_t modifySigOps = 0;
+        const auto epoch = GetFreshEpoch();
+        std::vector<txiter> stack(1, descendant);
+        visited(descendant);
+        while (!stack.empty()) {
+            txiter it = stack.back();
+            stack.pop_back();
+            for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+                const bool parent_removed = is_removed(parent);
+                if (!parent_removed && !std::binary_search(staying.begin(), staying.end(), &parent)) continue;
+                txiter parent_it = mapTx.iterator_to(parent);
+                if (visited(parent_it)) continue;
+                stack.push_back(parent_it);
+                if (parent_removed) {
+                    modifySize += parent.GetTxSize();
+                    modifyFee += parent.GetModifiedFee();
+                    ++modifyCount;
+                    modifySigOps += parent.GetSigOpCost();
+                }
+            }
+        }
+        mapTx.modify(descendant, update_ancestor_state(-modifySize, -modifyFee, -modifyCount, -modifySigOps));
+    }
+
+    // Sever the links between the removed entries and those that stay
+    for (txiter it : entries) {
+        for (const CTxMemPoolEntry& child : it->GetMemPoolChildrenConst()) {
+            if (!is_removed(child)) UpdateParent(mapTx.iterator_to(child), it, false);
+        }
+        for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+            if (!is_removed(parent)) UpdateChild(mapTx.iterator_to(parent), it, false);
+        }
+    }
+    for (txiter it : entries) {
+        removeUnchecked(it, MemPoolRemovalReason::BLOCK);
+    }
+}
+
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
     AssertLockHeld(cs);
     UpdateForRemoveFromMempool(stage, updateDescendants);
@@ -971,23 +1243,27 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, bool validFeeEstimat
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
     AssertLockHeld(cs);
-    CTxMemPoolEntry::Children s;
-    if (add && entry->GetMemPoolChildren().insert(*child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && entry->GetMemPoolChildren().erase(*child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Children& children = entry->GetMemPoolChildren();
+    cachedInnerUsage -= children.DynamicMemoryUsage();
+    if (add) {
+        children.insert(*child, m_links_resource);
+    } else {
+        children.erase(*child);
     }
+    cachedInnerUsage += children.DynamicMemoryUsage();
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
     AssertLockHeld(cs);
-    CTxMemPoolEntry::Parents s;
-    if (add && entry->GetMemPoolParents().insert(*parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && entry->GetMemPoolParents().erase(*parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Parents& parents = entry->GetMemPoolParents();
+    cachedInnerUsage -= parents.DynamicMemoryUsage();
+    if (add) {
+        parents.insert(*parent, m_links_resource);
+    } else {
+        parents.erase(*parent);
     }
+    cachedInnerUsage += parents.DynamicMemoryUsage();
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
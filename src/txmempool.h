@@ -10,6 +10,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -20,6 +21,8 @@
 #include <optional.h>
 #include <policy/feerate.h>
 #include <primitives/transaction.h>
+#include <span.h>
+#include <support/allocators/pool.h>
 #include <sync.h>
 #include <random.h>
 
@@ -29,10 +32,15 @@
 #include <boost/multi_index/sequenced_index.hpp>
 
 class CBlockIndex;
+class CTxMemPoolEntry;
 extern RecursiveMutex cs_main;
 
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Largest arrays of mempool entry links allocated from the pool resource of the mempool (32 links) */
+static const size_t MEMPOOL_LINKS_MAX_BLOCK_BYTES = 264;
+/** Maximum number of transaction additions logged for extending block templates */
+static const size_t MAX_TEMPLATE_ADDED_TXIDS = 100000;
 
 struct LockPoints
 {
@@ -63,6 +71,65 @@ struct CompareIteratorByHash {
         return a->GetTx().GetHash() < b->GetTx().GetHash();
     }
 };
+
+using MemPoolLinksResource = PoolResource<MEMPOOL_LINKS_MAX_BLOCK_BYTES, alignof(void*)>;
+
+/**
+ * The in-mempool parents or children of a mempool entry, as an array of
+ * references sorted by txid. Up to INLINE_LINKS of them are stored in place,
+ * which is enough for most transactions. Larger arrays are allocated from the
+ * pool resource of the mempool, and are moved back in place when they shrink.
+ */
+class MemPoolLinks
+{
+public:
+    typedef std::reference_wrapper<const CTxMemPoolEntry> value_type;
+    typedef const value_type* const_iterator;
+    static constexpr uint32_t INLINE_LINKS = 2;
+
+    MemPoolLinks() noexcept {}
+    MemPoolLinks(const MemPoolLinks& other);
+    MemPoolLinks& operator=(const MemPoolLinks& other);
+    ~MemPoolLinks() { Free(); }
+
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + m_size; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t count(const CTxMemPoolEntry& entry) const;
+
+    /** Add a link, allocating from resource if needed. Returns false if it was present already. */
+    bool insert(const CTxMemPoolEntry& entry, MemPoolLinksResource& resource);
+    /** Remove a link. Returns false if it was not present. */
+    bool erase(const CTxMemPoolEntry& entry);
+
+    /** Memory used outside of the pool resource (for arrays too large for it) */
+    size_t DynamicMemoryUsage() const;
+
+private:
+    /** Header of an array allocated from a resource, followed by the links */
+    struct Block {
+        MemPoolLinksResource* resource;
+    };
+    static_assert(sizeof(Block) % alignof(value_type) == 0, "Links following a block header must be aligned");
+    static_assert(std::is_trivially_copyable<value_type>::value, "Links are moved with memmove");
+
+    uint32_t m_size{0};
+    uint32_t m_capacity{INLINE_LINKS};
+    union {
+        alignas(value_type) unsigned char m_inline[INLINE_LINKS * sizeof(value_type)];
+        Block* m_block;
+    };
+
+    bool IsInline() const { return m_capacity == INLINE_LINKS; }
+    static size_t BlockBytes(uint32_t capacity) { return sizeof(Block) + capacity * sizeof(value_type); }
+    value_type* data() { return IsInline() ? reinterpret_cast<value_type*>(m_inline) : reinterpret_cast<value_type*>(m_block + 1); }
+    const value_type* data() const { return IsInline() ? reinterpret_cast<const value_type*>(m_inline) : reinterpret_cast<const value_type*>(m_block + 1); }
+    /** Move the links into an array of the given capacity */
+    void Reallocate(uint32_t capacity, MemPoolLinksResource* resource);
+    void Free();
+};
+
 /** \class CTxMemPoolEntry
  *
  * CTxMemPoolEntry stores data about the corresponding transaction, as well
@@ -80,8 +147,8 @@ class CTxMemPoolEntry
 public:
     typedef std::reference_wrapper<const CTxMemPoolEntry> CTxMemPoolEntryRef;
     // two aliases, should the types ever diverge
-    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> Parents;
-    typedef std::set<CTxMemPoolEntryRef, CompareIteratorByHash> Children;
+    typedef MemPoolLinks Parents;
+    typedef MemPoolLinks Children;
 
 private:
     const CTransactionRef tx;
@@ -501,6 +568,10 @@ private:
     mutable uint64_t m_epoch{0};
     mutable bool m_has_epoch_guard{false};
 
+    //! Memory for the parent and child links of entries that do not fit in
+    //! place, declared before mapTx so that it outlives the entries
+    MemPoolLinksResource m_links_resource;
+
     // In-memory counter for external mempool tracking purposes.
     // This number is incremented once every time a transaction
     // is added or removed from the mempool for any reason.
@@ -510,6 +581,25 @@ private:
 
     bool m_is_loaded GUARDED_BY(cs){false};
 
+public:
+    /** A point in the history of the mempool, see GetAddedSince() */
+    struct AddedCursor {
+        uint64_t generation{0};
+        size_t position{0};
+    };
+
+private:
+    //! Transactions added since m_added_generation was last incremented. It is
+    //! bounded by MAX_TEMPLATE_ADDED_TXIDS rather than counted in
+    //! DynamicMemoryUsage(), as evicting transactions doesn't shrink it.
+    std::vector<uint256> m_added_txids GUARDED_BY(cs);
+    //! Incremented when the log of added transactions is restarted, which
+    //! happens on changes to entries already in the mempool: block connection,
+    //! reorgs and fee deltas
+    uint64_t m_added_generation GUARDED_BY(cs){0};
+
+    void RestartAddedTxids() EXCLUSIVE_LOCKS_REQUIRED(cs);
+
 public:
 
     static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
@@ -630,7 +720,6 @@ public:
 
     void removeRecursive(const CTransaction& tx, MemPoolRemovalReason reason) EXCLUSIVE_LOCKS_REQUIRED(cs);
     void removeForReorg(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight, int flags) EXCLUSIVE_LOCKS_REQUIRED(cs, cs_main);
-    void removeConflicts(const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs);
     void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
     void clear();
@@ -689,6 +778,8 @@ public:
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
      *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *  Uses an epoch for the traversal, so it must not be called while an
+     *  EpochGuard is held.
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -757,6 +848,12 @@ public:
     TxMempoolInfo info(const uint256& hash) const;
     TxMempoolInfo info(const GenTxid& gtxid) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /**
+     * Look up a batch of transactions to announce under a single lock. Returns
+     * the ones still in the mempool, parents before their children and higher
+     * fee rates first, like infoAll().
+     */
+    std::vector<TxMempoolInfo> infoForRelay(const std::vector<uint256>& hashes, bool wtxid) const;
 
     size_t DynamicMemoryUsage() const;
 
@@ -795,6 +892,20 @@ public:
         return m_sequence_number;
     }
 
+    /** Return a cursor to the current state of the mempool */
+    AddedCursor GetAddedCursor() const EXCLUSIVE_LOCKS_REQUIRED(cs) {
+        return {m_added_generation, m_added_txids.size()};
+    }
+
+    /**
+     * Return the txids of the transactions added to the mempool since cursor
+     * was obtained, in order, or nullopt if entries already in the mempool may
+     * have changed since (for a block, a reorg or a fee delta). Transactions may
+     * have been removed again since they were added. Other removals do not
+     * change the entries left in the mempool.
+     */
+    Optional<Span<const uint256>> GetAddedSince(const AddedCursor& cursor) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
 private:
     /** UpdateForDescendants is used by UpdateTransactionsFromBlock to update
      *  the descendants for a single transaction that has been added to the
@@ -820,6 +931,10 @@ private:
       * If updateDescendants is true, then also update in-mempool descendants'
       * ancestor state. */
     void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Remove the given entries, confirmed by a block, from the mempool at once.
+      * Only the descendants and ancestors that stay in the mempool have their
+      * state updated, and only the links to them are severed. */
+    void RemoveConfirmed(const std::vector<txiter>& entries) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -897,12 +1012,20 @@ public:
  */
 class CCoinsViewMemPool : public CCoinsViewBacked
 {
+    /**
+     * Coins created by the transactions of a package being validated. Later
+     * transactions of the package spend them before any of the package is in
+     * the mempool.
+     */
+    std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> m_temp_added;
 protected:
     const CTxMemPool& mempool;
 
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    /** Add the coins created by this transaction, as if it was in the mempool. */
+    void PackageAddTransaction(const CTransactionRef& tx);
 };
 
 /**
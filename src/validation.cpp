@@ -20,7 +20,9 @@
 #include <index/txindex.h>
 #include <logging.h>
 #include <logging/timer.h>
+#include <node/coinstats.h>
 #include <node/ui_interface.h>
+#include <node/utxo_snapshot.h>
 #include <optional.h>
 #include <policy/policy.h>
 #include <policy/settings.h>
@@ -48,7 +50,10 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 
@@ -132,6 +137,9 @@ Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 bool g_parallel_script_checks{false};
+bool g_parallel_coins_prefetch{false};
+bool g_partial_coins_flush{DEFAULT_PARTIAL_COINS_FLUSH};
+bool g_background_coins_flush{DEFAULT_BACKGROUND_COINS_FLUSH};
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
@@ -250,7 +258,7 @@ bool TestLockPointValidity(const LockPoints* lp)
     return true;
 }
 
-bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flags, LockPoints* lp, bool useExistingLockPoints)
+bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flags, LockPoints* lp, bool useExistingLockPoints, const CCoinsView* coins_view)
 {
     AssertLockHeld(cs_main);
     AssertLockHeld(pool.cs);
@@ -277,12 +285,13 @@ bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flag
     else {
         // CoinsTip() contains the UTXO set for ::ChainActive().Tip()
         CCoinsViewMemPool viewMemPool(&::ChainstateActive().CoinsTip(), pool);
+        const CCoinsView& view = coins_view ? *coins_view : viewMemPool;
         std::vector<int> prevheights;
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
             Coin coin;
-            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
+            if (!view.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
             if (coin.nHeight == MEMPOOL_HEIGHT) {
@@ -475,6 +484,13 @@ public:
     // Single transaction acceptance
     bool AcceptSingleTransaction(const CTransactionRef& ptx, ATMPArgs& args) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    // Package acceptance, of all transactions or none
+    bool AcceptMultipleTransactions(const std::vector<CTransactionRef>& txns, ATMPArgs& args, std::vector<TxValidationState>& tx_states, std::vector<CAmount>* fees_out) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    // Run the policy checks on a transaction and collect the checks of its
+    // input scripts, to be run later without holding any lock.
+    bool PrecheckScripts(const CTransactionRef& ptx, ATMPArgs& args, PrecomputedTransactionData& txdata, std::vector<CScriptCheck>& checks) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 private:
     // All the intermediate state that gets passed between the various levels
     // of checking a given transaction.
@@ -515,6 +531,10 @@ private:
     // limiting is performed, false otherwise.
     bool Finalize(ATMPArgs& args, Workspace& ws) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_pool.cs);
 
+    // Check the ancestor and descendant limits as if all transactions of a
+    // package were in the mempool.
+    bool CheckPackageLimits(const std::vector<Workspace>& workspaces, TxValidationState& state) EXCLUSIVE_LOCKS_REQUIRED(m_pool.cs);
+
     // Compare a package's feerate against minimum allowed.
     bool CheckFeeRate(size_t package_size, CAmount package_fee, TxValidationState& state)
     {
@@ -671,9 +691,9 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
     // Only accept BIP68 sequence locked transactions that can be mined in the next
     // block; we don't want our mempool filled up with transactions that can't
     // be mined yet.
-    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-    // CoinsViewCache instead of create its own
-    if (!CheckSequenceLocks(m_pool, tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+    // The inputs are looked up in m_view, which also has those created by
+    // earlier transactions of a package.
+    if (!CheckSequenceLocks(m_pool, tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp, /* useExistingLockPoints */ false, &m_view))
         return state.Invalid(TxValidationResult::TX_PREMATURE_SPEND, "non-BIP68-final");
 
     CAmount nFees = 0;
@@ -1053,8 +1073,262 @@ bool MemPoolAccept::AcceptSingleTransaction(const CTransactionRef& ptx, ATMPArgs
     return true;
 }
 
+bool MemPoolAccept::CheckPackageLimits(const std::vector<Workspace>& workspaces, TxValidationState& state)
+{
+    AssertLockHeld(m_pool.cs);
+    // Transactions only spend earlier ones of the package, so the ancestors of
+    // each are known when it is reached. The workspaces only hold the
+    // transactions not in the mempool yet; the others are mempool ancestors.
+    std::map<uint256, size_t> positions;
+    std::vector<CTxMemPool::setEntries> mempool_ancestors(workspaces.size());
+    std::vector<std::set<size_t>> package_ancestors(workspaces.size());
+    std::map<CTxMemPool::txiter, std::pair<uint64_t, uint64_t>, CompareIteratorByHash> mempool_added;
+    std::vector<std::pair<uint64_t, uint64_t>> package_added(workspaces.size());
+    for (size_t i = 0; i < workspaces.size(); ++i) {
+        const CTransaction& tx = *workspaces[i].m_ptx;
+        const uint64_t size = workspaces[i].m_entry->GetTxSize();
+        mempool_ancestors[i] = workspaces[i].m_ancestors;
+        for (const CTxIn& txin : tx.vin) {
+            auto it = positions.find(txin.prevout.hash);
+            if (it == positions.end()) continue;
+            const size_t parent = it->second;
+            package_ancestors[i].insert(parent);
+            package_ancestors[i].insert(package_ancestors[parent].begin(), package_ancestors[parent].end());
+            mempool_ancestors[i].insert(mempool_ancestors[parent].begin(), mempool_ancestors[parent].end());
+        }
+        positions.emplace(tx.GetHash(), i);
+
+        uint64_t size_with_ancestors = size;
+        for (CTxMemPool::txiter ancestor : mempool_ancestors[i]) {
+            size_with_ancestors += ancestor->GetTxSize();
+        }
+        for (size_t ancestor : package_ancestors[i]) {
+            size_with_ancestors += workspaces[ancestor].m_entry->GetTxSize();
+        }
+        if (mempool_ancestors[i].size() + package_ancestors[i].size() + 1 > m_limit_ancestors) {
+            return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-long-mempool-chain",
+                                 strprintf("too many unconfirmed ancestors [limit: %u]", m_limit_ancestors));
+        } else if (size_with_ancestors > m_limit_ancestor_size) {
+            return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-long-mempool-chain",
+                                 strprintf("exceeds ancestor size limit [limit: %u]", m_limit_ancestor_size));
+        }
+
+        for (CTxMemPool::txiter ancestor : mempool_ancestors[i]) {
+            auto& added = mempool_added[ancestor];
+            added.first += 1;
+            added.second += size;
+            if (ancestor->GetCountWithDescendants() + added.first > m_limit_descendants) {
+                return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-long-mempool-chain",
+                                     strprintf("too many descendants for tx %s [limit: %u]", ancestor->GetTx().GetHash().ToString(), m_limit_descendants));
+            } else if (ancestor->GetSizeWithDescendants() + added.second > m_limit_descendant_size) {
+                return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-long-mempool-chain",
+                                     strprintf("exceeds descendant size limit for tx %s [limit: %u]", ancestor->GetTx().GetHash().ToString(), m_limit_descendant_size));
+            }
+        }
+        for (size_t ancestor : package_ancestors[i]) {
+            auto& added = package_added[ancestor];
+            added.first += 1;
+            added.second += size;
+            if (1 + added.first > m_limit_descendants) {
+                return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-long-mempool-chain",
+                                     strprintf("too many descendants for tx %s [limit: %u]", workspaces[ancestor].m_hash.ToString(), m_limit_descendants));
+            } else if (workspaces[ancestor].m_entry->GetTxSize() + added.second > m_limit_descendant_size) {
+                return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "too-long-mempool-chain",
+                                     strprintf("exceeds descendant size limit for tx %s [limit: %u]", workspaces[ancestor].m_hash.ToString(), m_limit_descendant_size));
+            }
+        }
+    }
+    return true;
+}
+
+// Check the rules of a package that do not depend on the chain or the mempool.
+bool CheckPackage(const std::vector<CTransactionRef>& txns, TxValidationState& state)
+{
+    if (txns.size() > MAX_PACKAGE_COUNT) {
+        return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "package-too-many-transactions");
+    }
+    int64_t total_size = 0;
+    for (const CTransactionRef& tx : txns) {
+        total_size += GetVirtualTransactionSize(*tx);
+    }
+    if (total_size > MAX_PACKAGE_SIZE * 1000) {
+        return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "package-too-large");
+    }
+
+    // The transactions not reached yet, which earlier ones may not spend
+    std::unordered_set<uint256, SaltedTxidHasher> later_txids;
+    for (const CTransactionRef& tx : txns) {
+        if (!later_txids.insert(tx->GetHash()).second) {
+            return state.Invalid(TxValidationResult::TX_CONFLICT, "package-contains-duplicates");
+        }
+    }
+    std::unordered_set<COutPoint, SaltedOutpointHasher> inputs;
+    for (const CTransactionRef& tx : txns) {
+        later_txids.erase(tx->GetHash());
+        for (const CTxIn& txin : tx->vin) {
+            if (later_txids.count(txin.prevout.hash)) {
+                return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "package-not-sorted");
+            }
+            if (!inputs.insert(txin.prevout).second) {
+                return state.Invalid(TxValidationResult::TX_CONSENSUS, "conflict-in-package");
+            }
+        }
+    }
+    return true;
+}
+
+bool MemPoolAccept::AcceptMultipleTransactions(const std::vector<CTransactionRef>& txns, ATMPArgs& args, std::vector<TxValidationState>& tx_states, std::vector<CAmount>* fees_out)
+{
+    AssertLockHeld(cs_main);
+    TxValidationState& state = args.m_state;
+    tx_states.clear();
+    tx_states.reserve(txns.size());
+
+    if (!CheckPackage(txns, state)) return false;
+
+    LOCK(m_pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
+
+    // The package is invalid if one of its transactions is, for the same reason.
+    const auto tx_invalid = [&]() {
+        state = tx_states.back();
+        return false;
+    };
+
+    std::vector<Workspace> workspaces;
+    workspaces.reserve(txns.size());
+    std::vector<PrecomputedTransactionData> txdata(txns.size());
+    std::vector<CAmount> fees(txns.size());
+    const unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(::ChainActive().Tip(), args.m_chainparams.GetConsensus());
+    std::set<uint256> package_txids;
+    for (size_t i = 0; i < txns.size(); ++i) {
+        tx_states.emplace_back();
+        // A transaction already in the mempool, such as a parent broadcast
+        // before its child, is not added again. The transactions spending it
+        // count it among their mempool ancestors.
+        if (auto it = m_pool.GetIter(txns[i]->GetHash())) {
+            fees[i] = (*it)->GetFee();
+            continue;
+        }
+        ATMPArgs tx_args{args.m_chainparams, tx_states.back(), args.m_accept_time, args.m_replaced_transactions,
+                         args.m_bypass_limits, args.m_coins_to_uncache, args.m_test_accept, &fees[i]};
+        workspaces.emplace_back(txns[i]);
+        Workspace& ws = workspaces.back();
+
+        if (!PreChecks(tx_args, ws)) return tx_invalid();
+        if (!ws.m_conflicts.empty()) {
+            tx_states.back().Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "package-txn-mempool-conflict");
+            return tx_invalid();
+        }
+
+        if (!PolicyScriptChecks(tx_args, ws, txdata[i])) return tx_invalid();
+
+        // ConsensusScriptChecks() looks up the coins spent in the mempool and
+        // the UTXO set, where those created by the package are not yet.
+        const bool spends_package = std::any_of(ws.m_ptx->vin.begin(), ws.m_ptx->vin.end(),
+                                                [&](const CTxIn& txin) { return package_txids.count(txin.prevout.hash); });
+        if (spends_package) {
+            if (!CheckInputScripts(*ws.m_ptx, tx_states.back(), m_view, currentBlockScriptVerifyFlags, true, true, txdata[i])) {
+                error("%s: BUG! PLEASE REPORT THIS! CheckInputScripts failed against latest-block but not STANDARD flags %s, %s",
+                      __func__, ws.m_hash.ToString(), tx_states.back().ToString());
+                return tx_invalid();
+            }
+        } else if (!ConsensusScriptChecks(tx_args, ws, txdata[i])) {
+            return tx_invalid();
+        }
+
+        m_viewmempool.PackageAddTransaction(ws.m_ptx);
+        package_txids.insert(ws.m_hash);
+    }
+
+    if (!CheckPackageLimits(workspaces, state)) return false;
+
+    if (fees_out) *fees_out = fees;
+
+    // Package was accepted, but not added
+    if (args.m_test_accept) return true;
+
+    // Add the transactions in order, so that each one finds its parents in the
+    // package in the mempool.
+    const uint64_t no_limit = std::numeric_limits<uint64_t>::max();
+    for (Workspace& ws : workspaces) {
+        CTxMemPool::setEntries ancestors;
+        std::string dummy;
+        m_pool.CalculateMemPoolAncestors(*ws.m_entry, ancestors, no_limit, no_limit, no_limit, no_limit, dummy);
+        const bool validForFeeEstimation = !args.m_bypass_limits && IsCurrentForFeeEstimation() && m_pool.HasNoInputsOf(*ws.m_ptx);
+        m_pool.addUnchecked(*ws.m_entry, ancestors, validForFeeEstimation);
+    }
+
+    // If trimming the mempool evicted part of the package, remove the rest too.
+    if (!args.m_bypass_limits) {
+        LimitMempoolSize(m_pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, std::chrono::hours{gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY)});
+        CTxMemPool::setEntries remaining;
+        for (const Workspace& ws : workspaces) {
+            if (auto it = m_pool.GetIter(ws.m_hash)) remaining.insert(*it);
+        }
+        if (remaining.size() < workspaces.size()) {
+            m_pool.RemoveStaged(remaining, false, MemPoolRemovalReason::SIZELIMIT);
+            return state.Invalid(TxValidationResult::TX_MEMPOOL_POLICY, "mempool full");
+        }
+    }
+
+    for (const Workspace& ws : workspaces) {
+        GetMainSignals().TransactionAddedToMempool(ws.m_ptx, m_pool.GetAndIncrementSequence());
+    }
+    return true;
+}
+
+bool MemPoolAccept::PrecheckScripts(const CTransactionRef& ptx, ATMPArgs& args, PrecomputedTransactionData& txdata, std::vector<CScriptCheck>& checks)
+{
+    AssertLockHeld(cs_main);
+    LOCK(m_pool.cs);
+
+    Workspace workspace(ptx);
+
+    if (!PreChecks(args, workspace)) return false;
+
+    // The checks copy the outputs they spend, so they do not refer to m_view.
+    return CheckInputScripts(*ptx, args.m_state, m_view, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata, &checks);
+}
+
 } // anon namespace
 
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, TxValidationState& state, std::vector<TxValidationState>& tx_states,
+                               const std::vector<CTransactionRef>& package, bool test_accept, std::vector<CAmount>* fees_out)
+{
+    AssertLockHeld(cs_main);
+    const CChainParams& chainparams = Params();
+    std::vector<COutPoint> coins_to_uncache;
+    MemPoolAccept::ATMPArgs args { chainparams, state, GetTime(), /* m_replaced_transactions */ nullptr, /* m_bypass_limits */ false, coins_to_uncache, test_accept, /* m_fee_out */ nullptr };
+    const bool res = MemPoolAccept(pool).AcceptMultipleTransactions(package, args, tx_states, fees_out);
+    if (!res) {
+        // As in AcceptToMemoryPoolWithTime(), do not keep the coins looked up
+        // for a rejected package in the coins cache.
+        for (const COutPoint& outpoint : coins_to_uncache) {
+            ::ChainstateActive().CoinsTip().Uncache(outpoint);
+        }
+    }
+    BlockValidationState state_dummy;
+    ::ChainstateActive().FlushStateToDisk(chainparams, state_dummy, FlushStateMode::PERIODIC);
+    return res;
+}
+
+bool PrepareTransactionScriptChecks(CTxMemPool& pool, const CTransactionRef& tx, TransactionScriptChecks& prepared)
+{
+    AssertLockHeld(cs_main);
+    TxValidationState state;
+    MemPoolAccept::ATMPArgs args { Params(), state, GetTime(), /* m_replaced_transactions */ nullptr, /* m_bypass_limits */ false, prepared.coins_to_uncache, /* m_test_accept */ true, /* m_fee_out */ nullptr };
+    return MemPoolAccept(pool).PrecheckScripts(tx, args, prepared.txdata, prepared.checks);
+}
+
+bool RunTransactionScriptChecks(TransactionScriptChecks& prepared)
+{
+    AssertLockNotHeld(cs_main);
+    for (CScriptCheck& check : prepared.checks) {
+        if (!check()) return false;
+    }
+    return true;
+}
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, TxValidationState &state, const CTransactionRef &tx,
                         int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
@@ -1184,13 +1458,14 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
+FILE* OpenRawBlockFile(const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start, unsigned int& block_size)
 {
     FlatFilePos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
     CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull()) {
-        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        return nullptr;
     }
 
     try {
@@ -1200,16 +1475,36 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, c
         filein >> blk_start >> blk_size;
 
         if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
-            return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+            error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
                     HexStr(blk_start),
                     HexStr(message_start));
+            return nullptr;
         }
 
         if (blk_size > MAX_SIZE) {
-            return error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
+            error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
                     blk_size, MAX_SIZE);
+            return nullptr;
         }
 
+        block_size = blk_size;
+    } catch(const std::exception& e) {
+        error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+        return nullptr;
+    }
+
+    return filein.release();
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
+{
+    unsigned int blk_size;
+    CAutoFile filein(OpenRawBlockFile(pos, message_start, blk_size), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return false;
+    }
+
+    try {
         block.resize(blk_size); // Zeroing of memory is intentional here
         filein.read((char*)block.data(), blk_size);
     } catch(const std::exception& e) {
@@ -1249,11 +1544,12 @@ CoinsViews::CoinsViews(
     bool in_memory,
     bool should_wipe) : m_dbview(
                             GetDataDir() / ldb_name, cache_size_bytes, in_memory, should_wipe),
-                        m_catcherview(&m_dbview) {}
+                        m_catcherview(&m_dbview),
+                        m_flushingview(&m_catcherview) {}
 
 void CoinsViews::InitCache()
 {
-    m_cacheview = MakeUnique<CCoinsViewCache>(&m_catcherview);
+    m_cacheview = MakeUnique<CCoinsViewCache>(&m_flushingview);
 }
 
 CChainState::CChainState(CTxMemPool& mempool, BlockManager& blockman, uint256 from_snapshot_blockhash)
@@ -1763,6 +2059,96 @@ void ThreadScriptCheck(int worker_num) {
     scriptcheckqueue.Thread();
 }
 
+namespace {
+
+/** The result of looking up one block input in the coins database. */
+struct PrefetchedCoin {
+    COutPoint outpoint;
+    Coin coin;
+    bool found{false};
+};
+
+/**
+ * Closure representing one coin lookup done by the coins prefetch threads.
+ * Each lookup writes to its own PrefetchedCoin slot, owned by the caller.
+ */
+class CCoinsPrefetchCheck
+{
+private:
+    const CCoinsView* m_view{nullptr};
+    PrefetchedCoin* m_slot{nullptr};
+
+public:
+    CCoinsPrefetchCheck() = default;
+    CCoinsPrefetchCheck(const CCoinsView& view, PrefetchedCoin& slot) : m_view(&view), m_slot(&slot) {}
+
+    bool operator()()
+    {
+        m_slot->found = m_view->GetCoin(m_slot->outpoint, m_slot->coin);
+        return true;
+    }
+
+    void swap(CCoinsPrefetchCheck& check)
+    {
+        std::swap(m_view, check.m_view);
+        std::swap(m_slot, check.m_slot);
+    }
+};
+
+} // namespace
+
+static CCheckQueue<CCoinsPrefetchCheck> coinsprefetchqueue(32);
+
+void ThreadCoinsPrefetch(int worker_num) {
+    util::ThreadRename(strprintf("prefetch.%i", worker_num));
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Look up the inputs spent by a block in `base` across the coins prefetch
+ * threads, and add the coins found to `cache`. ConnectBlock() then finds them
+ * in memory instead of hitting the database one input at a time.
+ *
+ * cs_main must be held for the whole call, so that `base` is not written to
+ * while lookups are in flight.
+ */
+static void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsView& base) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    if (!g_parallel_coins_prefetch) return;
+
+    // Outputs created within the block can't be in the database yet.
+    std::unordered_set<uint256, SaltedTxidHasher> block_txids;
+    block_txids.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx) {
+        block_txids.insert(tx->GetHash());
+    }
+
+    std::vector<PrefetchedCoin> slots;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (block_txids.count(txin.prevout.hash) || cache.HaveCoinInCache(txin.prevout)) continue;
+            slots.emplace_back();
+            slots.back().outpoint = txin.prevout;
+        }
+    }
+    if (slots.empty()) return;
+
+    std::vector<CCoinsPrefetchCheck> checks;
+    checks.reserve(slots.size());
+    for (PrefetchedCoin& slot : slots) {
+        checks.emplace_back(base, slot);
+    }
+    CCheckQueueControl<CCoinsPrefetchCheck> control(&coinsprefetchqueue);
+    control.Add(checks);
+    control.Wait();
+
+    for (PrefetchedCoin& slot : slots) {
+        if (slot.found) cache.EmplacePrefetchedCoin(slot.outpoint, std::move(slot.coin));
+    }
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -2197,8 +2583,14 @@ CoinsCacheSizeState CChainState::GetCoinsCacheSizeState(
     size_t max_coins_cache_size_bytes,
     size_t max_mempool_size_bytes)
 {
+    //! Upper bound of the coins a block adds to the cache, as each of its
+    //! outputs and inputs takes at least 9 bytes of non-witness data.
+    static constexpr size_t MAX_BLOCK_COINS = MAX_BLOCK_WEIGHT / WITNESS_SCALE_FACTOR / 9;
+
     const int64_t nMempoolUsage = tx_pool ? tx_pool->DynamicMemoryUsage() : 0;
-    int64_t cacheSize = CoinsTip().DynamicMemoryUsage();
+    // If the table of the cache has to grow for the next block, count the
+    // memory it reaches while the old and the new table are both allocated.
+    int64_t cacheSize = CoinsTip().PeakMemoryUsage(MAX_BLOCK_COINS);
     int64_t nTotalSpace =
         max_coins_cache_size_bytes + std::max<int64_t>(max_mempool_size_bytes - nMempoolUsage, 0);
 
@@ -2233,6 +2625,10 @@ bool CChainState::FlushStateToDisk(
     const size_t coins_mem_usage = CoinsTip().DynamicMemoryUsage();
 
     try {
+    // Release the coins of a background flush that completed in the meantime.
+    if (!FinishBackgroundFlush(/* wait */ false)) {
+        return AbortNode(state, "Failed to write to coin database");
+    }
     {
         bool fFlushForPrune = false;
         bool fDoFullFlush = false;
@@ -2275,6 +2671,12 @@ bool CChainState::FlushStateToDisk(
         bool fPeriodicFlush = mode == FlushStateMode::PERIODIC && nNow > nLastFlush + DATABASE_FLUSH_INTERVAL;
         // Combine all conditions that result in a full cache flush.
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+        // Only the cache size calls for a flush, so the coins still in use may stay cached.
+        const bool fPartialFlush = g_partial_coins_flush && (fCacheLarge || fCacheCritical) && !fPeriodicFlush && !fFlushForPrune;
+        // Nobody waits for the coins to be on disk, so they may be written in the background.
+        // Pruning is excluded, as the pruned block files could be needed to replay the
+        // blocks being written if the write is interrupted.
+        const bool fBackgroundFlush = g_background_coins_flush && (fCacheLarge || fCacheCritical || fPeriodicFlush) && !fFlushForPrune;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
             // Depend on nMinDiskSpace to ensure we can write block index
@@ -2310,6 +2712,12 @@ bool CChainState::FlushStateToDisk(
             }
             // Finally remove any pruned files
             if (fFlushForPrune) {
+                // The pruned files could be needed to replay the blocks of a
+                // background coins write if it is interrupted, so it must be
+                // complete first.
+                if (!FinishBackgroundFlush()) {
+                    return AbortNode(state, "Failed to write to coin database");
+                }
                 LOG_TIME_MILLIS_WITH_CATEGORY("unlink pruned files", BCLog::BENCH);
 
                 UnlinkPrunedFiles(setFilesToPrune);
@@ -2329,9 +2737,19 @@ bool CChainState::FlushStateToDisk(
             if (!CheckDiskSpace(GetDataDir(), 48 * 2 * 2 * CoinsTip().GetCacheSize())) {
                 return AbortNode(state, "Disk space is too low!", _("Disk space is too low!"));
             }
+            // Writes to the coins database must not overlap.
+            if (!FinishBackgroundFlush()) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
             // Flush the chainstate (which may refer to block index entries).
-            if (!CoinsTip().Flush())
+            if (fPartialFlush) {
+                if (!CoinsTip().Sync(m_coinstip_cache_size_bytes / 100 * PARTIAL_FLUSH_TARGET_PERCENT))
+                    return AbortNode(state, "Failed to write to coin database");
+            } else if (fBackgroundFlush) {
+                StartBackgroundFlush();
+            } else if (!CoinsTip().Flush()) {
                 return AbortNode(state, "Failed to write to coin database");
+            }
             nLastFlush = nNow;
             full_flush_completed = true;
         }
@@ -2478,6 +2896,7 @@ bool CChainState::DisconnectTip(BlockValidationState& state, const CChainParams&
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2551,6 +2970,9 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    PrefetchBlockInputs(blockConnecting, CoinsTip(), m_coins_views->m_flushingview);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTimePrefetched - nTime2) * MILLI, nTimePrefetch * MICRO);
     {
         CCoinsViewCache view(&CoinsTip());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2573,12 +2995,23 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime5 - nTime4) * MILLI, nTimeChainState * MICRO, nTimeChainState * MILLI / nBlocksTotal);
+    // A chainstate validating a UTXO snapshot in the background is behind the
+    // active chain, so it leaves the mempool and the best block alone.
+    const bool is_background = g_chainman.IsBackgroundIBD(this);
     // Remove conflicting transactions from the mempool.;
-    m_mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
+    if (!is_background) {
+        m_mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
+    }
     disconnectpool.removeForBlock(blockConnecting.vtx);
     // Update m_chain & related variables.
     m_chain.SetTip(pindexNew);
-    UpdateTip(m_mempool, pindexNew, chainparams);
+    if (!is_background) {
+        UpdateTip(m_mempool, pindexNew, chainparams);
+    } else {
+        LogPrintf("[snapshot] background validation: new best=%s height=%d tx=%lu date='%s'\n",
+            pindexNew->GetBlockHash().ToString(), pindexNew->nHeight, (unsigned long)pindexNew->nChainTx,
+            FormatISO8601DateTime(pindexNew->GetBlockTime()));
+    }
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
@@ -2588,6 +3021,79 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
     return true;
 }
 
+void CChainState::ReadAheadBlock(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    if (pindex == m_read_ahead_index) return;
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA)) return;
+
+    // Capture what is needed while holding cs_main; the read itself must not
+    // touch the block index.
+    const FlatFilePos pos = pindex->GetBlockPos();
+    const uint256 hash = pindex->GetBlockHash();
+    const Consensus::Params& consensus_params = chainparams.GetConsensus();
+    m_read_ahead_index = pindex;
+    m_read_ahead_block = std::async(std::launch::async, [pos, hash, &consensus_params]() -> std::shared_ptr<const CBlock> {
+        std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*block, pos, consensus_params) || block->GetHash() != hash) {
+            return nullptr;
+        }
+        // On success this caches the result in block->fChecked, so that the
+        // same checks are skipped by ConnectBlock(). On failure ConnectBlock()
+        // runs them again and reports the error.
+        BlockValidationState state;
+        CheckBlock(*block, state, consensus_params);
+        return block;
+    });
+}
+
+std::shared_ptr<const CBlock> CChainState::TakeReadAheadBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (m_read_ahead_index == nullptr) return nullptr;
+    // A block read ahead for another index (e.g. after a reorg) is discarded.
+    const bool match = m_read_ahead_index == pindex;
+    m_read_ahead_index = nullptr;
+    std::shared_ptr<const CBlock> block = m_read_ahead_block.get();
+    return match ? block : nullptr;
+}
+
+void CChainState::StartBackgroundFlush()
+{
+    AssertLockHeld(cs_main);
+    assert(!m_coins_views->m_background_flush.valid());
+    const uint256 best_block = CoinsTip().GetBestBlock();
+    std::shared_ptr<CCoinsMap> coins = CoinsTip().TakeCoins();
+    // CoinsTip() now reads the coins being written through m_flushingview.
+    // They are not modified until the write is finished, and nothing else
+    // writes to the database in the meantime. If the write is interrupted,
+    // the head blocks marker written by CCoinsViewDB::BatchWrite() makes
+    // ReplayBlocks() redo it on the next start.
+    m_coins_views->m_flushingview.SetFlushingCoins(coins, best_block);
+    CCoinsViewDB* db = &CoinsDB();
+    m_coins_views->m_background_flush = std::async(std::launch::async, [db, coins = std::move(coins), best_block] {
+        LOG_TIME_SECONDS(strprintf("write coins cache to disk in the background (%d coins)", coins->size()));
+        return db->BatchWrite(*coins, best_block, /* erase */ false);
+    });
+}
+
+bool CChainState::FinishBackgroundFlush(bool wait)
+{
+    AssertLockHeld(cs_main);
+    std::future<bool>& flush = m_coins_views->m_background_flush;
+    if (!flush.valid()) return true;
+    if (!wait && flush.wait_for(std::chrono::seconds::zero()) != std::future_status::ready) return true;
+    flush.wait();
+    // Also on failure, as nothing may be written through m_flushingview while the coins are set.
+    m_coins_views->m_flushingview.ClearFlushingCoins();
+    try {
+        return flush.get();
+    } catch (const std::runtime_error& e) {
+        LogPrintf("Error writing coins cache to disk in the background: %s\n", e.what());
+        return false;
+    }
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2710,7 +3216,16 @@ bool CChainState::ActivateBestChainStep(BlockValidationState& state, const CChai
 
         // Connect new blocks.
         for (CBlockIndex* pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            std::shared_ptr<const CBlock> pblockConnect = pindexConnect == pindexMostWork && pblock ? pblock : TakeReadAheadBlock(pindexConnect);
+            // Read and check the next block while this one is being connected,
+            // including while its script checks drain on the worker threads.
+            if (pindexConnect != pindexMostWork) {
+                const CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if (pindexNext != pindexMostWork || !pblock) {
+                    ReadAheadBlock(pindexNext, chainparams);
+                }
+            }
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (state.GetResult() != BlockValidationResult::BLOCK_MUTATED) {
@@ -2803,6 +3318,10 @@ bool CChainState::ActivateBestChain(BlockValidationState &state, const CChainPar
     CBlockIndex *pindexMostWork = nullptr;
     CBlockIndex *pindexNewTip = nullptr;
     int nStopAtHeight = gArgs.GetArg("-stopatheight", DEFAULT_STOPATHEIGHT);
+    // Blocks connected while validating a UTXO snapshot in the background
+    // are below the active tip, so they are not announced to the rest of
+    // the node.
+    const bool is_background = WITH_LOCK(::cs_main, return g_chainman.IsBackgroundIBD(this));
     do {
         // Block until the validation queue drains. This should largely
         // never happen in normal operation, however may happen during
@@ -2847,7 +3366,7 @@ bool CChainState::ActivateBestChain(BlockValidationState &state, const CChainPar
 
                 for (const PerBlockConnectTrace& trace : connectTrace.GetBlocksConnected()) {
                     assert(trace.pblock && trace.pindex);
-                    GetMainSignals().BlockConnected(trace.pblock, trace.pindex);
+                    if (!is_background) GetMainSignals().BlockConnected(trace.pblock, trace.pindex);
                 }
             } while (!m_chain.Tip() || (starting_tip && CBlockIndexWorkComparator()(m_chain.Tip(), starting_tip)));
             if (!blocks_connected) return true;
@@ -2857,7 +3376,7 @@ bool CChainState::ActivateBestChain(BlockValidationState &state, const CChainPar
 
             // Notify external listeners about the new tip.
             // Enqueue while holding cs_main to ensure that UpdatedBlockTip is called in the order in which blocks are connected
-            if (pindexFork != pindexNewTip) {
+            if (pindexFork != pindexNewTip && !is_background) {
                 // Notify ValidationInterface subscribers
                 GetMainSignals().UpdatedBlockTip(pindexNewTip, pindexFork, fInitialDownload);
 
@@ -2867,7 +3386,7 @@ bool CChainState::ActivateBestChain(BlockValidationState &state, const CChainPar
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
 
-        if (nStopAtHeight && pindexNewTip && pindexNewTip->nHeight >= nStopAtHeight) StartShutdown();
+        if (nStopAtHeight && pindexNewTip && pindexNewTip->nHeight >= nStopAtHeight && !is_background) StartShutdown();
 
         // We check shutdown only after giving ActivateBestChainStep a chance to run once so that we
         // never shutdown before connecting the genesis block during LoadChainTip(). Previously this
@@ -3100,17 +3619,21 @@ void ResetBlockFailureFlags(CBlockIndex *pindex) {
 }
 
 CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block)
+{
+    return AddToBlockIndex(block, block.GetHash());
+}
+
+CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     AssertLockHeld(cs_main);
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = m_block_index.find(hash);
     if (it != m_block_index.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = NewBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3139,7 +3662,9 @@ CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block)
 void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pindexNew, const FlatFilePos& pos, const Consensus::Params& consensusParams)
 {
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainTx = 0;
+    // The base of a UTXO snapshot keeps the nChainTx of the snapshot until
+    // the blocks below it are downloaded too, see ActivateSnapshot().
+    if (pindexNew != g_chainman.SnapshotBaseBlock()) pindexNew->nChainTx = 0;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
@@ -3167,6 +3692,7 @@ void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pi
             if (m_chain.Tip() == nullptr || !setBlockIndexCandidates.value_comp()(pindex, m_chain.Tip())) {
                 setBlockIndexCandidates.insert(pindex);
             }
+            g_chainman.AddBackgroundValidationCandidate(pindex);
             std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = m_blockman.m_blocks_unlinked.equal_range(pindex);
             while (range.first != range.second) {
                 std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
@@ -3543,10 +4069,14 @@ static bool ContextualCheckBlock(const CBlock& block, BlockValidationState& stat
 }
 
 bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    return AcceptBlockHeader(block, block.GetHash(), /* pow_checked */ false, state, chainparams, ppindex);
+}
+
+bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, bool pow_checked, BlockValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = m_block_index.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3562,7 +4092,7 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus())) {
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), /* fCheckPOW */ !pow_checked)) {
             LogPrint(BCLog::VALIDATION, "%s: Consensus::CheckBlockHeader: %s, %s\n", __func__, hash.ToString(), state.ToString());
             return false;
         }
@@ -3622,7 +4152,7 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
         }
     }
     if (pindex == nullptr)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3631,15 +4161,57 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
 }
 
 // Exposed wrapper for AcceptBlockHeader
+namespace {
+
+/** The hash of a block header, and whether its proof of work is valid. */
+struct HeaderPoW {
+    uint256 hash;
+    bool valid;
+};
+
+/**
+ * Hash headers and check their proof of work. Batches of more than
+ * HEADERS_POW_CHECK_BATCH headers are split over several threads.
+ */
+std::vector<HeaderPoW> CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensus_params)
+{
+    std::vector<HeaderPoW> result(headers.size());
+    const auto check_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            result[i].hash = headers[i].GetHash();
+            result[i].valid = CheckProofOfWork(result[i].hash, headers[i].nBits, consensus_params);
+        }
+    };
+
+    const size_t num_batches = std::min<size_t>(
+        (headers.size() + HEADERS_POW_CHECK_BATCH - 1) / HEADERS_POW_CHECK_BATCH,
+        std::max(1, std::min(GetNumCores(), MAX_HEADERS_POW_CHECK_THREADS)));
+    const size_t batch_size = num_batches ? (headers.size() + num_batches - 1) / num_batches : 0;
+    std::vector<std::future<void>> pending;
+    for (size_t begin = batch_size; begin < headers.size(); begin += batch_size) {
+        pending.push_back(std::async(std::launch::async, check_range, begin, std::min(begin + batch_size, headers.size())));
+    }
+    check_range(0, std::min(batch_size, headers.size()));
+    for (auto& batch : pending) batch.get();
+    return result;
+}
+
+} // namespace
+
 bool ChainstateManager::ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, BlockValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
     AssertLockNotHeld(cs_main);
+    // Hashing the headers is most of the work of accepting them, so do it
+    // before taking cs_main.
+    const std::vector<HeaderPoW> pow = CheckHeadersProofOfWork(headers, chainparams.GetConsensus());
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); ++i) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
+            // Headers with invalid proof of work are checked again, so that they
+            // are rejected the same way as when they are accepted one by one.
             bool accepted = m_blockman.AcceptBlockHeader(
-                header, state, chainparams, &pindex);
+                headers[i], pow[i].hash, pow[i].valid, state, chainparams, &pindex);
             ::ChainstateActive().CheckBlockIndex(chainparams.GetConsensus());
 
             if (!accepted) {
@@ -3792,6 +4364,15 @@ bool ChainstateManager::ProcessNewBlock(const CChainParams& chainparams, const s
     if (!::ChainstateActive().ActivateBestChain(state, chainparams, pblock))
         return error("%s: ActivateBestChain failed (%s)", __func__, state.ToString());
 
+    // Blocks below the base of an active UTXO snapshot are connected by the
+    // chainstate that validates it in the background.
+    CChainState* background = WITH_LOCK(::cs_main, return BackgroundValidationChainstate());
+    if (background) {
+        if (!background->ActivateBestChain(state, chainparams, pblock))
+            return error("%s: ActivateBestChain failed for background validation (%s)", __func__, state.ToString());
+        MaybeCompleteSnapshotValidation();
+    }
+
     return true;
 }
 
@@ -4011,7 +4592,7 @@ CBlockIndex * BlockManager::InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = NewBlockIndex();
     mi = m_block_index.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -4078,7 +4659,8 @@ void BlockManager::Unload() {
     m_blocks_unlinked.clear();
 
     for (const BlockMap::value_type& entry : m_block_index) {
-        delete entry.second;
+        entry.second->~CBlockIndex();
+        m_block_index_pool.Deallocate(entry.second, sizeof(CBlockIndex), alignof(CBlockIndex));
     }
 
     m_block_index.clear();
@@ -4147,6 +4729,13 @@ void CChainState::LoadMempool(const ArgsManager& args)
     m_mempool.SetIsLoaded(!ShutdownRequested());
 }
 
+void CChainState::LoadCoinsCache(const ArgsManager& args)
+{
+    if (args.GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE)) {
+        ::LoadCoinsCache(*this);
+    }
+}
+
 bool CChainState::LoadChainTip(const CChainParams& chainparams)
 {
     AssertLockHeld(cs_main);
@@ -4749,6 +5338,19 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    // The base of a UTXO snapshot is given the nChainTx of the snapshot, so
+    // its descendants can be connected before the blocks below it are
+    // downloaded and validated. Its descendants are checked as if those
+    // blocks were all downloaded and valid; the values the variables above
+    // had at the base are restored when the search leaves it.
+    const CBlockIndex* snap_base = g_chainman.SnapshotBaseBlock();
+    const bool is_snapshot_chainstate = !m_from_snapshot_blockhash.IsNull();
+    const bool is_background_chainstate = g_chainman.IsBackgroundIBD(this);
+    CBlockIndex* snap_first_missing = nullptr;
+    CBlockIndex* snap_first_never_processed = nullptr;
+    CBlockIndex* snap_first_not_transactions_valid = nullptr;
+    CBlockIndex* snap_first_not_chain_valid = nullptr;
+    CBlockIndex* snap_first_not_scripts_valid = nullptr;
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
@@ -4759,6 +5361,9 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
 
+        // Whether pindex is the snapshot base, and has its nChainTx from the snapshot.
+        const bool snap_base_assumed = pindex == snap_base && pindex->HaveTxsDownloaded() && pindexFirstNeverProcessed != nullptr;
+
         // Begin: actual consistency checks.
         if (pindex->pprev == nullptr) {
             // Genesis block checks.
@@ -4779,8 +5384,8 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to HaveTxsDownloaded().
-        assert((pindexFirstNeverProcessed == nullptr) == pindex->HaveTxsDownloaded());
-        assert((pindexFirstNotTransactionsValid == nullptr) == pindex->HaveTxsDownloaded());
+        assert((pindexFirstNeverProcessed == nullptr || snap_base_assumed) == pindex->HaveTxsDownloaded());
+        assert((pindexFirstNotTransactionsValid == nullptr || snap_base_assumed) == pindex->HaveTxsDownloaded());
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == nullptr || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
@@ -4792,8 +5397,10 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, m_chain.Tip()) && pindexFirstNeverProcessed == nullptr) {
-            if (pindexFirstInvalid == nullptr) {
+        // The background chainstate only connects blocks up to the snapshot base.
+        const bool can_be_candidate = !is_background_chainstate || snap_base->GetAncestor(pindex->nHeight) == pindex;
+        if (!CBlockIndexWorkComparator()(pindex, m_chain.Tip()) && (pindexFirstNeverProcessed == nullptr || (snap_base_assumed && is_snapshot_chainstate))) {
+            if (pindexFirstInvalid == nullptr && can_be_candidate) {
                 // If this block sorts at least as good as the current tip and
                 // is valid and we have all data for its parents, it must be in
                 // setBlockIndexCandidates.  m_chain.Tip() must also be there
@@ -4837,7 +5444,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             // So if this block is itself better than m_chain.Tip() and it wasn't in
             // setBlockIndexCandidates, then it must be in m_blocks_unlinked.
             if (!CBlockIndexWorkComparator()(pindex, m_chain.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
-                if (pindexFirstInvalid == nullptr) {
+                if (pindexFirstInvalid == nullptr && can_be_candidate) {
                     assert(foundInUnlinked);
                 }
             }
@@ -4845,6 +5452,16 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
 
+        if (pindex == snap_base) {
+            snap_first_missing = pindexFirstMissing;
+            snap_first_never_processed = pindexFirstNeverProcessed;
+            snap_first_not_transactions_valid = pindexFirstNotTransactionsValid;
+            snap_first_not_chain_valid = pindexFirstNotChainValid;
+            snap_first_not_scripts_valid = pindexFirstNotScriptsValid;
+            pindexFirstMissing = pindexFirstNeverProcessed = pindexFirstNotTransactionsValid = nullptr;
+            pindexFirstNotChainValid = pindexFirstNotScriptsValid = nullptr;
+        }
+
         // Try descending into the first subnode.
         std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> range = forward.equal_range(pindex);
         if (range.first != range.second) {
@@ -4857,6 +5474,13 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         // Move upwards until we reach a node of which we have not yet visited the last child.
         while (pindex) {
             // We are going to either move to a parent or a sibling of pindex.
+            if (pindex == snap_base) {
+                pindexFirstMissing = snap_first_missing;
+                pindexFirstNeverProcessed = snap_first_never_processed;
+                pindexFirstNotTransactionsValid = snap_first_not_transactions_valid;
+                pindexFirstNotChainValid = snap_first_not_chain_valid;
+                pindexFirstNotScriptsValid = snap_first_not_scripts_valid;
+            }
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = nullptr;
             if (pindex == pindexFirstMissing) pindexFirstMissing = nullptr;
@@ -4910,6 +5534,11 @@ bool CChainState::ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
     size_t old_coinstip_size = m_coinstip_cache_size_bytes;
     m_coinstip_cache_size_bytes = coinstip_size;
     m_coinsdb_cache_size_bytes = coinsdb_size;
+    BlockValidationState state;
+    // The database may be reopened, which must not happen while it is being written to.
+    if (!FinishBackgroundFlush()) {
+        return AbortNode(state, "Failed to write to coin database");
+    }
     CoinsDB().ResizeCache(coinsdb_size);
 
     LogPrintf("[%s] resized coinsdb cache to %.1f MiB\n",
@@ -4917,7 +5546,6 @@ bool CChainState::ResizeCoinsCaches(size_t coinstip_size, size_t coinsdb_size)
     LogPrintf("[%s] resized coinstip cache to %.1f MiB\n",
         this->ToString(), coinstip_size * (1.0 / 1024 / 1024));
 
-    BlockValidationState state;
     const CChainParams& chainparams = Params();
 
     bool ret;
@@ -5119,6 +5747,144 @@ bool DumpMempool(const CTxMemPool& pool)
     return true;
 }
 
+static const uint64_t COINS_CACHE_DUMP_VERSION = 1;
+//! Number of coins read from coinscache.dat before adding them to the cache under cs_main.
+static const size_t COINS_CACHE_LOAD_BATCH_SIZE = 50000;
+
+bool DumpCoinsCache(CChainState& chainstate)
+{
+    AssertLockHeld(cs_main);
+    int64_t start = GetTimeMicros();
+    const CCoinsViewCache& cache = chainstate.CoinsTip();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "coinscache.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = COINS_CACHE_DUMP_VERSION;
+        file << version;
+        // The dump is only valid for the UTXO set as of this block.
+        file << cache.GetBestBlock();
+
+        uint64_t num = 0;
+        cache.ForEachUnspentCoin([&num](const COutPoint&, const Coin&) { ++num; });
+        file << num;
+        cache.ForEachUnspentCoin([&file](const COutPoint& outpoint, const Coin& coin) {
+            file << outpoint;
+            file << coin;
+        });
+
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        if (!RenameOver(GetDataDir() / "coinscache.dat.new", GetDataDir() / "coinscache.dat")) {
+            throw std::runtime_error("Rename failed");
+        }
+        LogPrintf("Dumped %u coins from the coins cache: %gs\n", num, (GetTimeMicros() - start) * MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump coins cache: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+static bool LoadCoinsCacheFile(CChainState& chainstate, CAutoFile& file, uint64_t& loaded)
+{
+    uint64_t version;
+    file >> version;
+    if (version != COINS_CACHE_DUMP_VERSION) {
+        LogPrintf("Coins cache file has unknown version %u, not loading it.\n", version);
+        return false;
+    }
+    uint256 best_block;
+    file >> best_block;
+    uint64_t num;
+    file >> num;
+
+    // Coins absent from the cache are unchanged since the dump only as long
+    // as nothing has been flushed from the cache since. This is checked on
+    // the view under the cache rather than on the database: while a flush is
+    // written in the background, the database still reports the old best
+    // block, but the coins it spent are no longer in the cache.
+    const auto up_to_date = [&]() EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+        return chainstate.CoinsFlushing().GetBestBlock() == best_block;
+    };
+    if (!WITH_LOCK(cs_main, return up_to_date())) {
+        LogPrintf("Coins cache file is out of date, not loading it.\n");
+        return false;
+    }
+
+    std::vector<std::pair<COutPoint, Coin>> batch;
+    while (num) {
+        // Deserialize without holding cs_main, so that validation can
+        // proceed while the cache is being warmed.
+        batch.clear();
+        while (num && batch.size() < COINS_CACHE_LOAD_BATCH_SIZE) {
+            batch.emplace_back();
+            file >> batch.back().first;
+            file >> batch.back().second;
+            --num;
+        }
+
+        LOCK(cs_main);
+        if (!up_to_date()) {
+            LogPrintf("Coins cache file is out of date, not loading the rest of it.\n");
+            break;
+        }
+        CCoinsViewCache& cache = chainstate.CoinsTip();
+        for (auto& entry : batch) {
+            cache.EmplacePrefetchedCoin(entry.first, std::move(entry.second));
+        }
+        loaded += batch.size();
+        // Leave room for new blocks rather than forcing an early flush.
+        if (chainstate.GetCoinsCacheSizeState(nullptr, chainstate.m_coinstip_cache_size_bytes, 0) != CoinsCacheSizeState::OK) {
+            LogPrintf("Coins cache is full, not loading the rest of the coins cache file.\n");
+            break;
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+    return true;
+}
+
+bool LoadCoinsCache(CChainState& chainstate)
+{
+    int64_t start = GetTimeMicros();
+    const fs::path path = GetDataDir() / "coinscache.dat";
+    FILE* filestr = fsbridge::fopen(path, "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open coins cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    uint64_t loaded = 0;
+    bool res;
+    try {
+        res = LoadCoinsCacheFile(chainstate, file, loaded);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize coins cache data on disk: %s. Continuing anyway.\n", e.what());
+        res = false;
+    }
+    // The file only describes the coins as of the last clean shutdown. Remove
+    // it, so that a later start after an unclean shutdown does not load it
+    // again.
+    file.fclose();
+    try {
+        fs::remove(path);
+    } catch (const fs::filesystem_error& e) {
+        LogPrintf("Failed to remove coins cache file: %s\n", fsbridge::get_filesystem_error_message(e));
+    }
+    if (!res) return false;
+
+    LogPrintf("Imported %u coins into the coins cache from disk: %gs\n", loaded, (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -5138,6 +5904,17 @@ double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pin
     return std::min<double>(pindex->nChainTx / fTxTotal, 1.0);
 }
 
+Optional<AssumeutxoData> ExpectedAssumeutxo(const int height, const CChainParams& chainparams)
+{
+    const MapAssumeutxo& valid_assumeutxos_map = chainparams.Assumeutxo();
+    const auto assumeutxo_found = valid_assumeutxos_map.find(height);
+
+    if (assumeutxo_found != valid_assumeutxos_map.end()) {
+        return assumeutxo_found->second;
+    }
+    return {};
+}
+
 Optional<uint256> ChainstateManager::SnapshotBlockhash() const {
     if (m_active_chainstate != nullptr) {
         // If a snapshot chainstate exists, it will always be our active.
@@ -5161,6 +5938,273 @@ std::vector<CChainState*> ChainstateManager::GetAll()
     return out;
 }
 
+bool ChainstateManager::ActivateSnapshot(
+    CAutoFile& coins_file,
+    const SnapshotMetadata& metadata,
+    const CChainParams& chainparams,
+    bool in_memory)
+{
+    const uint256& base_blockhash = metadata.m_base_blockhash;
+
+    if (fPruneMode) {
+        LogPrintf("[snapshot] can't activate a snapshot when pruning is enabled\n");
+        return false;
+    }
+
+    size_t current_coinsdb_cache_size{0};
+    size_t current_coinstip_cache_size{0};
+
+    // Cache percentages to allocate to each chainstate while the snapshot is
+    // loaded. MaybeRebalanceCaches() settles on the final split afterwards,
+    // including when the snapshot turns out to be unusable.
+    static constexpr double IBD_CACHE_PERC = 0.01;
+    static constexpr double SNAPSHOT_CACHE_PERC = 0.99;
+
+    {
+        LOCK(::cs_main);
+        if (m_snapshot_chainstate) {
+            LogPrintf("[snapshot] can't activate a snapshot-based chainstate more than once\n");
+            return false;
+        }
+
+        const CBlockIndex* snapshot_start_block = LookupBlockIndex(base_blockhash);
+        if (!snapshot_start_block) {
+            LogPrintf("[snapshot] did not find snapshot start blockheader %s\n", base_blockhash.ToString());
+            return false;
+        }
+        if (snapshot_start_block->nStatus & BLOCK_FAILED_MASK) {
+            LogPrintf("[snapshot] snapshot start block %s is invalid\n", base_blockhash.ToString());
+            return false;
+        }
+        if (ActiveTip() && ActiveTip()->nChainWork > snapshot_start_block->nChainWork) {
+            LogPrintf("[snapshot] the active chain is already past the snapshot start block %s\n", base_blockhash.ToString());
+            return false;
+        }
+
+        // Make room for the coins of the snapshot by temporarily shrinking
+        // the caches of the active chainstate.
+        current_coinsdb_cache_size = ActiveChainstate().m_coinsdb_cache_size_bytes;
+        current_coinstip_cache_size = ActiveChainstate().m_coinstip_cache_size_bytes;
+        ActiveChainstate().ResizeCoinsCaches(
+            static_cast<size_t>(current_coinstip_cache_size * IBD_CACHE_PERC),
+            static_cast<size_t>(current_coinsdb_cache_size * IBD_CACHE_PERC));
+    }
+
+    // Nothing else knows about snapshot_chainstate until it is activated
+    // below, so its contents can be used without holding cs_main.
+    auto snapshot_chainstate = WITH_LOCK(::cs_main, return MakeUnique<CChainState>(
+        ActiveChainstate().m_mempool, m_blockman, base_blockhash));
+
+    {
+        LOCK(::cs_main);
+        // Wipe any leftovers of an earlier attempt to load this snapshot.
+        snapshot_chainstate->InitCoinsDB(
+            static_cast<size_t>(current_coinsdb_cache_size * SNAPSHOT_CACHE_PERC),
+            in_memory, /* should_wipe */ true);
+        snapshot_chainstate->InitCoinsCache(
+            static_cast<size_t>(current_coinstip_cache_size * SNAPSHOT_CACHE_PERC));
+    }
+
+    if (!PopulateAndValidateSnapshot(*snapshot_chainstate, coins_file, metadata, chainparams)) {
+        WITH_LOCK(::cs_main, MaybeRebalanceCaches());
+        return false;
+    }
+
+    {
+        LOCK(::cs_main);
+        assert(!m_snapshot_chainstate);
+        m_snapshot_chainstate.swap(snapshot_chainstate);
+        const bool chaintip_loaded = m_snapshot_chainstate->LoadChainTip(chainparams);
+        assert(chaintip_loaded);
+
+        m_active_chainstate = m_snapshot_chainstate.get();
+
+        // The mempool was built on top of the old tip, which its
+        // transactions may no longer fit.
+        m_active_chainstate->m_mempool.clear();
+
+        LogPrintf("[snapshot] successfully activated snapshot %s\n", base_blockhash.ToString());
+        LogPrintf("Switching active chainstate to %s\n", m_snapshot_chainstate->ToString());
+
+        MaybeRebalanceCaches();
+    }
+    return true;
+}
+
+bool ChainstateManager::PopulateAndValidateSnapshot(
+    CChainState& snapshot_chainstate,
+    CAutoFile& coins_file,
+    const SnapshotMetadata& metadata,
+    const CChainParams& chainparams)
+{
+    CCoinsViewCache& coins_cache = *WITH_LOCK(::cs_main, return &snapshot_chainstate.CoinsTip());
+    const uint256& base_blockhash = metadata.m_base_blockhash;
+    CBlockIndex* snapshot_start_block = WITH_LOCK(::cs_main, return LookupBlockIndex(base_blockhash));
+    assert(snapshot_start_block);
+    const int base_height = snapshot_start_block->nHeight;
+
+    const Optional<AssumeutxoData> maybe_au_data = ExpectedAssumeutxo(base_height, chainparams);
+    if (!maybe_au_data) {
+        LogPrintf("[snapshot] assumeutxo height in snapshot metadata not recognized (%d) - refusing to load snapshot\n", base_height);
+        return false;
+    }
+    const AssumeutxoData& au_data = *maybe_au_data;
+
+    // The coins are flushed to disk whenever the cache gets too large, so the
+    // database needs a best block before the snapshot is fully loaded. Nothing
+    // uses this database until the snapshot is activated.
+    coins_cache.SetBestBlock(base_blockhash);
+
+    COutPoint outpoint;
+    Coin coin;
+    const uint64_t coins_count = metadata.m_coins_count;
+    uint64_t coins_left = coins_count;
+
+    LogPrintf("[snapshot] loading %d coins from snapshot %s\n", coins_count, base_blockhash.ToString());
+    int64_t coins_processed{0};
+
+    while (coins_left > 0) {
+        try {
+            coins_file >> outpoint;
+            coins_file >> coin;
+        } catch (const std::ios_base::failure&) {
+            LogPrintf("[snapshot] bad snapshot format or truncated snapshot after deserializing %d coins\n",
+                coins_count - coins_left);
+            return false;
+        }
+        if (coin.nHeight > uint32_t(base_height)) {
+            LogPrintf("[snapshot] bad snapshot data after deserializing %d coins\n",
+                coins_count - coins_left);
+            return false;
+        }
+        try {
+            coins_cache.AddCoin(outpoint, std::move(coin), /* possible_overwrite */ false);
+        } catch (const std::logic_error&) {
+            LogPrintf("[snapshot] bad snapshot - duplicate coin %s\n", outpoint.ToString());
+            return false;
+        }
+
+        --coins_left;
+        ++coins_processed;
+
+        if (coins_processed % 1000000 == 0) {
+            LogPrintf("[snapshot] %d coins loaded (%.2f%%, %.2f MB)\n",
+                coins_processed,
+                static_cast<float>(coins_processed) * 100 / static_cast<float>(coins_count),
+                coins_cache.DynamicMemoryUsage() / (1000.0 * 1000));
+        }
+
+        // Flush the cache every so often if it gets too large.
+        if (coins_processed % 120000 == 0) {
+            if (ShutdownRequested()) {
+                return false;
+            }
+            const auto snapshot_cache_state = WITH_LOCK(::cs_main,
+                return snapshot_chainstate.GetCoinsCacheSizeState(&snapshot_chainstate.m_mempool));
+            if (snapshot_cache_state >= CoinsCacheSizeState::CRITICAL) {
+                LogPrintf("[snapshot] flushing coins cache (%.2f MB)\n",
+                    coins_cache.DynamicMemoryUsage() / (1000.0 * 1000));
+                coins_cache.Flush();
+            }
+        }
+    }
+
+    bool out_of_coins{false};
+    try {
+        coins_file >> outpoint;
+    } catch (const std::ios_base::failure&) {
+        // We expect an exception since we should be out of coins.
+        out_of_coins = true;
+    }
+    if (!out_of_coins) {
+        LogPrintf("[snapshot] bad snapshot - coins left over after deserializing %d coins\n", coins_count);
+        return false;
+    }
+
+    LogPrintf("[snapshot] loaded %d (%.2f MB) coins from snapshot %s\n",
+        coins_count,
+        coins_cache.DynamicMemoryUsage() / (1000.0 * 1000),
+        base_blockhash.ToString());
+
+    // The hash is computed over the coins database.
+    coins_cache.Flush();
+
+    CCoinsStats stats;
+    CCoinsViewDB* snapshot_coinsdb = WITH_LOCK(::cs_main, return &snapshot_chainstate.CoinsDB());
+    if (!GetUTXOStats(snapshot_coinsdb, stats, CoinStatsHashType::HASH_SERIALIZED, [] {})) {
+        LogPrintf("[snapshot] failed to generate coins stats\n");
+        return false;
+    }
+
+    // Assert that the deserialized chainstate contents match the expected assumeutxo value.
+    if (stats.hashSerialized != au_data.hash_serialized) {
+        LogPrintf("[snapshot] bad snapshot content hash: expected %s, got %s\n",
+            au_data.hash_serialized.ToString(), stats.hashSerialized.ToString());
+        return false;
+    }
+
+    LOCK(::cs_main);
+    snapshot_chainstate.m_chain.SetTip(snapshot_start_block);
+
+    // The blocks up to the snapshot base are not downloaded yet, so fake
+    // the nChainTx of the base block to accurately report the progress of
+    // syncing the snapshot chainstate to the network tip. It is recomputed
+    // once the base block and all blocks below it are downloaded for
+    // background validation.
+    if (!snapshot_start_block->HaveTxsDownloaded()) {
+        snapshot_start_block->nChainTx = au_data.nChainTx;
+    }
+    snapshot_chainstate.setBlockIndexCandidates.insert(snapshot_start_block);
+
+    m_snapshot_hash_serialized = au_data.hash_serialized;
+    return true;
+}
+
+void ChainstateManager::MaybeCompleteSnapshotValidation()
+{
+    AssertLockNotHeld(::cs_main);
+    CCoinsViewDB* coinsdb;
+    {
+        LOCK(::cs_main);
+        CChainState* background = BackgroundValidationChainstate();
+        if (!background || background->m_chain.Tip() != SnapshotBaseBlock()) {
+            return;
+        }
+
+        LogPrintf("[snapshot] background validation reached the snapshot base %s, checking its UTXO set\n",
+            background->m_chain.Tip()->GetBlockHash().ToString());
+
+        // The hash is computed over the coins database.
+        background->ForceFlushStateToDisk();
+        coinsdb = &background->CoinsDB();
+    }
+
+    // The background chainstate doesn't go past the snapshot base, so its
+    // coins database doesn't change while the hash is computed without
+    // holding cs_main.
+    CCoinsStats stats;
+    if (!GetUTXOStats(coinsdb, stats, CoinStatsHashType::HASH_SERIALIZED, [] {})) {
+        LogPrintf("[snapshot] failed to generate coins stats for background validation\n");
+        return;
+    }
+
+    LOCK(::cs_main);
+    if (m_snapshot_validated) {
+        return;
+    }
+    if (stats.hashSerialized != m_snapshot_hash_serialized) {
+        BlockValidationState state;
+        AbortNode(state, strprintf("UTXO set hash %s of the validated chain does not match hash %s of the snapshot in use",
+            stats.hashSerialized.ToString(), m_snapshot_hash_serialized.ToString()),
+            _("The UTXO snapshot in use does not match the validated chain. Please restart and let the node sync without it."));
+        return;
+    }
+
+    m_snapshot_validated = true;
+    LogPrintf("[snapshot] snapshot %s validated in the background\n", m_snapshot_chainstate->m_from_snapshot_blockhash.ToString());
+    MaybeRebalanceCaches();
+}
+
 CChainState& ChainstateManager::InitializeChainstate(CTxMemPool& mempool, const uint256& snapshot_blockhash)
 {
     bool is_snapshot = !snapshot_blockhash.IsNull();
@@ -5208,6 +6252,39 @@ bool ChainstateManager::IsBackgroundIBD(CChainState* chainstate) const
     return (m_snapshot_chainstate && chainstate == m_ibd_chainstate.get());
 }
 
+CChainState* ChainstateManager::BackgroundValidationChainstate() const
+{
+    if (!IsSnapshotActive() || IsSnapshotValidated()) {
+        return nullptr;
+    }
+    return m_ibd_chainstate.get();
+}
+
+CBlockIndex* ChainstateManager::SnapshotBaseBlock() const
+{
+    if (!m_snapshot_chainstate) {
+        return nullptr;
+    }
+    BlockMap::const_iterator it = m_blockman.m_block_index.find(m_snapshot_chainstate->m_from_snapshot_blockhash);
+    return it == m_blockman.m_block_index.end() ? nullptr : it->second;
+}
+
+void ChainstateManager::AddBackgroundValidationCandidate(CBlockIndex* pindex)
+{
+    CChainState* background = BackgroundValidationChainstate();
+    if (!background) {
+        return;
+    }
+    const CBlockIndex* snapshot_base = SnapshotBaseBlock();
+    if (!snapshot_base || snapshot_base->GetAncestor(pindex->nHeight) != pindex) {
+        return;
+    }
+    const CBlockIndex* tip = background->m_chain.Tip();
+    if (tip == nullptr || !background->setBlockIndexCandidates.value_comp()(pindex, tip)) {
+        background->setBlockIndexCandidates.insert(pindex);
+    }
+}
+
 void ChainstateManager::Unload()
 {
     for (CChainState* chainstate : this->GetAll()) {
@@ -5242,7 +6319,7 @@ void ChainstateManager::MaybeRebalanceCaches()
         // If both chainstates exist, determine who needs more cache based on IBD status.
         //
         // Note: shrink caches first so that we don't inadvertently overwhelm available memory.
-        if (m_snapshot_chainstate->IsInitialBlockDownload()) {
+        if (m_snapshot_chainstate->IsInitialBlockDownload() || m_snapshot_validated) {
             m_ibd_chainstate->ResizeCoinsCaches(
                 m_total_coinstip_cache * 0.05, m_total_coinsdb_cache * 0.05);
             m_snapshot_chainstate->ResizeCoinsCaches(
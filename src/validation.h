@@ -11,20 +11,25 @@
 #endif
 
 #include <amount.h>
+#include <chain.h>
 #include <coins.h>
 #include <crypto/common.h> // for ReadLE64
 #include <fs.h>
 #include <optional.h>
 #include <policy/feerate.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
+#include <script/interpreter.h> // For PrecomputedTransactionData
 #include <script/script_error.h>
+#include <support/allocators/pool.h>
 #include <sync.h>
 #include <txmempool.h> // For CTxMemPool::cs
 #include <txdb.h>
 #include <versionbits.h>
 #include <serialize.h>
 
+#include <algorithm>
 #include <atomic>
+#include <future>
 #include <map>
 #include <memory>
 #include <set>
@@ -33,6 +38,7 @@
 #include <utility>
 #include <vector>
 
+class CAutoFile;
 class CChainState;
 class BlockValidationState;
 class CBlockIndex;
@@ -44,7 +50,9 @@ class CConnman;
 class CScriptCheck;
 class CTxMemPool;
 class ChainstateManager;
+class SnapshotMetadata;
 class TxValidationState;
+struct AssumeutxoData;
 struct ChainTxData;
 
 struct DisconnectedBlockTransactions;
@@ -69,12 +77,32 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 15;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Minimum number of headers per thread when checking the proof of work of a headers message */
+static const size_t HEADERS_POW_CHECK_BATCH = 250;
+/** Maximum number of threads checking the proof of work of a headers message */
+static const int MAX_HEADERS_POW_CHECK_THREADS = 8;
+/** Maximum number of transactions in a package accepted to the mempool at once */
+static const unsigned int MAX_PACKAGE_COUNT = 25;
+/** Maximum total virtual size of a package accepted to the mempool at once, in kilobytes */
+static const unsigned int MAX_PACKAGE_SIZE = 101;
+/** Maximum number of dedicated coins prefetch threads allowed */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -parprefetch default (number of threads looking up block inputs in the coins database, 0 = disable) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
 static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistcoinscache */
+static const bool DEFAULT_PERSIST_COINS_CACHE = false;
+/** Default for -partialcoinsflush */
+static const bool DEFAULT_PARTIAL_COINS_FLUSH = false;
+/** Percentage of the coins cache size that a partial flush evicts down to */
+static const unsigned int PARTIAL_FLUSH_TARGET_PERCENT = 75;
+/** Default for -backgroundcoinsflush */
+static const bool DEFAULT_BACKGROUND_COINS_FLUSH = false;
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
 /** Default for -stopatheight */
@@ -119,6 +147,18 @@ extern std::atomic_bool fReindex;
  * False indicates all script checking is done on the main threadMessageHandler thread.
  */
 extern bool g_parallel_script_checks;
+/** Whether there are dedicated coins prefetch threads running.
+ * False indicates the inputs of a block are looked up one at a time by ConnectBlock().
+ */
+extern bool g_parallel_coins_prefetch;
+/** Whether flushes caused by the coins cache size keep recently used coins cached.
+ * False indicates the whole coins cache is dropped after it is written to disk.
+ */
+extern bool g_partial_coins_flush;
+/** Whether periodic and cache size triggered flushes write the coins cache to disk on a background thread.
+ * False indicates the coins cache is written while holding cs_main.
+ */
+extern bool g_background_coins_flush;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
@@ -158,6 +198,8 @@ bool LoadGenesisBlock(const CChainParams& chainparams);
 void UnloadBlockIndex(CTxMemPool* mempool, ChainstateManager& chainman);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch(int worker_num);
 /**
  * Return transaction from the block at block_index.
  * If block_index is not provided, fall back to mempool.
@@ -183,6 +225,9 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 /** Guess verification progress (as a fraction between 0.0=genesis and 1.0=current tip). */
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex* pindex);
 
+/** Return the assumeutxo data for a UTXO snapshot whose base block is at the given height, if the chain accepts one. */
+Optional<AssumeutxoData> ExpectedAssumeutxo(int height, const CChainParams& params);
+
 /** Calculate the amount of disk space the block & undo files currently use */
 uint64_t CalculateCurrentUsage();
 
@@ -201,6 +246,26 @@ bool AcceptToMemoryPool(CTxMemPool& pool, TxValidationState &state, const CTrans
                         std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, bool test_accept=false, CAmount* fee_out=nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/**
+ * (Try to) add a package of transactions to the memory pool, all of them or
+ * none. Transactions must come after those of the package they spend. The
+ * package is checked as a whole: its transactions may not spend the same
+ * outputs or replace mempool transactions, and the ancestor and descendant
+ * limits apply to the mempool with all of them in it. Transactions of the
+ * package already in the mempool are left there and count as mempool
+ * ancestors of those spending them.
+ * @param[out] state the reason the package was rejected, which is that of the
+ *             invalid transaction if there is one
+ * @param[out] tx_states the state of each transaction checked, up to the
+ *             first invalid one
+ * @param[out] fees_out optional argument to return the fee of each
+ *             transaction to the caller
+ */
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, TxValidationState& state, std::vector<TxValidationState>& tx_states,
+                               const std::vector<CTransactionRef>& package, bool test_accept,
+                               std::vector<CAmount>* fees_out = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+
 /** Get the BIP9 state for a given deployment at the current tip. */
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos);
 
@@ -238,10 +303,12 @@ bool TestLockPointValidity(const LockPoints* lp) EXCLUSIVE_LOCKS_REQUIRED(cs_mai
  * of the block needed for calculation or skips the calculation and uses the LockPoints
  * passed in for evaluation.
  * The LockPoints should not be considered valid if CheckSequenceLocks returns false.
+ * The coins spent are looked up in coins_view if given, and otherwise in the
+ * UTXO set and the mempool.
  *
  * See consensus/consensus.h for flag definitions.
  */
-bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flags, LockPoints* lp = nullptr, bool useExistingLockPoints = false) EXCLUSIVE_LOCKS_REQUIRED(::cs_main, pool.cs);
+bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flags, LockPoints* lp = nullptr, bool useExistingLockPoints = false, const CCoinsView* coins_view = nullptr) EXCLUSIVE_LOCKS_REQUIRED(::cs_main, pool.cs);
 
 /**
  * Closure representing one script verification
@@ -278,6 +345,31 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/** The signature checks of a transaction, prepared to be run without holding cs_main */
+struct TransactionScriptChecks
+{
+    PrecomputedTransactionData txdata;
+    //! These refer to txdata, so the struct is not moved once prepared
+    std::vector<CScriptCheck> checks;
+    //! The coins looked up for the transaction that were not in the coins cache before
+    std::vector<COutPoint> coins_to_uncache;
+};
+
+/**
+ * Prepare the signature checks of a transaction that passes the mempool policy
+ * checks, so that several message handler threads verify the transactions
+ * they receive at the same time. Valid signatures are stored in the signature
+ * cache, where AcceptToMemoryPool() finds them after checking the transaction
+ * again against the UTXO set and mempool of that time. The caller uncaches
+ * prepared.coins_to_uncache before AcceptToMemoryPool(), which then uncaches
+ * them itself if it rejects the transaction.
+ * Returns false if the transaction fails a policy check.
+ */
+bool PrepareTransactionScriptChecks(CTxMemPool& pool, const CTransactionRef& tx, TransactionScriptChecks& prepared) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** Run the checks prepared by PrepareTransactionScriptChecks(). Returns whether they all pass. */
+bool RunTransactionScriptChecks(TransactionScriptChecks& prepared) LOCKS_EXCLUDED(cs_main);
+
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
@@ -287,6 +379,9 @@ bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::P
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Open the block file at pos, after checking the block's meta header. The returned file is positioned at the
+ *  start of the block, whose size is returned in block_size. Returns nullptr on failure. */
+FILE* OpenRawBlockFile(const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start, unsigned int& block_size);
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
@@ -375,6 +470,24 @@ private:
      */
     void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight, int chain_tip_height, bool is_ibd);
 
+    //! Alignment and size of the memory used for one entry of m_block_index
+    static constexpr size_t BLOCK_INDEX_ALIGN_BYTES = std::max(alignof(CBlockIndex), alignof(void*));
+    static constexpr size_t BLOCK_INDEX_ENTRY_BYTES = (sizeof(CBlockIndex) + BLOCK_INDEX_ALIGN_BYTES - 1) / BLOCK_INDEX_ALIGN_BYTES * BLOCK_INDEX_ALIGN_BYTES;
+
+    /**
+     * The entries of m_block_index are allocated from this pool, which requests
+     * memory from the system in large chunks rather than once per header.
+     * They are only freed by Unload().
+     */
+    PoolResource<BLOCK_INDEX_ENTRY_BYTES, BLOCK_INDEX_ALIGN_BYTES> m_block_index_pool GUARDED_BY(cs_main);
+
+    template <typename... Args>
+    CBlockIndex* NewBlockIndex(Args&&... args) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        void* p = m_block_index_pool.Allocate(sizeof(CBlockIndex), alignof(CBlockIndex));
+        return new (p) CBlockIndex(std::forward<Args>(args)...);
+    }
+
 public:
     BlockMap m_block_index GUARDED_BY(cs_main);
 
@@ -422,6 +535,8 @@ public:
     void Unload() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /** As above, for a header whose hash is already known. */
+    CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
     CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -438,6 +553,18 @@ public:
         const CChainParams& chainparams,
         CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * As above, for a header whose hash is already known. If pow_checked, its
+     * proof of work was already found to be valid, and is not checked again.
+     */
+    bool AcceptBlockHeader(
+        const CBlockHeader& block,
+        const uint256& hash,
+        bool pow_checked,
+        BlockValidationState& state,
+        const CChainParams& chainparams,
+        CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     ~BlockManager() {
         Unload();
     }
@@ -462,10 +589,18 @@ public:
     //! This view wraps access to the leveldb instance and handles read errors gracefully.
     CCoinsViewErrorCatcher m_catcherview GUARDED_BY(cs_main);
 
+    //! This view makes the coins being written to the database by a background
+    //! flush visible to the cache above it until the write is done.
+    CCoinsViewFlushing m_flushingview GUARDED_BY(cs_main);
+
     //! This is the top layer of the cache hierarchy - it keeps as many coins in memory as
     //! can fit per the dbcache setting.
     std::unique_ptr<CCoinsViewCache> m_cacheview GUARDED_BY(cs_main);
 
+    //! The result of the background flush in progress, if any. Declared last, so
+    //! that it is waited for before the views it writes to are destroyed.
+    std::future<bool> m_background_flush GUARDED_BY(cs_main);
+
     //! This constructor initializes CCoinsViewDB and CCoinsViewErrorCatcher instances, but it
     //! *does not* create a CCoinsViewCache instance by default. This is done separately because the
     //! presence of the cache has implications on whether or not we're allowed to flush the cache's
@@ -541,6 +676,12 @@ protected:
     //! Manages the UTXO set, which is a reflection of the contents of `m_chain`.
     std::unique_ptr<CoinsViews> m_coins_views;
 
+    //! The next block to be connected, which is read from disk and run
+    //! through CheckBlock() in the background while the current block is
+    //! being connected. See ActivateBestChainStep().
+    const CBlockIndex* m_read_ahead_index GUARDED_BY(::cs_main){nullptr};
+    std::future<std::shared_ptr<const CBlock>> m_read_ahead_block GUARDED_BY(::cs_main);
+
 public:
     explicit CChainState(CTxMemPool& mempool, BlockManager& blockman, uint256 from_snapshot_blockhash = uint256());
 
@@ -597,6 +738,13 @@ public:
         return m_coins_views->m_dbview;
     }
 
+    //! @returns A reference to the view CoinsTip() is backed by, which also
+    //!     answers from the coins being written to CoinsDB() in the background.
+    CCoinsViewFlushing& CoinsFlushing() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        return m_coins_views->m_flushingview;
+    }
+
     //! @returns A reference to a wrapped view of the in-memory UTXO set that
     //!     handles disk read errors gracefully.
     CCoinsViewErrorCatcher& CoinsErrorCatcher() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
@@ -698,6 +846,9 @@ public:
     /** Load the persisted mempool from disk */
     void LoadMempool(const ArgsManager& args);
 
+    /** Load the persisted coins cache from disk */
+    void LoadCoinsCache(const ArgsManager& args);
+
     /** Update the chain tip based on database information, i.e. CoinsTip()'s best block. */
     bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -718,6 +869,17 @@ private:
     bool ActivateBestChainStep(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_mempool.cs);
     bool ConnectTip(BlockValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions& disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_mempool.cs);
 
+    //! Start reading pindex's block from disk and checking it in the background.
+    void ReadAheadBlock(const CBlockIndex* pindex, const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    //! Return the block read ahead for pindex, or nullptr if it has to be read from disk.
+    std::shared_ptr<const CBlock> TakeReadAheadBlock(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    //! Take the coins out of CoinsTip() and start writing them to the database in the background.
+    void StartBackgroundFlush() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    //! Wait for the background flush in progress, if any. Returns false if it failed.
+    //! If wait is false, only finish it if it is already done.
+    bool FinishBackgroundFlush(bool wait = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     void InvalidBlockFound(CBlockIndex *pindex, const BlockValidationState &state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     CBlockIndex* FindMostWorkChain() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     void ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pindexNew, const FlatFilePos& pos, const Consensus::Params& consensusParams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -828,6 +990,25 @@ private:
     //! by the background validation chainstate.
     bool m_snapshot_validated{false};
 
+    //! The serialized hash of the UTXO set loaded from the active snapshot,
+    //! which the background validation chainstate must reproduce once it
+    //! reaches the snapshot base block.
+    uint256 m_snapshot_hash_serialized;
+
+    //! Load the coins of a snapshot into the coins database of
+    //! snapshot_chainstate and check them against the assumeutxo data of the
+    //! chain. On success, the tip of snapshot_chainstate is the snapshot base.
+    bool PopulateAndValidateSnapshot(
+        CChainState& snapshot_chainstate,
+        CAutoFile& coins_file,
+        const SnapshotMetadata& metadata,
+        const CChainParams& chainparams);
+
+    //! Once the background validation chainstate has connected the snapshot
+    //! base block, compare its UTXO set with the one loaded from the snapshot.
+    //! A match marks the snapshot as validated; a mismatch is fatal.
+    void MaybeCompleteSnapshotValidation() LOCKS_EXCLUDED(::cs_main);
+
     // For access to m_active_chainstate.
     friend CChainState& ChainstateActive();
     friend CChain& ChainActive();
@@ -858,6 +1039,24 @@ public:
     //! Get all chainstates currently being used.
     std::vector<CChainState*> GetAll();
 
+    //! Construct and activate a chainstate on the basis of a UTXO snapshot.
+    //!
+    //! The snapshot chainstate becomes active immediately and syncs from the
+    //! snapshot base block to the network tip, while the current chainstate
+    //! keeps validating the blocks up to the snapshot base in the background.
+    //!
+    //! @param[in] coins_file   The snapshot, positioned after its metadata.
+    //! @param[in] metadata     The metadata read from the snapshot.
+    //! @param[in] in_memory    Whether to keep the coins database in memory;
+    //!                         only used for testing.
+    //! @returns false if the snapshot can't be used, in which case the
+    //!          current chainstate stays active.
+    bool ActivateSnapshot(
+        CAutoFile& coins_file,
+        const SnapshotMetadata& metadata,
+        const CChainParams& chainparams,
+        bool in_memory) LOCKS_EXCLUDED(::cs_main);
+
     //! The most-work chain.
     CChainState& ActiveChainstate() const;
     CChain& ActiveChain() const { return ActiveChainstate().m_chain; }
@@ -880,6 +1079,17 @@ public:
     //!          snapshot in the background.
     bool IsBackgroundIBD(CChainState* chainstate) const;
 
+    //! The chainstate validating the active snapshot in the background, or
+    //! nullptr if no snapshot is active or it has already been validated.
+    CChainState* BackgroundValidationChainstate() const;
+
+    //! The base block of the active snapshot, or nullptr if no snapshot is active.
+    CBlockIndex* SnapshotBaseBlock() const EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+
+    //! Make a block that leads to the base of the active snapshot a candidate
+    //! for the tip of the background validation chainstate.
+    void AddBackgroundValidationCandidate(CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(::cs_main);
+
     //! Return the most-work chainstate that has been fully validated.
     //!
     //! During background validation of a snapshot, this is the IBD chain. After
@@ -973,6 +1183,12 @@ bool DumpMempool(const CTxMemPool& pool);
 /** Load the mempool from disk. */
 bool LoadMempool(CTxMemPool& pool);
 
+/** Dump the unspent coins held in the in-memory coins cache to disk. */
+bool DumpCoinsCache(CChainState& chainstate) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** Warm the in-memory coins cache with a dump made at the last clean shutdown. */
+bool LoadCoinsCache(CChainState& chainstate);
+
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test loading a UTXO snapshot with loadtxoutset.
+
+A node that only has the headers of the chain loads a snapshot, syncs the
+snapshot chainstate to the tip, and meanwhile validates the blocks up to the
+snapshot base in the background. The consistency checks of the block index
+(-checkblockindex, on by default on regtest) run throughout.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+SNAPSHOT_BASE_HEIGHT = 299
+FINAL_HEIGHT = 399
+
+
+class AssumeutxoTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.setup_nodes()
+
+    def run_test(self):
+        n0, n1 = self.nodes
+
+        self.log.info("Create a snapshot at height %d" % SNAPSHOT_BASE_HEIGHT)
+        n0.generatetoaddress(SNAPSHOT_BASE_HEIGHT, n0.get_deterministic_priv_key().address)
+        dump = n0.dumptxoutset('utxos.dat')
+        assert_equal(dump['base_height'], SNAPSHOT_BASE_HEIGHT)
+        hash_serialized = n0.gettxoutsetinfo()['hash_serialized_2']
+        chain_tx = n0.getchaintxstats(blockhash=dump['base_hash'])['txcount']
+        n0.generatetoaddress(FINAL_HEIGHT - SNAPSHOT_BASE_HEIGHT, n0.get_deterministic_priv_key().address)
+
+        self.log.info("Load the snapshot on a node that only has the headers")
+        self.restart_node(1, extra_args=['-assumeutxo=%d:%s:%d' % (SNAPSHOT_BASE_HEIGHT, hash_serialized, chain_tx)])
+        for height in range(1, FINAL_HEIGHT + 1):
+            n1.submitheader(n0.getblockheader(n0.getblockhash(height), False))
+        assert_equal(n1.getblockcount(), 0)
+        result = n1.loadtxoutset(dump['path'])
+        assert_equal(result['coins_loaded'], dump['coins_written'])
+        assert_equal(result['base_height'], SNAPSHOT_BASE_HEIGHT)
+        assert_equal(n1.getbestblockhash(), dump['base_hash'])
+
+        self.log.info("Sync to the tip, and validate the snapshot in the background")
+        with n1.assert_debug_log(['[snapshot] snapshot %s validated in the background' % dump['base_hash']], timeout=120):
+            self.connect_nodes(1, 0)
+            self.sync_blocks()
+        assert_equal(n1.gettxoutsetinfo()['hash_serialized_2'], n0.gettxoutsetinfo()['hash_serialized_2'])
+
+        self.log.info("The snapshot chainstate is not reloaded after a restart")
+        with n1.assert_debug_log(['Switching active chainstate to Chainstate [ibd]']):
+            self.restart_node(1)
+        self.connect_nodes(1, 0)
+        self.sync_blocks()
+        assert_equal(n1.gettxoutsetinfo()['hash_serialized_2'], n0.gettxoutsetinfo()['hash_serialized_2'])
+
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test mempool acceptance of packages of transactions.
+
+Packages are tested with testmempoolaccept and submitted with submitpackage.
+The transactions of a package may spend outputs of earlier ones, and are
+accepted all together or not at all.
+"""
+
+from decimal import Decimal
+
+from test_framework.address import ADDRESS_BCRT1_P2WSH_OP_TRUE
+from test_framework.messages import (
+    COIN,
+    COutPoint,
+    CTransaction,
+    CTxIn,
+    CTxInWitness,
+    CTxOut,
+)
+from test_framework.script import (
+    CScript,
+    OP_TRUE,
+)
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    hex_str_to_bytes,
+    satoshi_round,
+)
+from test_framework.wallet import MiniWallet
+
+FEE = Decimal("0.0001")
+MAX_PACKAGE_COUNT = 25
+
+
+class MempoolPackageAcceptTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 1
+        self.setup_clean_chain = True
+
+    def make_spend(self, utxo, *, vout=0, fee=FEE):
+        """Create a transaction spending an OP_TRUE output to another one, without sending it"""
+        value = satoshi_round(utxo['value'] - fee)
+        tx = CTransaction()
+        tx.vin = [CTxIn(COutPoint(int(utxo['txid'], 16), vout))]
+        tx.vout = [CTxOut(int(value * COIN), self.script_pubkey)]
+        tx.wit.vtxinwit = [CTxInWitness()]
+        tx.wit.vtxinwit[0].scriptWitness.stack = [CScript([OP_TRUE])]
+        tx.rehash()
+        return {'txid': tx.hash, 'hex': tx.serialize().hex(), 'utxo': {'txid': tx.hash, 'vout': 0, 'value': value}}
+
+    def make_chain(self, utxo, length):
+        chain = []
+        for _ in range(length):
+            tx = self.make_spend(utxo)
+            chain.append(tx)
+            utxo = tx['utxo']
+        return chain
+
+    def check_package_result(self, txs, result_expected, **kwargs):
+        """Check the result of testmempoolaccept for a package, which must not change the mempool"""
+        mempool_size = self.nodes[0].getmempoolinfo()['size']
+        result = self.nodes[0].testmempoolaccept(rawtxs=[tx['hex'] for tx in txs], **kwargs)
+        assert_equal(result, [dict(txid=tx['txid'], **expected) for tx, expected in zip(txs, result_expected)])
+        assert_equal(self.nodes[0].getmempoolinfo()['size'], mempool_size)
+
+    def run_test(self):
+        node = self.nodes[0]
+        wallet = MiniWallet(node)
+        self.script_pubkey = hex_str_to_bytes(node.validateaddress(ADDRESS_BCRT1_P2WSH_OP_TRUE)['scriptPubKey'])
+
+        wallet.generate(10)
+        node.generate(100)
+
+        self.log.info('A chain of transactions is accepted as a package')
+        chain = self.make_chain(wallet.get_utxo(), MAX_PACKAGE_COUNT)
+        accepted = {'allowed': True, 'vsize': 96, 'fees': {'base': FEE}}
+        self.check_package_result(chain, [accepted] * len(chain))
+
+        self.log.info('A package may not be larger than {} transactions'.format(MAX_PACKAGE_COUNT))
+        too_long = chain + [self.make_spend(chain[-1]['utxo'])]
+        assert_raises_rpc_error(-8, 'Array must contain between 1 and 25 transactions.', node.testmempoolaccept, [tx['hex'] for tx in too_long])
+        assert_raises_rpc_error(-8, 'Array must contain between 1 and 25 transactions.', node.submitpackage, [tx['hex'] for tx in too_long])
+
+        self.log.info('The transactions of a package must come after those they spend')
+        self.check_package_result(chain[::-1], [{'allowed': False, 'reject-reason': 'package-not-sorted'}] * len(chain))
+
+        self.log.info('The transactions of a package may not spend the same output')
+        utxo = wallet.get_utxo()
+        double_spends = [self.make_spend(utxo), self.make_spend(utxo, fee=2 * FEE)]
+        self.check_package_result(double_spends, [{'allowed': False, 'reject-reason': 'conflict-in-package'}] * 2)
+
+        self.log.info('A package is rejected with the reason of its invalid transaction')
+        parent = self.make_spend(wallet.get_utxo())
+        bad_child = self.make_spend(parent['utxo'], vout=1)
+        self.check_package_result([parent, bad_child], [{}, {'allowed': False, 'reject-reason': 'missing-inputs'}])
+        assert_raises_rpc_error(-25, bad_child['txid'], node.submitpackage, [parent['hex'], bad_child['hex']])
+        assert_equal(node.getrawmempool(), [])
+
+        self.log.info('The ancestor limit applies to the package and its mempool ancestors')
+        mempool_parent = wallet.send_self_transfer(from_node=node)
+        long_chain = self.make_chain(wallet.get_utxo(txid=mempool_parent['txid']), MAX_PACKAGE_COUNT)
+        self.check_package_result(long_chain, [{'allowed': False, 'reject-reason': 'too-long-mempool-chain'}] * len(long_chain))
+        self.check_package_result(long_chain[:-1], [accepted] * (len(long_chain) - 1))
+
+        self.log.info('A package paying too high a fee rate is rejected')
+        high_fee = self.make_chain(wallet.get_utxo(), 2)
+        high_fee.append(self.make_spend(high_fee[-1]['utxo'], fee=Decimal("0.02")))
+        self.check_package_result(high_fee, [accepted, accepted, {'allowed': False, 'reject-reason': 'max-fee-exceeded'}])
+        assert_raises_rpc_error(-25, high_fee[-1]['txid'], node.submitpackage, [tx['hex'] for tx in high_fee])
+        assert_equal(node.getrawmempool(), [mempool_parent['txid']])
+
+        self.log.info('A transaction of the package already in the mempool is skipped')
+        parent, child = self.make_chain(wallet.get_utxo(), 2)
+        node.sendrawtransaction(parent['hex'])
+        self.check_package_result([parent, child], [accepted] * 2)
+        assert_equal(node.submitpackage([parent['hex'], child['hex']]), [parent['txid'], child['txid']])
+        assert_equal(node.getmempoolentry(child['txid'])['ancestorcount'], 2)
+        node.generate(1)
+        assert_equal(node.getrawmempool(), [])
+
+        self.log.info('The ancestor limit counts the transactions of the package in the mempool')
+        mempool_parent = wallet.send_self_transfer(from_node=node)
+        long_chain = self.make_chain(wallet.get_utxo(txid=mempool_parent['txid']), MAX_PACKAGE_COUNT)
+        node.sendrawtransaction(long_chain[0]['hex'])
+        self.check_package_result(long_chain, [{'allowed': False, 'reject-reason': 'too-long-mempool-chain'}] * len(long_chain))
+        self.check_package_result(long_chain[:-1], [accepted] * (len(long_chain) - 1))
+
+        self.log.info('A package is submitted to the mempool at once')
+        assert_equal(node.submitpackage([tx['hex'] for tx in chain]), [tx['txid'] for tx in chain])
+        assert_equal(sorted(node.getrawmempool()), sorted([tx['txid'] for tx in chain] + [mempool_parent['txid'], long_chain[0]['txid']]))
+        assert_equal(node.getmempoolentry(chain[-1]['txid'])['ancestorcount'], MAX_PACKAGE_COUNT)
+        node.generate(1)
+        assert_equal(node.getrawmempool(), [])
+
+
+if __name__ == '__main__':
+    MempoolPackageAcceptTest().main()
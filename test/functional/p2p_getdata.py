@@ -7,20 +7,25 @@ from collections import defaultdict
 
 from test_framework.messages import (
     CInv,
+    MSG_BLOCK,
+    MSG_WITNESS_FLAG,
     msg_getdata,
 )
-from test_framework.p2p import P2PInterface
+from test_framework.p2p import P2PInterface, p2p_lock
 from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
 
 
 class P2PStoreBlock(P2PInterface):
     def __init__(self):
         super().__init__()
         self.blocks = defaultdict(int)
+        self.block_data = {}
 
     def on_block(self, message):
         message.block.calc_sha256()
         self.blocks[message.block.sha256] += 1
+        self.block_data[message.block.sha256] = message.block.serialize().hex()
 
 
 class GetdataTest(BitcoinTestFramework):
@@ -44,6 +49,25 @@ class GetdataTest(BitcoinTestFramework):
         p2p_block_store.send_and_ping(good_getdata)
         p2p_block_store.wait_until(lambda: p2p_block_store.blocks[best_block] == 1)
 
+        self.log.info("test that old blocks are served from disk")
+        # Restart, so that no block is in the cache of recent blocks, and use
+        # a small send buffer so that sending pauses after every block
+        self.restart_node(0, extra_args=['-maxsendbuffer=1'])
+        p2p_block_store = self.nodes[0].add_p2p_connection(P2PStoreBlock())
+        block_hashes = [self.nodes[0].getblockhash(height) for height in range(1, self.nodes[0].getblockcount() + 1)]
+        for inv_type in [MSG_BLOCK | MSG_WITNESS_FLAG, MSG_BLOCK]:
+            with p2p_lock:
+                p2p_block_store.blocks.clear()
+            getdata = msg_getdata()
+            getdata.inv = [CInv(t=inv_type, h=int(block_hash, 16)) for block_hash in block_hashes]
+            p2p_block_store.send_message(getdata)
+            p2p_block_store.wait_until(lambda: len(p2p_block_store.blocks) == len(block_hashes))
+            for block_hash in block_hashes:
+                assert_equal(p2p_block_store.blocks[int(block_hash, 16)], 1)
+            if inv_type & MSG_WITNESS_FLAG:
+                for block_hash in block_hashes:
+                    assert_equal(p2p_block_store.block_data[int(block_hash, 16)], self.nodes[0].getblock(block_hash, 0))
+
 
 if __name__ == '__main__':
     GetdataTest().main()
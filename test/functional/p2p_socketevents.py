@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the epoll socket events backend.
+
+Peer sockets are edge-triggered with -socketevents=epoll, so readiness that is
+not acted on is not reported again. Check that connections are serviced from
+their first bytes on, that the end of the stream is seen when it comes with the
+last data, and that receiving resumes after it was paused.
+"""
+
+import platform
+import socket
+
+from test_framework.messages import msg_ping
+from test_framework.p2p import MAGIC_BYTES, P2PInterface
+from test_framework.test_framework import BitcoinTestFramework, SkipTest
+from test_framework.util import (
+    assert_equal,
+    p2p_port,
+)
+
+PINGS = 200
+
+
+class SocketEventsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [
+            ['-socketevents=epoll', '-maxreceivebuffer=1'],
+            ['-socketevents=poll'],
+        ]
+
+    def skip_test_if_missing_module(self):
+        if platform.system() != 'Linux':
+            raise SkipTest("epoll is only available on Linux")
+
+    def setup_network(self):
+        self.setup_nodes()
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        self.log.info("Check that new inbound connections are serviced")
+        for _ in range(10):
+            node.add_p2p_connection(P2PInterface())
+        assert_equal(len(node.getpeerinfo()), 10)
+        node.disconnect_p2ps()
+        self.wait_until(lambda: len(node.getpeerinfo()) == 0)
+
+        self.log.info("Check that new outbound connections are serviced")
+        for _ in range(3):
+            self.connect_nodes(0, 1)
+            self.disconnect_nodes(0, 1)
+
+        self.log.info("Check that the end of the stream is seen when it comes with the last data")
+        with node.assert_debug_log(['socket closed for peer']):
+            sock = socket.create_connection(('127.0.0.1', p2p_port(0)))
+            self.wait_until(lambda: len(node.getpeerinfo()) == 1)
+            # Part of a message header, directly followed by the FIN
+            sock.sendall(MAGIC_BYTES[self.chain] + b'version')
+            sock.shutdown(socket.SHUT_WR)
+            # Well before the timeout for peers that don't send a version
+            self.wait_until(lambda: len(node.getpeerinfo()) == 0, timeout=5)
+            sock.close()
+
+        self.log.info("Check that receiving resumes after it was paused")
+        peer = node.add_p2p_connection(P2PInterface())
+        pongs = peer.message_count['pong']
+        # Far more than the receive buffer of 1000 bytes, in one write
+        peer.send_raw_message(b''.join(peer.build_message(msg_ping(nonce)) for nonce in range(1, PINGS + 1)))
+        peer.wait_until(lambda: peer.message_count['pong'] == pongs + PINGS)
+        assert_equal(peer.last_message['pong'].nonce, PINGS)
+
+
+if __name__ == '__main__':
+    SocketEventsTest().main()
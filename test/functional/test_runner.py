@@ -221,6 +221,7 @@ BASE_SCRIPTS = [
     'feature_nulldummy.py',
     'feature_nulldummy.py --descriptors',
     'mempool_accept.py',
+    'mempool_package_accept.py',
     'mempool_expiry.py',
     'wallet_import_rescan.py --legacy-wallet',
     'wallet_import_with_label.py --legacy-wallet',
@@ -248,6 +249,7 @@ BASE_SCRIPTS = [
     'wallet_fallbackfee.py',
     'wallet_fallbackfee.py --descriptors',
     'rpc_dumptxoutset.py',
+    'feature_assumeutxo.py',
     'feature_minchainwork.py',
     'rpc_estimatefee.py',
     'rpc_getblockstats.py',
@@ -270,6 +272,7 @@ BASE_SCRIPTS = [
     'rpc_deriveaddresses.py',
     'rpc_deriveaddresses.py --usecli',
     'p2p_ping.py',
+    'p2p_socketevents.py',
     'rpc_scantxoutset.py',
     'feature_logging.py',
     'p2p_node_network_limited.py',